@@ -0,0 +1,169 @@
+#ifndef HARNESS_HPP
+#define HARNESS_HPP
+
+#include "perf_counters.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+/*
+    Minimal microbenchmark harness.
+
+    A kernel processes a whole batch of pre-generated inputs and returns how many of
+    them were "hits" (whatever that means for the kernel: rays that hit, scatters that
+    produced a ray, ...). The count is both reported as a ratio and used as a sink, so
+    the compiler can't drop the work.
+
+    Each benchmark is first calibrated to find how many batches fit in the minimum time,
+    then timed over several trials; the fastest trial is kept, since noise only ever
+    makes a run slower.
+*/
+
+// Stops the compiler from optimizing away a value computed by a kernel
+template<typename T>
+inline void do_not_optimize(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const T* sink;
+    sink = &value;
+#endif
+}
+
+struct BenchmarkResult
+{
+    std::string name;
+    std::size_t batch_size;
+    std::uint64_t batches;
+    double nanoseconds_per_item;
+    // Negative for kernels without a meaningful hit count
+    double hit_ratio;
+    // Hardware counters per item, when Microbenchmarks::counters is set and available
+    bool has_counters{false};
+    std::array<double, PerfCounters::CounterCount> counters_per_item{};
+};
+
+class Microbenchmarks
+{
+public:
+    using Kernel = std::function<std::size_t()>;
+
+    // Seconds spent in each timed trial
+    double min_seconds{0.2};
+    int trials{5};
+    // If set, hardware counters are read over all the timed trials
+    PerfCounters* counters{nullptr};
+
+    void add(const std::string& name, std::size_t batch_size, Kernel kernel, bool counts_hits = true);
+
+    // Runs the benchmarks whose name contains filter (all of them if it's empty)
+    std::vector<BenchmarkResult> run(const std::string& filter, const std::function<void(const BenchmarkResult&)>& on_result) const;
+private:
+    struct Entry
+    {
+        std::string name;
+        std::size_t batch_size;
+        Kernel kernel;
+        bool counts_hits;
+    };
+
+    std::vector<Entry> entries;
+
+    BenchmarkResult measure(const Entry& entry) const;
+};
+
+void Microbenchmarks::add(const std::string& name, std::size_t batch_size, Kernel kernel, bool counts_hits)
+{
+    entries.push_back(Entry{name, batch_size, std::move(kernel), counts_hits});
+}
+
+std::vector<BenchmarkResult> Microbenchmarks::run(const std::string& filter, const std::function<void(const BenchmarkResult&)>& on_result) const
+{
+    std::vector<BenchmarkResult> results;
+
+    for (const auto& entry: entries)
+    {
+        if (!filter.empty() && entry.name.find(filter) == std::string::npos)
+        {
+            continue;
+        }
+
+        results.push_back(measure(entry));
+        on_result(results.back());
+    }
+
+    return results;
+}
+
+BenchmarkResult Microbenchmarks::measure(const Entry& entry) const
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Calibration: double the number of batches until a run lasts a tenth of the trial time
+    std::uint64_t batches = 1;
+    std::size_t hits = 0;
+    for (;;)
+    {
+        const auto start = Clock::now();
+        for (std::uint64_t batch = 0; batch < batches; ++batch)
+        {
+            hits = entry.kernel();
+            do_not_optimize(hits);
+        }
+
+        const auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (seconds >= 0.1 * min_seconds)
+        {
+            batches = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(batches * min_seconds / seconds));
+            break;
+        }
+        batches *= 2;
+    }
+
+    const bool counting = counters && counters->available();
+    if (counting)
+    {
+        counters->start();
+    }
+
+    auto best_seconds = std::numeric_limits<double>::infinity();
+    for (int trial = 0; trial < trials; ++trial)
+    {
+        const auto start = Clock::now();
+        for (std::uint64_t batch = 0; batch < batches; ++batch)
+        {
+            do_not_optimize(entry.kernel());
+        }
+        best_seconds = std::min(best_seconds, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+
+    BenchmarkResult result;
+    result.name = entry.name;
+    result.batch_size = entry.batch_size;
+    result.batches = batches;
+    result.nanoseconds_per_item = 1e9 * best_seconds / (static_cast<double>(batches) * entry.batch_size);
+    result.hit_ratio = entry.counts_hits ? static_cast<double>(hits) / entry.batch_size : -1.0;
+
+    if (counting)
+    {
+        counters->stop();
+        const auto items = static_cast<double>(trials) * batches * entry.batch_size;
+        result.has_counters = true;
+        for (int counter = 0; counter < PerfCounters::CounterCount; ++counter)
+        {
+            result.counters_per_item[counter] = counters->value(static_cast<PerfCounters::Counter>(counter)) / items;
+        }
+    }
+
+    return result;
+}
+
+#endif // HARNESS_HPP
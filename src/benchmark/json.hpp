@@ -0,0 +1,328 @@
+#ifndef JSON_HPP
+#define JSON_HPP
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+    Minimal JSON document used by the benchmark reports: null, booleans, numbers,
+    strings, arrays and objects (which keep their insertion order). It only needs to
+    read back what write() produces, so string escapes are limited to \" \\ \n \t.
+*/
+class JsonValue
+{
+public:
+    enum class Type { Null, Boolean, Number, String, Array, Object };
+
+    Type type{Type::Null};
+    bool boolean{false};
+    double number{0.0};
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue>> object;
+
+    JsonValue() {}
+    JsonValue(bool value): type{Type::Boolean}, boolean{value} {}
+    JsonValue(double value): type{Type::Number}, number{value} {}
+    JsonValue(const std::string& value): type{Type::String}, string{value} {}
+    JsonValue(const char* value): type{Type::String}, string{value} {}
+
+    static JsonValue make_array();
+    static JsonValue make_object();
+
+    // Adds a member to an object (or replaces it if the key already exists)
+    JsonValue& set(const std::string& key, const JsonValue& value);
+    void push_back(const JsonValue& value);
+    // Returns nullptr if this isn't an object or has no such member
+    const JsonValue* find(const std::string& key) const;
+
+    void write(std::ostream& out, int indent = 0) const;
+
+    // Returns false if text isn't a valid document
+    static bool parse(const std::string& text, JsonValue& value);
+private:
+    static bool parse_value(const std::string& text, std::size_t& position, JsonValue& value);
+    static bool parse_string(const std::string& text, std::size_t& position, std::string& value);
+    static void skip_whitespace(const std::string& text, std::size_t& position);
+    static void write_string(std::ostream& out, const std::string& value);
+};
+
+JsonValue JsonValue::make_array()
+{
+    JsonValue value;
+    value.type = Type::Array;
+    return value;
+}
+
+JsonValue JsonValue::make_object()
+{
+    JsonValue value;
+    value.type = Type::Object;
+    return value;
+}
+
+JsonValue& JsonValue::set(const std::string& key, const JsonValue& value)
+{
+    for (auto& member: object)
+    {
+        if (member.first == key)
+        {
+            member.second = value;
+            return member.second;
+        }
+    }
+
+    object.emplace_back(key, value);
+    return object.back().second;
+}
+
+void JsonValue::push_back(const JsonValue& value)
+{
+    array.push_back(value);
+}
+
+const JsonValue* JsonValue::find(const std::string& key) const
+{
+    if (type != Type::Object)
+    {
+        return nullptr;
+    }
+
+    for (const auto& member: object)
+    {
+        if (member.first == key)
+        {
+            return &member.second;
+        }
+    }
+
+    return nullptr;
+}
+
+void JsonValue::write(std::ostream& out, int indent) const
+{
+    const std::string padding(indent + 2, ' ');
+
+    switch (type)
+    {
+    case Type::Null:
+        out << "null";
+        break;
+    case Type::Boolean:
+        out << (boolean ? "true" : "false");
+        break;
+    case Type::Number:
+    {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.17g", number);
+        out << buffer;
+        break;
+    }
+    case Type::String:
+        write_string(out, string);
+        break;
+    case Type::Array:
+        out << "[";
+        for (std::size_t i = 0; i < array.size(); ++i)
+        {
+            out << (i == 0 ? "\n" : ",\n") << padding;
+            array[i].write(out, indent + 2);
+        }
+        out << (array.empty() ? "]" : "\n" + std::string(indent, ' ') + "]");
+        break;
+    case Type::Object:
+        out << "{";
+        for (std::size_t i = 0; i < object.size(); ++i)
+        {
+            out << (i == 0 ? "\n" : ",\n") << padding;
+            write_string(out, object[i].first);
+            out << ": ";
+            object[i].second.write(out, indent + 2);
+        }
+        out << (object.empty() ? "}" : "\n" + std::string(indent, ' ') + "}");
+        break;
+    }
+}
+
+void JsonValue::write_string(std::ostream& out, const std::string& value)
+{
+    out << '"';
+    for (auto character: value)
+    {
+        switch (character)
+        {
+        case '"': out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        case '\n': out << "\\n"; break;
+        case '\t': out << "\\t"; break;
+        default: out << character;
+        }
+    }
+    out << '"';
+}
+
+bool JsonValue::parse(const std::string& text, JsonValue& value)
+{
+    std::size_t position = 0;
+    if (!parse_value(text, position, value))
+    {
+        return false;
+    }
+
+    skip_whitespace(text, position);
+    return position == text.size();
+}
+
+void JsonValue::skip_whitespace(const std::string& text, std::size_t& position)
+{
+    while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position])))
+    {
+        ++position;
+    }
+}
+
+bool JsonValue::parse_string(const std::string& text, std::size_t& position, std::string& value)
+{
+    if (position >= text.size() || text[position] != '"')
+    {
+        return false;
+    }
+
+    value.clear();
+    for (++position; position < text.size(); ++position)
+    {
+        auto character = text[position];
+        if (character == '"')
+        {
+            ++position;
+            return true;
+        }
+
+        if (character == '\\' && position + 1 < text.size())
+        {
+            character = text[++position];
+            character = character == 'n' ? '\n' : character == 't' ? '\t' : character;
+        }
+
+        value += character;
+    }
+
+    return false;
+}
+
+bool JsonValue::parse_value(const std::string& text, std::size_t& position, JsonValue& value)
+{
+    skip_whitespace(text, position);
+    if (position >= text.size())
+    {
+        return false;
+    }
+
+    const auto character = text[position];
+
+    if (character == '{')
+    {
+        value = make_object();
+        ++position;
+        skip_whitespace(text, position);
+        if (position < text.size() && text[position] == '}')
+        {
+            ++position;
+            return true;
+        }
+
+        while (true)
+        {
+            std::string key;
+            JsonValue member;
+            skip_whitespace(text, position);
+            if (!parse_string(text, position, key))
+            {
+                return false;
+            }
+
+            skip_whitespace(text, position);
+            if (position >= text.size() || text[position++] != ':' || !parse_value(text, position, member))
+            {
+                return false;
+            }
+
+            value.object.emplace_back(key, member);
+            skip_whitespace(text, position);
+            if (position < text.size() && text[position] == ',')
+            {
+                ++position;
+                continue;
+            }
+
+            return position < text.size() && text[position++] == '}';
+        }
+    }
+
+    if (character == '[')
+    {
+        value = make_array();
+        ++position;
+        skip_whitespace(text, position);
+        if (position < text.size() && text[position] == ']')
+        {
+            ++position;
+            return true;
+        }
+
+        while (true)
+        {
+            JsonValue element;
+            if (!parse_value(text, position, element))
+            {
+                return false;
+            }
+
+            value.array.push_back(element);
+            skip_whitespace(text, position);
+            if (position < text.size() && text[position] == ',')
+            {
+                ++position;
+                continue;
+            }
+
+            return position < text.size() && text[position++] == ']';
+        }
+    }
+
+    if (character == '"')
+    {
+        value = JsonValue{""};
+        return parse_string(text, position, value.string);
+    }
+
+    for (const auto& literal: {std::make_pair("true", JsonValue{true}), std::make_pair("false", JsonValue{false}), std::make_pair("null", JsonValue{})})
+    {
+        const std::string word{literal.first};
+        if (text.compare(position, word.size(), word) == 0)
+        {
+            value = literal.second;
+            position += word.size();
+            return true;
+        }
+    }
+
+    const char* begin = text.c_str() + position;
+    char* end = nullptr;
+    const auto number = std::strtod(begin, &end);
+    if (end == begin)
+    {
+        return false;
+    }
+
+    value = JsonValue{number};
+    position += end - begin;
+    return true;
+}
+
+#endif // JSON_HPP
@@ -0,0 +1,522 @@
+#include "aabb.hpp"
+#include "aarect.hpp"
+#include "bvh.hpp"
+#include "harness.hpp"
+#include "hittable_list.hpp"
+#include "json.hpp"
+#include "material.hpp"
+#include "moving_sphere.hpp"
+#include "perlin.hpp"
+#include "sphere.hpp"
+#include "texture.hpp"
+#include "util.hpp"
+#include "vector3.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+    Microbenchmarks of the hottest kernels: ray-primitive and ray-box intersection,
+    BVH traversal (of single rays and of ray packets), Perlin turbulence, image texture lookups, material scattering and
+    random sampling.
+
+    Inputs are generated up front with a fixed seed, so every run sees the same batch;
+    ray batches come from a shell around the target and are aimed at a box a bit larger
+    than it, so a realistic share of the rays miss. The measured hit ratio is reported
+    next to the time per item.
+
+    Usage:
+        microbench [--filter SUBSTRING] [--min-time SECONDS] [--batch N] [--output FILE] [--perf]
+
+    --perf adds hardware counters per item (cycles, instructions, cache and branch misses)
+    where perf_event_open is allowed.
+*/
+
+constexpr std::uint64_t seed{20240601};
+
+/*
+    Rays starting on a sphere of radius distance around the origin and aimed at a random
+    point of the cube [-extent; extent]^3, with random times in [0; 1[.
+*/
+std::vector<Ray> make_rays(std::size_t count, double distance, double extent)
+{
+    std::vector<Ray> rays;
+    rays.reserve(count);
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const auto origin = distance * random_unit_vector();
+        const Point3 target{random_double(-extent, extent), random_double(-extent, extent), random_double(-extent, extent)};
+        rays.emplace_back(origin, target - origin, random_double());
+    }
+
+    return rays;
+}
+
+/*
+    Pinhole camera rays from (0, 0, distance) through a square grid of pixels covering
+    [-extent; extent]^2 in the plane z = 0, at time 0. The pixels are ordered by blocks of
+    4x4, so consecutive rays are as coherent as the ones of a packet in the renderer.
+*/
+std::vector<Ray> make_camera_rays(std::size_t count, double distance, double extent)
+{
+    const auto width = std::max<std::size_t>(4, static_cast<std::size_t>(std::sqrt(static_cast<double>(count))) / 4 * 4);
+    const Point3 origin{0, 0, distance};
+    std::vector<Ray> rays;
+    rays.reserve(width * width);
+
+    for (std::size_t block_row = 0; block_row < width; block_row += 4)
+    {
+        for (std::size_t block_column = 0; block_column < width; block_column += 4)
+        {
+            for (std::size_t i = 0; i < 16; ++i)
+            {
+                const auto x = extent * (2.0 * (block_column + i % 4 + 0.5) / width - 1.0);
+                const auto y = extent * (2.0 * (block_row + i / 4 + 0.5) / width - 1.0);
+                rays.emplace_back(origin, Point3{x, y, 0} - origin, 0.0);
+            }
+        }
+    }
+
+    return rays;
+}
+
+// Number of rays of the batch that hit the object
+std::size_t hit_batch(const Hittable& object, const std::vector<Ray>& rays)
+{
+    std::size_t hits = 0;
+    HitRecord record;
+
+    for (const auto& ray: rays)
+    {
+        hits += object.hit(ray, min_hit_parameter, infinity, record);
+    }
+
+    return hits;
+}
+
+// Same as hit_batch with occlusion queries
+std::size_t occluded_batch(const Hittable& object, const std::vector<Ray>& rays)
+{
+    std::size_t hits = 0;
+
+    for (const auto& ray: rays)
+    {
+        hits += object.occluded(ray, min_hit_parameter, infinity);
+    }
+
+    return hits;
+}
+
+// Same as hit_batch with packets of packet_size consecutive rays; the batch size must be a multiple of it
+std::size_t packet_hit_batch(const Hittable& object, const std::vector<Ray>& rays, int packet_size)
+{
+    std::size_t hits = 0;
+    RayPacket packet;
+    packet.size = packet_size;
+    PacketHits packet_hits;
+    const auto all_lanes = static_cast<std::uint32_t>((1ull << packet_size) - 1);
+
+    for (std::size_t first = 0; first + packet_size <= rays.size(); first += packet_size)
+    {
+        std::copy(rays.begin() + first, rays.begin() + first + packet_size, packet.rays);
+        packet.prepare(all_lanes);
+        packet_hits.reset(infinity);
+
+        object.hit_packet(packet, all_lanes, min_hit_parameter, packet_hits);
+        hits += RayPacket::count(packet_hits.hit_lanes);
+    }
+
+    return hits;
+}
+
+struct ShadingInput
+{
+    Ray ray;
+    HitRecord record;
+};
+
+// Hit records on a unit sphere, as the materials would see them while rendering
+std::vector<ShadingInput> make_shading_inputs(std::size_t count)
+{
+    const Sphere sphere{Point3{0, 0, 0}, 1.0, std::make_shared<Lambertian>(Color{0.5, 0.5, 0.5})};
+    std::vector<ShadingInput> inputs;
+    inputs.reserve(count);
+
+    while (inputs.size() < count)
+    {
+        for (const auto& ray: make_rays(count, 4.0, 1.0))
+        {
+            ShadingInput input{ray, HitRecord{}};
+            if (inputs.size() < count && sphere.hit(ray, min_hit_parameter, infinity, input.record))
+            {
+                finish_hit(ray, input.record);
+                inputs.push_back(input);
+            }
+        }
+    }
+
+    return inputs;
+}
+
+std::size_t scatter_batch(const Material& material, const std::vector<ShadingInput>& inputs)
+{
+    std::size_t scattered = 0;
+    Color attenuation;
+    Ray scattered_ray;
+
+    for (const auto& input: inputs)
+    {
+        scattered += material.scatter(input.ray, input.record, attenuation, scattered_ray);
+        do_not_optimize(scattered_ray);
+    }
+
+    return scattered;
+}
+
+/*
+    Random spheres in [-5; 5]^3 for BVH traversal. The radius shrinks as 1/sqrt(count) so
+    the projected area of all the spheres, hence the share of rays that hit, stays about
+    the same whatever the size of the tree. With a non-zero motion, the spheres move over
+    [0; 1] by a random vector up to motion times their radius long.
+*/
+HittableList make_sphere_soup(int count, double motion = 0.0)
+{
+    HittableList list;
+    const auto radius = 6.0 / std::sqrt(count);
+    auto material = std::make_shared<Lambertian>(Color{0.5, 0.5, 0.5});
+
+    for (int i = 0; i < count; ++i)
+    {
+        const Point3 center{random_double(-5, 5), random_double(-5, 5), random_double(-5, 5)};
+        const auto sphere_radius = radius * random_double(0.5, 1.0);
+        if (motion > 0.0)
+        {
+            const auto end_center = center + motion * sphere_radius * random_double() * random_unit_vector();
+            list.add(std::make_shared<MovingSphere>(center, end_center, 0.0, 1.0, sphere_radius, material));
+        }
+        else
+        {
+            list.add(std::make_shared<Sphere>(center, sphere_radius, material));
+        }
+    }
+
+    return list;
+}
+
+// Writes a 1024x1024 binary PPM with a smooth pattern, so the image benchmark doesn't depend on a texture file
+std::string write_test_image()
+{
+    const auto filename = (std::filesystem::temp_directory_path() / "rt_microbench_texture.ppm").string();
+    constexpr int size{1024};
+
+    std::ofstream file{filename, std::ios::binary};
+    file << "P6\n" << size << " " << size << "\n255\n";
+    for (int y = 0; y < size; ++y)
+    {
+        for (int x = 0; x < size; ++x)
+        {
+            const char pixel[3] = {static_cast<char>(x & 255), static_cast<char>(y & 255), static_cast<char>((x ^ y) & 255)};
+            file.write(pixel, 3);
+        }
+    }
+
+    return filename;
+}
+
+int main(int argc, char* argv[])
+{
+    Microbenchmarks benchmarks;
+    std::string filter;
+    std::string output_filename;
+    std::size_t batch_size{4096};
+    bool use_perf_counters{false};
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string argument{argv[i]};
+        const bool has_value = i + 1 < argc;
+
+        if (argument == "--filter" && has_value)
+        {
+            filter = argv[++i];
+        }
+        else if (argument == "--min-time" && has_value)
+        {
+            benchmarks.min_seconds = std::stod(argv[++i]);
+        }
+        else if (argument == "--batch" && has_value)
+        {
+            batch_size = std::stoul(argv[++i]);
+        }
+        else if (argument == "--output" && has_value)
+        {
+            output_filename = argv[++i];
+        }
+        else if (argument == "--perf")
+        {
+            use_perf_counters = true;
+        }
+        else
+        {
+            std::cerr << "Usage: microbench [--filter SUBSTRING] [--min-time SECONDS] [--batch N] [--output FILE] [--perf]\n";
+            return 2;
+        }
+    }
+
+    PerfCounters perf_counters;
+    if (use_perf_counters)
+    {
+        if (perf_counters.available())
+        {
+            benchmarks.counters = &perf_counters;
+        }
+        else
+        {
+            std::cerr << "Hardware counters unavailable (" << perf_counters.error() << "), timing only\n";
+        }
+    }
+
+    seed_random(seed);
+
+    // Intersection of single primitives: rays aimed at a box 1.5 times the size of the primitive
+    const auto rays = make_rays(batch_size, 4.0, 1.5);
+    auto material = std::make_shared<Lambertian>(Color{0.5, 0.5, 0.5});
+    const Sphere sphere{Point3{0, 0, 0}, 1.0, material};
+    const MovingSphere moving_sphere{Point3{-0.25, 0, 0}, Point3{0.25, 0, 0}, 0.0, 1.0, 1.0, material};
+    const XYRect rectangle{-1, 1, -1, 1, 0, material};
+    const AABB box{Point3{-1, -1, -1}, Point3{1, 1, 1}};
+
+    benchmarks.add("sphere_hit", rays.size(), [&] { return hit_batch(sphere, rays); });
+    benchmarks.add("moving_sphere_hit", rays.size(), [&] { return hit_batch(moving_sphere, rays); });
+    benchmarks.add("xy_rect_hit", rays.size(), [&] { return hit_batch(rectangle, rays); });
+    benchmarks.add("aabb_hit", rays.size(), [&]
+    {
+        std::size_t hits = 0;
+        for (const auto& ray: rays)
+        {
+            hits += box.hit(ray, min_hit_parameter, infinity);
+        }
+        return hits;
+    });
+
+    // BVH traversal over synthetic trees of increasing size
+    const auto scene_rays = make_rays(batch_size, 12.0, 5.0);
+    std::vector<std::shared_ptr<BVHNode>> trees;
+    for (int count: {64, 1024, 16384})
+    {
+        const auto tree = std::make_shared<BVHNode>(make_sphere_soup(count), 0.0, 1.0);
+        trees.push_back(tree);
+        benchmarks.add("bvh_hit_" + std::to_string(count), scene_rays.size(), [&, tree] { return hit_batch(*tree, scene_rays); });
+        benchmarks.add("bvh_occluded_" + std::to_string(count), scene_rays.size(), [&, tree] { return occluded_batch(*tree, scene_rays); });
+    }
+
+    // Motion blur: spheres moving up to 4 radii over the shutter, which the rays sample at random times
+    const auto moving_spheres = make_sphere_soup(1024, 4.0);
+    const auto moving_tree = std::make_shared<BVHNode>(moving_spheres, 0.0, 1.0);
+    const auto motion_tree = std::make_shared<MotionBVH>(moving_spheres, 0.0, 1.0);
+    benchmarks.add("bvh_motion_hit_1024", scene_rays.size(), [&, moving_tree] { return hit_batch(*moving_tree, scene_rays); });
+    benchmarks.add("motion_bvh_hit_1024", scene_rays.size(), [&, motion_tree] { return hit_batch(*motion_tree, scene_rays); });
+
+    // Coherent camera rays, one at a time and in packets, through the largest tree
+    const auto camera_rays = make_camera_rays(batch_size, 12.0, 5.0);
+    const auto& camera_tree = *trees.back();
+    benchmarks.add("bvh_camera_hit_16384", camera_rays.size(), [&] { return hit_batch(camera_tree, camera_rays); });
+    for (int packet_size: {4, 8, 16})
+    {
+        benchmarks.add("bvh_packet" + std::to_string(packet_size) + "_hit_16384", camera_rays.size(), [&, packet_size]
+        {
+            return packet_hit_batch(camera_tree, camera_rays, packet_size);
+        });
+    }
+
+    // Noise and textures
+    const Perlin perlin;
+    std::vector<Point3> noise_points(batch_size);
+    std::vector<double> noise_values(batch_size);
+    for (auto& point: noise_points)
+    {
+        point = 4.0 * Point3{random_double(), random_double(), random_double()};
+    }
+
+    benchmarks.add("perlin_turbulence", noise_points.size(), [&]
+    {
+        double sum = 0.0;
+        for (const auto& point: noise_points)
+        {
+            sum += perlin.turbulence(point);
+        }
+        return static_cast<std::size_t>(sum);
+    }, false);
+    benchmarks.add("perlin_turbulence_batch", noise_points.size(), [&]
+    {
+        perlin.turbulence(noise_points.data(), noise_values.data(), noise_points.size());
+        return static_cast<std::size_t>(noise_values[0] > 0.0);
+    }, false);
+
+    const ImageTexture image{write_test_image()};
+    std::vector<double> texture_coordinates(2 * batch_size);
+    std::vector<double> footprints(batch_size);
+    for (std::size_t i = 0; i < batch_size; ++i)
+    {
+        texture_coordinates[2 * i] = random_double();
+        texture_coordinates[2 * i + 1] = random_double();
+        // Footprints from a texel to a hundred texels wide
+        footprints[i] = std::pow(100.0, random_double()) / 1024.0;
+    }
+
+    benchmarks.add("image_texture_value", batch_size, [&]
+    {
+        double sum = 0.0;
+        for (std::size_t i = 0; i < batch_size; ++i)
+        {
+            sum += image.value(texture_coordinates[2 * i], texture_coordinates[2 * i + 1], Point3{}).x();
+        }
+        return static_cast<std::size_t>(sum);
+    }, false);
+    benchmarks.add("image_texture_filtered_value", batch_size, [&]
+    {
+        double sum = 0.0;
+        for (std::size_t i = 0; i < batch_size; ++i)
+        {
+            sum += image.filtered_value(texture_coordinates[2 * i], texture_coordinates[2 * i + 1], Point3{}, footprints[i]).x();
+        }
+        return static_cast<std::size_t>(sum);
+    }, false);
+
+    // Materials
+    const auto shading_inputs = make_shading_inputs(batch_size);
+    const Lambertian lambertian{Color{0.5, 0.5, 0.5}};
+    const Metal metal{Color{0.8, 0.8, 0.8}, 0.3};
+    const Dielectric dielectric{1.5};
+    const DiffuseLight diffuse_light{Color{4, 4, 4}};
+    const Isotropic isotropic{Color{0.5, 0.5, 0.5}};
+
+    benchmarks.add("scatter_lambertian", shading_inputs.size(), [&] { return scatter_batch(lambertian, shading_inputs); });
+    benchmarks.add("scatter_metal", shading_inputs.size(), [&] { return scatter_batch(metal, shading_inputs); });
+    benchmarks.add("scatter_dielectric", shading_inputs.size(), [&] { return scatter_batch(dielectric, shading_inputs); });
+    benchmarks.add("scatter_diffuse_light", shading_inputs.size(), [&] { return scatter_batch(diffuse_light, shading_inputs); });
+    benchmarks.add("scatter_isotropic", shading_inputs.size(), [&] { return scatter_batch(isotropic, shading_inputs); });
+
+    // Sampling
+    benchmarks.add("random_in_unit_sphere", batch_size, [&]
+    {
+        double sum = 0.0;
+        for (std::size_t i = 0; i < batch_size; ++i)
+        {
+            sum += random_in_unit_sphere().x();
+        }
+        return static_cast<std::size_t>(sum + batch_size);
+    }, false);
+
+    // Vector math, on the directions and normals of the shading inputs
+    benchmarks.add("vector_unit_vector", shading_inputs.size(), [&]
+    {
+        double sum = 0.0;
+        for (const auto& input: shading_inputs)
+        {
+            sum += unit_vector(input.ray.direction()).z();
+        }
+        return static_cast<std::size_t>(std::fabs(sum));
+    }, false);
+    benchmarks.add("vector_cross", shading_inputs.size(), [&]
+    {
+        double sum = 0.0;
+        for (const auto& input: shading_inputs)
+        {
+            sum += cross(input.ray.direction(), input.record.normal).z();
+        }
+        return static_cast<std::size_t>(std::fabs(sum));
+    }, false);
+    benchmarks.add("vector_reflect", shading_inputs.size(), [&]
+    {
+        double sum = 0.0;
+        for (const auto& input: shading_inputs)
+        {
+            sum += reflect(unit_vector(input.ray.direction()), input.record.normal).z();
+        }
+        return static_cast<std::size_t>(std::fabs(sum));
+    }, false);
+    benchmarks.add("vector_refract", shading_inputs.size(), [&]
+    {
+        double sum = 0.0;
+        for (const auto& input: shading_inputs)
+        {
+            sum += refract(unit_vector(input.ray.direction()), input.record.normal, 1.0 / 1.5).z();
+        }
+        return static_cast<std::size_t>(std::fabs(sum));
+    }, false);
+
+    std::printf("%-32s %12s %12s %10s", "benchmark", "ns/item", "Mitems/s", "hit ratio");
+    if (benchmarks.counters)
+    {
+        for (int counter = 0; counter < PerfCounters::CounterCount; ++counter)
+        {
+            std::printf(" %14s", PerfCounters::name(static_cast<PerfCounters::Counter>(counter)));
+        }
+    }
+    std::printf("\n");
+
+    const auto results = benchmarks.run(filter, [](const BenchmarkResult& result)
+    {
+        std::printf("%-32s %12.2f %12.2f ", result.name.c_str(), result.nanoseconds_per_item, 1e3 / result.nanoseconds_per_item);
+        if (result.hit_ratio >= 0.0)
+        {
+            std::printf("%10.3f", result.hit_ratio);
+        }
+        else
+        {
+            std::printf("%10s", "-");
+        }
+
+        for (int counter = 0; result.has_counters && counter < PerfCounters::CounterCount; ++counter)
+        {
+            std::printf(" %14.3f", result.counters_per_item[counter]);
+        }
+        std::printf("\n");
+        std::fflush(stdout);
+    });
+
+    if (!output_filename.empty())
+    {
+        auto report = JsonValue::make_array();
+        for (const auto& result: results)
+        {
+            auto entry = JsonValue::make_object();
+            entry.set("name", result.name);
+            entry.set("batch_size", static_cast<double>(result.batch_size));
+            entry.set("nanoseconds_per_item", result.nanoseconds_per_item);
+            if (result.hit_ratio >= 0.0)
+            {
+                entry.set("hit_ratio", result.hit_ratio);
+            }
+            if (result.has_counters)
+            {
+                auto counters = JsonValue::make_object();
+                for (int counter = 0; counter < PerfCounters::CounterCount; ++counter)
+                {
+                    if (perf_counters.available(static_cast<PerfCounters::Counter>(counter)))
+                    {
+                        counters.set(PerfCounters::name(static_cast<PerfCounters::Counter>(counter)), result.counters_per_item[counter]);
+                    }
+                }
+                entry.set("counters_per_item", counters);
+            }
+            report.push_back(entry);
+        }
+
+        std::ofstream output_file{output_filename};
+        report.write(output_file);
+        output_file << '\n';
+    }
+
+    return 0;
+}
@@ -0,0 +1,201 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+/*
+    Hardware performance counters through Linux perf_event_open: cycles, instructions,
+    L1 data cache read misses, last level cache misses and branch misses, counted in
+    user space for the calling thread and the threads it starts while counting.
+
+    Every counter is opened on its own, so the ones the CPU or the kernel don't provide
+    are simply left out; in containers, VMs or with a restrictive perf_event_paranoid
+    usually none is available, which available() reports. On other systems nothing is
+    ever available.
+
+    When the kernel multiplexes counters, values are scaled by the fraction of the time
+    each counter was actually running.
+*/
+class PerfCounters
+{
+public:
+    enum Counter { Cycles, Instructions, L1DataMisses, LastLevelCacheMisses, BranchMisses, CounterCount };
+
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const;
+    bool available(Counter counter) const;
+
+    void start();
+    void stop();
+
+    // Value counted between the last start and stop
+    double value(Counter counter) const;
+
+    static const char* name(Counter counter);
+    // Why nothing is available, empty otherwise
+    const std::string& error() const;
+private:
+    std::array<int, CounterCount> descriptors;
+    std::array<double, CounterCount> values{};
+    std::string open_error;
+};
+
+PerfCounters::PerfCounters()
+{
+    descriptors.fill(-1);
+
+#ifdef __linux__
+    const std::uint64_t cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    const std::array<std::pair<std::uint32_t, std::uint64_t>, CounterCount> events{{
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cache_read_miss},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    }};
+
+    for (int counter = 0; counter < CounterCount; ++counter)
+    {
+        perf_event_attr attributes;
+        std::memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = events[counter].first;
+        attributes.config = events[counter].second;
+        attributes.disabled = 1;
+        attributes.inherit = 1; // also count the render threads started while counting
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        descriptors[counter] = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+        if (descriptors[counter] < 0 && open_error.empty())
+        {
+            open_error = std::string{"perf_event_open: "} + std::strerror(errno);
+        }
+    }
+
+    if (available())
+    {
+        open_error.clear();
+    }
+#else
+    open_error = "hardware counters are only supported on Linux";
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for (auto descriptor: descriptors)
+    {
+        if (descriptor >= 0)
+        {
+            close(descriptor);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::available() const
+{
+    for (auto descriptor: descriptors)
+    {
+        if (descriptor >= 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PerfCounters::available(Counter counter) const
+{
+    return descriptors[counter] >= 0;
+}
+
+void PerfCounters::start()
+{
+#ifdef __linux__
+    for (auto descriptor: descriptors)
+    {
+        if (descriptor >= 0)
+        {
+            ioctl(descriptor, PERF_EVENT_IOC_RESET, 0);
+            ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+/*
+    Counts of inherited counters only include the threads that already exited, so
+    stop must be called after the worker threads were joined.
+*/
+void PerfCounters::stop()
+{
+#ifdef __linux__
+    for (auto descriptor: descriptors)
+    {
+        if (descriptor >= 0)
+        {
+            ioctl(descriptor, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    for (int counter = 0; counter < CounterCount; ++counter)
+    {
+        values[counter] = 0.0;
+
+        // value, time enabled, time running
+        std::uint64_t data[3];
+        if (descriptors[counter] < 0 || read(descriptors[counter], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)))
+        {
+            continue;
+        }
+
+        values[counter] = data[2] > 0 ? static_cast<double>(data[0]) * data[1] / data[2] : 0.0;
+    }
+#endif
+}
+
+double PerfCounters::value(Counter counter) const
+{
+    return values[counter];
+}
+
+const char* PerfCounters::name(Counter counter)
+{
+    switch (counter)
+    {
+    case Cycles: return "cycles";
+    case Instructions: return "instructions";
+    case L1DataMisses: return "l1d_misses";
+    case LastLevelCacheMisses: return "llc_misses";
+    case BranchMisses: return "branch_misses";
+    default: return "";
+    }
+}
+
+const std::string& PerfCounters::error() const
+{
+    return open_error;
+}
+
+#endif // PERF_COUNTERS_HPP
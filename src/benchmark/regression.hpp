@@ -0,0 +1,324 @@
+#ifndef REGRESSION_HPP
+#define REGRESSION_HPP
+
+#include "bvh.hpp"
+#include "json.hpp"
+#include "renderer.hpp"
+#include "scenes.hpp"
+#include "util.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+    Image and performance regression checks against stored reference renders.
+
+    Updating the references renders every scene twice: a reference at many samples per
+    pixel (with a different seed) saved as <directory>/<scene>.pfm, and a test render at
+    the regular samples per pixel and seed. The error of the test render against the
+    reference, and the time it took, are saved in <directory>/references.json.
+
+    Checking renders the test image again and compares it with the reference:
+
+    - image: its error must stay within (1 + image_tolerance) times the recorded error.
+      The test render is deterministic, so an unchanged tree gives the same error; a change
+      that only consumes random numbers differently gives an error within Monte Carlo
+      noise of the recorded one, while a real bug (bias, missing objects, NaNs) is well
+      beyond it.
+    - time to target error: the samples per pixel are doubled (up to 4 times) until the
+      render is at least as close to the reference as the recorded error, and the time of
+      that render must stay within (1 + time_tolerance) times the recorded time. This
+      catches slower code as well as samplers that converge more slowly. Test renders take
+      a few milliseconds, so a single timing is mostly scheduler noise: both the recorded
+      and the checked times are the best of timing_runs renders, repeated until they add
+      up to timing_seconds. Times only compare on the machine that recorded them, so
+      check_time is off for references made elsewhere (the ones of the repository).
+
+    The error is the RMSE of the displayed values (gamma 2, clamped to [0; 1]), so a few
+    fireflies don't dominate it.
+*/
+struct RegressionOptions
+{
+    std::string directory;
+    int image_width{96};
+    int samples_per_pixel{8};
+    int reference_samples_per_pixel{256};
+    int max_depth{50};
+    std::uint64_t seed{1};
+    unsigned threads{0};
+    int packet_size{0};
+    bool wavefront{false};
+    bool reorder_rays{false};
+    double image_tolerance{0.25};
+    double time_tolerance{0.50};
+    int timing_runs{3};
+    double timing_seconds{0.25};
+    bool check_time{true};
+    std::vector<Scenes> scenes;
+};
+
+// Error of image (a sum of samples_per_pixel samples) against reference (averages)
+double display_rmse(const Framebuffer& image, int samples_per_pixel, const Framebuffer& reference);
+
+// Writes the references and the manifest; returns the process exit code
+int update_references(const RegressionOptions& options);
+// Returns the process exit code: 0 if every scene passed, 1 on regressions, 2 on missing references
+int check_references(const RegressionOptions& options);
+
+double display_rmse(const Framebuffer& image, int samples_per_pixel, const Framebuffer& reference)
+{
+    if (image.width != reference.width || image.height != reference.height)
+    {
+        return infinity;
+    }
+
+    const auto display = [](double value) { return std::sqrt(clamp(value, 0.0, 1.0)); };
+    double sum = 0.0;
+
+    for (std::size_t i = 0; i < image.pixels.size(); ++i)
+    {
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            const auto difference = display(image.pixels[i][channel] / samples_per_pixel) - display(reference.pixels[i][channel]);
+            sum += difference * difference;
+        }
+    }
+
+    // NaNs fail every comparison, so they're reported as an infinite error
+    const auto rmse = std::sqrt(sum / (3.0 * image.pixels.size()));
+    return std::isnan(rmse) ? infinity : rmse;
+}
+
+// Scene ready to render, built with the fixed seed so the world is the same in every run
+struct RegressionScene
+{
+    SceneSettings settings;
+    MotionBVH world;
+    RenderSettings render_settings;
+
+    RegressionScene(Scenes scene, const RegressionOptions& options);
+
+    // Renders with the given samples per pixel and seed; seconds is set to the render time
+    Framebuffer render_image(int samples_per_pixel, std::uint64_t seed, double& seconds) const;
+    // Best render time of at least runs renders, rendering more until they took total_seconds
+    double best_seconds(int samples_per_pixel, std::uint64_t seed, int runs, double total_seconds) const;
+};
+
+RegressionScene::RegressionScene(Scenes scene, const RegressionOptions& options)
+{
+    seed_random(options.seed);
+    settings = scene_settings(scene);
+    world = MotionBVH{settings.world, settings.open_shutter_time, settings.close_shutter_time};
+
+    render_settings.image_width = options.image_width;
+    render_settings.image_height = static_cast<int>(options.image_width / settings.aspect_ratio);
+    render_settings.max_depth = options.max_depth;
+    render_settings.threads = options.threads;
+    render_settings.packet_size = options.packet_size;
+    render_settings.wavefront = options.wavefront;
+    render_settings.reorder_rays = options.reorder_rays;
+}
+
+Framebuffer RegressionScene::render_image(int samples_per_pixel, std::uint64_t seed, double& seconds) const
+{
+    auto image_settings = render_settings;
+    image_settings.samples_per_pixel = samples_per_pixel;
+    image_settings.seed = seed;
+
+    RenderStatistics statistics;
+    auto image = render(world, settings.camera(image_settings.image_height), settings.background, image_settings, &statistics);
+    seconds = statistics.seconds;
+
+    return image;
+}
+
+double RegressionScene::best_seconds(int samples_per_pixel, std::uint64_t seed, int runs, double total_seconds) const
+{
+    auto best = infinity;
+    auto spent = 0.0;
+    for (int run = 0; run < runs || spent < total_seconds; ++run)
+    {
+        double seconds;
+        render_image(samples_per_pixel, seed, seconds);
+        best = std::fmin(best, seconds);
+        spent += seconds;
+    }
+
+    return best;
+}
+
+std::string reference_filename(const RegressionOptions& options, Scenes scene)
+{
+    return (std::filesystem::path{options.directory} / (std::string{scene_name(scene)} + ".pfm")).string();
+}
+
+std::string manifest_filename(const RegressionOptions& options)
+{
+    return (std::filesystem::path{options.directory} / "references.json").string();
+}
+
+int update_references(const RegressionOptions& options)
+{
+    std::filesystem::create_directories(options.directory);
+
+    auto manifest = JsonValue::make_object();
+    manifest.set("image_width", static_cast<double>(options.image_width));
+    manifest.set("samples_per_pixel", static_cast<double>(options.samples_per_pixel));
+    manifest.set("reference_samples_per_pixel", static_cast<double>(options.reference_samples_per_pixel));
+    manifest.set("max_depth", static_cast<double>(options.max_depth));
+    manifest.set("seed", static_cast<double>(options.seed));
+    auto scenes = JsonValue::make_array();
+
+    std::printf("%-30s %10s %12s\n", "scene", "rmse", "seconds");
+    for (auto scene: options.scenes)
+    {
+        const RegressionScene regression_scene{scene, options};
+        if (regression_scene.render_settings.image_height < 1)
+        {
+            std::cerr << "Width " << options.image_width << " gives " << scene_name(scene) << " no rows; use a larger width\n";
+            return 2;
+        }
+
+        double reference_seconds;
+        const auto reference = regression_scene.render_image(options.reference_samples_per_pixel, options.seed + 1, reference_seconds);
+        if (!reference.write_pfm(reference_filename(options, scene), options.reference_samples_per_pixel))
+        {
+            std::cerr << "Unable to write " << reference_filename(options, scene) << "\n";
+            return 2;
+        }
+
+        // Compare against the reference as it was stored, in float
+        Framebuffer stored_reference;
+        Framebuffer::read_pfm(reference_filename(options, scene), stored_reference);
+
+        double seconds;
+        const auto image = regression_scene.render_image(options.samples_per_pixel, options.seed, seconds);
+        const auto rmse = display_rmse(image, options.samples_per_pixel, stored_reference);
+        seconds = regression_scene.best_seconds(options.samples_per_pixel, options.seed, options.timing_runs, options.timing_seconds);
+
+        auto entry = JsonValue::make_object();
+        entry.set("name", scene_name(scene));
+        entry.set("rmse", rmse);
+        entry.set("seconds_to_target", seconds);
+        scenes.push_back(entry);
+
+        std::printf("%-30s %10.5f %12.4f\n", scene_name(scene), rmse, seconds);
+        std::fflush(stdout);
+    }
+
+    manifest.set("scenes", scenes);
+
+    std::ofstream manifest_file{manifest_filename(options)};
+    manifest.write(manifest_file);
+    manifest_file << '\n';
+
+    return manifest_file ? 0 : 2;
+}
+
+int check_references(const RegressionOptions& options)
+{
+    std::ifstream manifest_file{manifest_filename(options)};
+    std::stringstream text;
+    text << manifest_file.rdbuf();
+
+    JsonValue manifest;
+    if (!manifest_file.is_open() || !JsonValue::parse(text.str(), manifest) || !manifest.find("scenes"))
+    {
+        std::cerr << "Unable to read " << manifest_filename(options) << "; create the references with --update-references\n";
+        return 2;
+    }
+
+    // The references only make sense with the settings they were made with
+    auto checked_options = options;
+    const auto setting = [&](const char* key, double fallback)
+    {
+        const auto value = manifest.find(key);
+        return value && value->type == JsonValue::Type::Number ? value->number : fallback;
+    };
+    checked_options.image_width = static_cast<int>(setting("image_width", options.image_width));
+    checked_options.samples_per_pixel = static_cast<int>(setting("samples_per_pixel", options.samples_per_pixel));
+    checked_options.max_depth = static_cast<int>(setting("max_depth", options.max_depth));
+    checked_options.seed = static_cast<std::uint64_t>(setting("seed", static_cast<double>(options.seed)));
+
+    int failures = 0;
+    int missing = 0;
+    std::printf("%-30s %10s %10s %12s %12s %8s\n", "scene", "rmse", "target", "time (s)", "budget (s)", "status");
+
+    for (auto scene: options.scenes)
+    {
+        const JsonValue* expected = nullptr;
+        for (const auto& entry: manifest.find("scenes")->array)
+        {
+            const auto name = entry.find("name");
+            if (name && name->string == scene_name(scene))
+            {
+                expected = &entry;
+            }
+        }
+
+        const auto number = [expected](const char* key)
+        {
+            const auto value = expected ? expected->find(key) : nullptr;
+            return value && value->type == JsonValue::Type::Number ? value : nullptr;
+        };
+        const auto target_value = number("rmse");
+        const auto budget_value = number("seconds_to_target");
+
+        Framebuffer reference;
+        if (!target_value || !budget_value || !Framebuffer::read_pfm(reference_filename(options, scene), reference))
+        {
+            std::printf("%-30s %10s %10s %12s %12s %8s\n", scene_name(scene), "-", "-", "-", "-", "MISSING");
+            ++missing;
+            continue;
+        }
+
+        const auto target = target_value->number;
+        const auto budget = budget_value->number;
+        const RegressionScene regression_scene{scene, checked_options};
+        if (regression_scene.render_settings.image_height < 1)
+        {
+            std::cerr << "Width " << checked_options.image_width << " gives " << scene_name(scene) << " no rows; use a larger width\n";
+            return 2;
+        }
+
+        double seconds;
+        auto samples_per_pixel = checked_options.samples_per_pixel;
+        auto image = regression_scene.render_image(samples_per_pixel, checked_options.seed, seconds);
+        const auto rmse = display_rmse(image, samples_per_pixel, reference);
+        const bool image_passed = rmse <= target * (1.0 + options.image_tolerance) + 1e-6;
+
+        // Time to reach the recorded error, doubling the samples per pixel if needed
+        auto seconds_to_target = seconds;
+        auto reached_rmse = rmse;
+        for (int doubling = 0; doubling < 2 && reached_rmse > target; ++doubling)
+        {
+            samples_per_pixel *= 2;
+            image = regression_scene.render_image(samples_per_pixel, checked_options.seed, seconds);
+            reached_rmse = display_rmse(image, samples_per_pixel, reference);
+        }
+        if (image_passed && options.check_time)
+        {
+            seconds_to_target = regression_scene.best_seconds(samples_per_pixel, checked_options.seed, options.timing_runs, options.timing_seconds);
+        }
+        const bool time_passed = !options.check_time
+            || (reached_rmse <= target * (1.0 + options.image_tolerance) && seconds_to_target <= budget * (1.0 + options.time_tolerance));
+
+        const char* status = !image_passed ? "IMAGE" : !time_passed ? "TIME" : "ok";
+        std::printf("%-30s %10.5f %10.5f %12.4f %12.4f %8s\n", scene_name(scene), rmse, target, seconds_to_target, budget, status);
+        std::fflush(stdout);
+
+        failures += !image_passed || !time_passed;
+    }
+
+    std::printf("\n%d failure(s), %d missing reference(s)\n", failures, missing);
+    return missing > 0 ? 2 : failures > 0 ? 1 : 0;
+}
+
+#endif // REGRESSION_HPP
@@ -0,0 +1,598 @@
+#include "bvh.hpp"
+#include "json.hpp"
+#include "perf_counters.hpp"
+#include "regression.hpp"
+#include "renderer.hpp"
+#include "scenes.hpp"
+#include "trace.hpp"
+#include "util.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+    Benchmark runner: renders every scene (or the ones given with --scene) at a fixed
+    resolution, samples per pixel and seed, and reports for each one the time to build
+    the scene, the time to build the top-level BVH, the primary and secondary rays per
+    second and the total wall time.
+
+    Usage:
+        rtbench [--width N] [--spp N] [--depth N] [--seed N] [--threads N] [--packet 4|8|16] [--wavefront] [--reorder]
+                [--scene NAME]... [--output FILE] [--compare BASELINE] [--tolerance FRACTION]
+                [--trace FILE] [--perf]
+        rtbench --update-references DIRECTORY [--reference-spp N] [--width N] [--spp N] [--scene NAME]...
+        rtbench --check DIRECTORY [--image-tolerance FRACTION] [--time-tolerance FRACTION] [--images-only] [--scene NAME]...
+
+    --output writes the results as JSON; --compare reads a previous output and flags every
+    scene whose rays per second dropped (or total time grew) by more than the tolerance,
+    in which case the exit code is 1. --trace writes a Chrome trace timeline of the whole run.
+    --packet traces the camera rays in packets of that many rays, --wavefront renders with
+    the wavefront renderer and --reorder also sorts its secondary rays before tracing them.
+
+    --perf reads hardware counters (cycles, instructions, L1/LLC and branch misses) around
+    the render of each scene and reports them per ray, and per BVH node visited in builds
+    with RT_STATISTICS. Where perf_event_open isn't allowed, it's skipped with a warning.
+
+    --update-references and --check run the image and performance regression checks
+    instead of the benchmark (see regression.hpp): the first stores reference renders
+    (at 16 times the samples per pixel unless --reference-spp is given) and the error and
+    time of the regular render, the second fails (exit code 1) when a scene's error or its
+    time to reach the recorded error grew beyond the tolerances. --images-only leaves the
+    times out, for references recorded on another machine such as the ones in references/
+    (the regression test of CTest).
+
+    Must be run from the repository root, so the scenes find obj/ and their textures.
+*/
+
+struct BenchmarkOptions
+{
+    int image_width{160};
+    int samples_per_pixel{8};
+    int max_depth{50};
+    std::uint64_t seed{1};
+    unsigned threads{0};
+    int packet_size{0};
+    bool wavefront{false};
+    bool reorder_rays{false};
+    std::vector<Scenes> scenes;
+    std::string output_filename;
+    std::string baseline_filename;
+    std::string trace_filename;
+    double tolerance{0.10};
+    bool use_perf_counters{false};
+    // Regression checks
+    std::string references_directory;
+    bool update_references{false};
+    int reference_samples_per_pixel{0};
+    double image_tolerance{0.25};
+    double time_tolerance{0.50};
+    bool check_time{true};
+};
+
+struct SceneResult
+{
+    std::string name;
+    int image_width;
+    int image_height;
+    double scene_build_ms;
+    double bvh_build_ms;
+    double render_ms;
+    double total_ms;
+    RenderStatistics statistics;
+    // Negative for counters that aren't available
+    bool has_perf_counters{false};
+    std::array<double, PerfCounters::CounterCount> perf_counters{};
+};
+
+bool parse_options(int argc, char* argv[], BenchmarkOptions& options);
+SceneResult run_scene(Scenes scene, const BenchmarkOptions& options, PerfCounters* perf_counters);
+JsonValue to_json(const BenchmarkOptions& options, const std::vector<SceneResult>& results);
+JsonValue to_json(const TraversalCounters& counters);
+JsonValue perf_counters_to_json(const SceneResult& result);
+void print_perf_counters(const std::vector<SceneResult>& results);
+// Returns the number of regressions
+int compare_with_baseline(const JsonValue& current, const JsonValue& baseline, double tolerance);
+
+double milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options;
+    if (!parse_options(argc, argv, options))
+    {
+        return 2;
+    }
+
+    if (!options.references_directory.empty())
+    {
+        RegressionOptions regression_options;
+        regression_options.directory = options.references_directory;
+        regression_options.image_width = options.image_width;
+        regression_options.samples_per_pixel = options.samples_per_pixel;
+        regression_options.reference_samples_per_pixel = options.reference_samples_per_pixel > 0 ? options.reference_samples_per_pixel : 16 * options.samples_per_pixel;
+        regression_options.max_depth = options.max_depth;
+        regression_options.seed = options.seed;
+        regression_options.threads = options.threads;
+        regression_options.packet_size = options.packet_size;
+        regression_options.wavefront = options.wavefront;
+        regression_options.reorder_rays = options.reorder_rays;
+        regression_options.image_tolerance = options.image_tolerance;
+        regression_options.time_tolerance = options.time_tolerance;
+        regression_options.check_time = options.check_time;
+        regression_options.scenes = options.scenes;
+
+        return options.update_references ? update_references(regression_options) : check_references(regression_options);
+    }
+
+    PerfCounters perf_counters;
+    if (options.use_perf_counters && !perf_counters.available())
+    {
+        std::cerr << "Hardware counters unavailable (" << perf_counters.error() << "), timing only\n";
+    }
+    const auto counters = options.use_perf_counters && perf_counters.available() ? &perf_counters : nullptr;
+
+    std::vector<SceneResult> results;
+    std::printf("%-30s %9s %9s %9s %9s %12s %12s\n", "scene", "size", "build ms", "bvh ms", "total ms", "primary/s", "secondary/s");
+
+    for (auto scene: options.scenes)
+    {
+        auto result = run_scene(scene, options, counters);
+        if (result.image_height < 1)
+        {
+            std::cerr << "--width " << options.image_width << " gives " << result.name << " no rows; use a larger width\n";
+            return 2;
+        }
+        const auto render_seconds = result.render_ms / 1000.0;
+        const auto size = std::to_string(result.image_width) + "x" + std::to_string(result.image_height);
+
+        std::printf("%-30s %9s %9.1f %9.1f %9.1f %12.0f %12.0f\n", result.name.c_str(), size.c_str(),
+                    result.scene_build_ms, result.bvh_build_ms, result.total_ms,
+                    result.statistics.primary_rays / render_seconds, result.statistics.secondary_rays / render_seconds);
+        std::fflush(stdout);
+
+        results.push_back(result);
+    }
+
+    if (counters)
+    {
+        print_perf_counters(results);
+    }
+
+    const auto report = to_json(options, results);
+
+    if (!options.trace_filename.empty() && !write_trace(options.trace_filename))
+    {
+        std::cerr << "Unable to write trace " << options.trace_filename << "\n";
+    }
+
+    if (!options.output_filename.empty())
+    {
+        std::ofstream output_file{options.output_filename};
+        report.write(output_file);
+        output_file << '\n';
+
+        if (!output_file)
+        {
+            std::cerr << "Unable to write file " << options.output_filename << "\n";
+            return 2;
+        }
+    }
+
+    if (!options.baseline_filename.empty())
+    {
+        std::ifstream baseline_file{options.baseline_filename};
+        std::stringstream text;
+        text << baseline_file.rdbuf();
+
+        JsonValue baseline;
+        if (!baseline_file.is_open() || !JsonValue::parse(text.str(), baseline))
+        {
+            std::cerr << "Unable to read baseline " << options.baseline_filename << "\n";
+            return 2;
+        }
+
+        if (compare_with_baseline(report, baseline, options.tolerance) > 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+bool parse_options(int argc, char* argv[], BenchmarkOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string argument{argv[i]};
+        const bool has_value = i + 1 < argc;
+
+        if (argument == "--width" && has_value)
+        {
+            options.image_width = std::stoi(argv[++i]);
+            if (options.image_width < 1)
+            {
+                std::cerr << "--width must be at least 1\n";
+                return false;
+            }
+        }
+        else if (argument == "--spp" && has_value)
+        {
+            options.samples_per_pixel = std::stoi(argv[++i]);
+        }
+        else if (argument == "--depth" && has_value)
+        {
+            options.max_depth = std::stoi(argv[++i]);
+        }
+        else if (argument == "--seed" && has_value)
+        {
+            options.seed = std::stoull(argv[++i]);
+        }
+        else if (argument == "--threads" && has_value)
+        {
+            options.threads = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
+        else if (argument == "--packet" && has_value)
+        {
+            options.packet_size = std::stoi(argv[++i]);
+        }
+        else if (argument == "--wavefront")
+        {
+            options.wavefront = true;
+        }
+        else if (argument == "--reorder")
+        {
+            options.wavefront = true;
+            options.reorder_rays = true;
+        }
+        else if (argument == "--scene" && has_value)
+        {
+            Scenes scene;
+            if (!scene_from_name(argv[++i], scene))
+            {
+                std::cerr << "Unknown scene " << argv[i] << "; available scenes:";
+                for (auto candidate: all_scenes)
+                {
+                    std::cerr << ' ' << scene_name(candidate);
+                }
+                std::cerr << "\n";
+                return false;
+            }
+            options.scenes.push_back(scene);
+        }
+        else if (argument == "--output" && has_value)
+        {
+            options.output_filename = argv[++i];
+        }
+        else if (argument == "--compare" && has_value)
+        {
+            options.baseline_filename = argv[++i];
+        }
+        else if (argument == "--tolerance" && has_value)
+        {
+            options.tolerance = std::stod(argv[++i]);
+        }
+        else if (argument == "--perf")
+        {
+            options.use_perf_counters = true;
+        }
+        else if (argument == "--trace" && has_value)
+        {
+            options.trace_filename = argv[++i];
+            enable_tracing();
+        }
+        else if ((argument == "--update-references" || argument == "--check") && has_value)
+        {
+            options.update_references = argument == "--update-references";
+            options.references_directory = argv[++i];
+        }
+        else if (argument == "--reference-spp" && has_value)
+        {
+            options.reference_samples_per_pixel = std::stoi(argv[++i]);
+        }
+        else if (argument == "--image-tolerance" && has_value)
+        {
+            options.image_tolerance = std::stod(argv[++i]);
+        }
+        else if (argument == "--time-tolerance" && has_value)
+        {
+            options.time_tolerance = std::stod(argv[++i]);
+        }
+        else if (argument == "--images-only")
+        {
+            options.check_time = false;
+        }
+        else
+        {
+            std::cerr << "Usage: rtbench [--width N] [--spp N] [--depth N] [--seed N] [--threads N] [--packet 4|8|16] [--wavefront] [--reorder]\n"
+                      << "               [--scene NAME]...\n"
+                      << "               [--output FILE] [--compare BASELINE] [--tolerance FRACTION] [--trace FILE] [--perf]\n"
+                      << "       rtbench --update-references DIRECTORY [--reference-spp N] | --check DIRECTORY\n"
+                      << "               [--image-tolerance FRACTION] [--time-tolerance FRACTION] [--images-only]\n";
+            return false;
+        }
+    }
+
+    if (options.scenes.empty())
+    {
+        options.scenes.assign(all_scenes.begin(), all_scenes.end());
+    }
+
+    return true;
+}
+
+SceneResult run_scene(Scenes scene, const BenchmarkOptions& options, PerfCounters* perf_counters)
+{
+    SceneResult result;
+    result.name = scene_name(scene);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // Scene construction is random too, so it's seeded for a reproducible world
+    seed_random(options.seed);
+    auto settings = scene_settings(scene);
+    result.scene_build_ms = milliseconds_since(start);
+
+    const auto bvh_start = std::chrono::steady_clock::now();
+    MotionBVH world{settings.world, settings.open_shutter_time, settings.close_shutter_time};
+    result.bvh_build_ms = milliseconds_since(bvh_start);
+
+    RenderSettings render_settings;
+    render_settings.image_width = options.image_width;
+    render_settings.image_height = static_cast<int>(options.image_width / settings.aspect_ratio);
+    render_settings.samples_per_pixel = options.samples_per_pixel;
+    render_settings.max_depth = options.max_depth;
+    render_settings.threads = options.threads;
+    render_settings.seed = options.seed;
+    render_settings.packet_size = options.packet_size;
+    render_settings.wavefront = options.wavefront;
+    render_settings.reorder_rays = options.reorder_rays;
+
+    result.image_width = render_settings.image_width;
+    result.image_height = render_settings.image_height;
+    if (render_settings.image_height < 1)
+    {
+        return result;
+    }
+
+    const auto camera = settings.camera(render_settings.image_height);
+    const auto render_start = std::chrono::steady_clock::now();
+    if (perf_counters)
+    {
+        perf_counters->start();
+    }
+
+    render(world, camera, settings.background, render_settings, &result.statistics);
+
+    if (perf_counters)
+    {
+        perf_counters->stop();
+        result.has_perf_counters = true;
+        for (int counter = 0; counter < PerfCounters::CounterCount; ++counter)
+        {
+            const auto which = static_cast<PerfCounters::Counter>(counter);
+            result.perf_counters[counter] = perf_counters->available(which) ? perf_counters->value(which) : -1.0;
+        }
+    }
+    result.render_ms = milliseconds_since(render_start);
+
+    result.total_ms = milliseconds_since(start);
+
+    return result;
+}
+
+JsonValue to_json(const BenchmarkOptions& options, const std::vector<SceneResult>& results)
+{
+    auto report = JsonValue::make_object();
+
+    auto settings = JsonValue::make_object();
+    settings.set("image_width", static_cast<double>(options.image_width));
+    settings.set("samples_per_pixel", static_cast<double>(options.samples_per_pixel));
+    settings.set("max_depth", static_cast<double>(options.max_depth));
+    settings.set("seed", static_cast<double>(options.seed));
+    settings.set("threads", static_cast<double>(options.threads != 0 ? options.threads : std::thread::hardware_concurrency()));
+    settings.set("precision", sizeof(real) == sizeof(float) ? "float" : "double");
+    settings.set("simd_vector", std::is_same<Vector3, SimdVector3>::value);
+    report.set("settings", settings);
+
+    auto scenes = JsonValue::make_array();
+    for (const auto& result: results)
+    {
+        const auto render_seconds = result.render_ms / 1000.0;
+        const auto rays = static_cast<double>(result.statistics.primary_rays + result.statistics.secondary_rays);
+
+        auto scene = JsonValue::make_object();
+        scene.set("name", result.name);
+        scene.set("image_width", static_cast<double>(result.image_width));
+        scene.set("image_height", static_cast<double>(result.image_height));
+        scene.set("scene_build_ms", result.scene_build_ms);
+        scene.set("bvh_build_ms", result.bvh_build_ms);
+        scene.set("render_ms", result.render_ms);
+        scene.set("total_ms", result.total_ms);
+        scene.set("primary_rays", static_cast<double>(result.statistics.primary_rays));
+        scene.set("secondary_rays", static_cast<double>(result.statistics.secondary_rays));
+        scene.set("primary_rays_per_second", result.statistics.primary_rays / render_seconds);
+        scene.set("secondary_rays_per_second", result.statistics.secondary_rays / render_seconds);
+        scene.set("rays_per_second", rays / render_seconds);
+#ifdef RT_STATISTICS
+        scene.set("counters", to_json(result.statistics.counters));
+#endif
+        if (result.has_perf_counters)
+        {
+            scene.set("hardware_counters", perf_counters_to_json(result));
+        }
+        scenes.push_back(scene);
+    }
+    report.set("scenes", scenes);
+
+    return report;
+}
+
+JsonValue to_json(const TraversalCounters& counters)
+{
+    auto object = JsonValue::make_object();
+
+    auto rays_per_depth = JsonValue::make_array();
+    for (auto rays: counters.rays_per_depth)
+    {
+        rays_per_depth.push_back(static_cast<double>(rays));
+    }
+    object.set("rays_per_depth", rays_per_depth);
+    object.set("bvh_nodes_visited", static_cast<double>(counters.bvh_nodes_visited));
+    object.set("box_tests", static_cast<double>(counters.box_tests));
+    object.set("box_hits", static_cast<double>(counters.box_hits));
+    object.set("list_visits", static_cast<double>(counters.list_visits));
+
+    auto primitive_tests = JsonValue::make_object();
+    auto primitive_hits = JsonValue::make_object();
+    for (std::size_t kind = 0; kind < TraversalCounters::primitive_kinds; ++kind)
+    {
+        const auto name = primitive_name(static_cast<PrimitiveKind>(kind));
+        primitive_tests.set(name, static_cast<double>(counters.primitive_tests[kind]));
+        primitive_hits.set(name, static_cast<double>(counters.primitive_hits[kind]));
+    }
+    object.set("primitive_tests", primitive_tests);
+    object.set("primitive_hits", primitive_hits);
+
+    auto scatter_calls = JsonValue::make_object();
+    for (std::size_t kind = 0; kind < TraversalCounters::material_kinds; ++kind)
+    {
+        scatter_calls.set(material_name(static_cast<MaterialKind>(kind)), static_cast<double>(counters.scatter_calls[kind]));
+    }
+    object.set("scatter_calls", scatter_calls);
+
+    auto path_ends = JsonValue::make_object();
+    for (std::size_t end = 0; end < TraversalCounters::path_ends; ++end)
+    {
+        path_ends.set(path_end_name(static_cast<PathEnd>(end)), static_cast<double>(counters.path_end_counts[end]));
+    }
+    object.set("path_ends", path_ends);
+
+    return object;
+}
+
+/*
+    Totals, per ray (primary and secondary) and, when the traversal counters are compiled
+    in, per BVH node visited; e.g. LLC misses per node tell whether traversal is memory bound.
+*/
+JsonValue perf_counters_to_json(const SceneResult& result)
+{
+    const auto rays = static_cast<double>(result.statistics.primary_rays + result.statistics.secondary_rays);
+    const auto nodes = static_cast<double>(result.statistics.counters.bvh_nodes_visited);
+    auto object = JsonValue::make_object();
+
+    for (int index = 0; index < PerfCounters::CounterCount; ++index)
+    {
+        if (result.perf_counters[index] < 0.0)
+        {
+            continue;
+        }
+
+        const std::string name{PerfCounters::name(static_cast<PerfCounters::Counter>(index))};
+        object.set(name, result.perf_counters[index]);
+        object.set(name + "_per_ray", rays > 0.0 ? result.perf_counters[index] / rays : 0.0);
+        if (nodes > 0.0)
+        {
+            object.set(name + "_per_bvh_node", result.perf_counters[index] / nodes);
+        }
+    }
+
+    return object;
+}
+
+void print_perf_counters(const std::vector<SceneResult>& results)
+{
+    std::printf("\n%-30s", "per ray");
+    for (int counter = 0; counter < PerfCounters::CounterCount; ++counter)
+    {
+        std::printf(" %14s", PerfCounters::name(static_cast<PerfCounters::Counter>(counter)));
+    }
+    std::printf("\n");
+
+    for (const auto& result: results)
+    {
+        const auto rays = static_cast<double>(result.statistics.primary_rays + result.statistics.secondary_rays);
+        std::printf("%-30s", result.name.c_str());
+        for (int counter = 0; counter < PerfCounters::CounterCount; ++counter)
+        {
+            if (result.perf_counters[counter] >= 0.0)
+            {
+                std::printf(" %14.2f", rays > 0.0 ? result.perf_counters[counter] / rays : 0.0);
+            }
+            else
+            {
+                std::printf(" %14s", "-");
+            }
+        }
+        std::printf("\n");
+    }
+}
+
+double number_member(const JsonValue& object, const std::string& key)
+{
+    const auto member = object.find(key);
+    return member && member->type == JsonValue::Type::Number ? member->number : 0.0;
+}
+
+/*
+    Rays per second must not drop below (1 - tolerance) times the baseline and total
+    time must not exceed (1 + tolerance) times the baseline. Scenes that aren't in the
+    baseline are reported but don't count as regressions.
+*/
+int compare_with_baseline(const JsonValue& current, const JsonValue& baseline, double tolerance)
+{
+    const auto baseline_scenes = baseline.find("scenes");
+    const auto current_scenes = current.find("scenes");
+    int regressions = 0;
+
+    std::printf("\n%-30s %14s %14s %9s %9s\n", "scene", "rays/s", "baseline", "change", "status");
+
+    for (const auto& scene: current_scenes->array)
+    {
+        const auto name = scene.find("name")->string;
+        const JsonValue* reference = nullptr;
+
+        if (baseline_scenes)
+        {
+            for (const auto& candidate: baseline_scenes->array)
+            {
+                const auto candidate_name = candidate.find("name");
+                if (candidate_name && candidate_name->string == name)
+                {
+                    reference = &candidate;
+                }
+            }
+        }
+
+        const auto rays_per_second = number_member(scene, "rays_per_second");
+        if (!reference)
+        {
+            std::printf("%-30s %14.0f %14s %9s %9s\n", name.c_str(), rays_per_second, "-", "-", "new");
+            continue;
+        }
+
+        const auto baseline_rays_per_second = number_member(*reference, "rays_per_second");
+        const auto change = baseline_rays_per_second > 0.0 ? rays_per_second / baseline_rays_per_second - 1.0 : 0.0;
+        const bool slower = rays_per_second < (1.0 - tolerance) * baseline_rays_per_second
+                         || number_member(scene, "total_ms") > (1.0 + tolerance) * number_member(*reference, "total_ms");
+
+        std::printf("%-30s %14.0f %14.0f %+8.1f%% %9s\n", name.c_str(), rays_per_second, baseline_rays_per_second,
+                    100.0 * change, slower ? "REGRESSED" : "ok");
+        regressions += slower;
+    }
+
+    std::printf("\n%d regression(s) with a tolerance of %.0f%%\n", regressions, 100.0 * tolerance);
+    return regressions;
+}
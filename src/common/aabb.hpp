@@ -2,6 +2,7 @@
 #define AABB_HPP
 
 #include "ray.hpp"
+#include "statistics.hpp"
 #include "vector3.hpp"
 
 #include <cmath>
@@ -18,6 +19,7 @@ public:
     Point3 min() const;
     Point3 max() const;
     bool hit(const Ray& ray, double left_end, double right_end) const;
+    double surface_area() const;
 };
 
 Point3 AABB::min() const
@@ -30,8 +32,16 @@ Point3 AABB::max() const
     return maximum;
 }
 
+double AABB::surface_area() const
+{
+    const auto extent = maximum - minimum;
+    return 2.0 * (extent.x() * extent.y() + extent.y() * extent.z() + extent.z() * extent.x());
+}
+
 bool AABB::hit(const Ray& ray, double left_end, double right_end) const
 {
+    RT_STATISTIC(count_box_test());
+
     for (int i = 0; i < 3; ++i)
     {
         auto inverse_direction = 1.0f / ray.direction()[i];
@@ -52,6 +62,7 @@ bool AABB::hit(const Ray& ray, double left_end, double right_end) const
         }
     }
 
+    RT_STATISTIC(count_box_hit());
     return true;
 }
 
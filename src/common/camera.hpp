@@ -12,6 +12,9 @@ public:
     Camera(Point3 look_from, Point3 look_at, Vector3 view_up, double vertical_fov, double aspect_ratio, 
         double aperture = 0.0, double focus_distance = 1.0, double time0 = 0.0, double time1 = 0.0);
 
+    // Sets the spread angle of the ray cones of primary rays so each one covers a pixel
+    void set_image_height(int image_height);
+
     Ray get_ray(double u, double v) const;
 private:
     Point3 origin{0, 0, 0};
@@ -21,6 +24,8 @@ private:
     // Basis vectors of the camera frame of reference
     Vector3 u, v, w;
     double lens_radius;
+    double viewport_height;
+    double pixel_spread_angle{0.0};
     // Open/close times of the shutter
     double open_time;
     double close_time;
@@ -32,7 +37,7 @@ Camera::Camera(Point3 look_from, Point3 look_at, Vector3 view_up, double vertica
 {
     const auto theta = degrees_to_radians(vertical_fov);
     const auto height = std::tan(theta / 2);
-    const auto viewport_height = 2.0 * height;
+    viewport_height = 2.0 * height;
     const auto viewport_width = aspect_ratio * viewport_height; // 3.555...
 
     // Basis vectors for the camera frame of reference
@@ -45,12 +50,23 @@ Camera::Camera(Point3 look_from, Point3 look_at, Vector3 view_up, double vertica
     lower_left_corner = origin - horizontal / 2 - vertical / 2 - focus_distance * w;
 }
 
+/*
+    Ray cones (Akenine-Moller et al., "Texture Level of Detail Strategies for Real-Time
+    Ray Tracing"): the spread angle of a primary ray is the angle subtended by one pixel
+    on the viewport at unit distance from the eye.
+*/
+void Camera::set_image_height(int image_height)
+{
+    pixel_spread_angle = std::atan(viewport_height / image_height);
+}
+
 Ray Camera::get_ray(double s, double t) const
 {
     Vector3 random = lens_radius * random_in_unit_disk();
     Vector3 offset = u * random.x() + v * random.y();
 
-    return Ray{origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, random_double(open_time, close_time)};
+    return Ray{origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, random_double(open_time, close_time),
+               0.0, pixel_spread_angle};
 }
 
 #endif // CAMERA_HPP
\ No newline at end of file
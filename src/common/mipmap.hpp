@@ -0,0 +1,271 @@
+#ifndef MIPMAP_HPP
+#define MIPMAP_HPP
+
+#include "util.hpp"
+#include "vector3.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Size and placement of one level of a tiled MIP pyramid
+struct MipLevel
+{
+    int width;
+    int height;
+    int tiles_per_row;
+    std::size_t first_tile; // index of the first tile of this level in the whole pyramid
+};
+
+/*
+    Layout and filtering shared by MIP pyramids of RGB 8-bit images.
+
+    Every level is split into tile_size x tile_size tiles stored one after the other
+    (row by row, level after level), and the texels inside a tile are stored in
+    Morton (Z-order) order. Texels that are close in the image are then close in
+    memory, so the 2x2 footprint of a bilinear lookup usually lies in one or two
+    cache lines instead of two distant scanlines. Tiles are also the paging unit of
+    the TextureCache.
+
+    Image is the derived class (CRTP) and must provide levels(), level(index)
+    and texel(level, x, y).
+*/
+template <typename Image>
+class MipFiltering
+{
+public:
+    constexpr static int bytes_per_pixel{3};
+    constexpr static int tile_size{32};
+    constexpr static int texels_per_tile{tile_size * tile_size};
+    constexpr static std::size_t bytes_per_tile{texels_per_tile * bytes_per_pixel};
+
+    // Bilinear lookup on a single level; (u, v) in image space, v pointing down
+    Color bilinear(int level, double u, double v) const;
+    // Trilinear lookup: footprint is the size of the lookup in UV units
+    Color trilinear(double u, double v, double footprint) const;
+
+    static std::vector<MipLevel> layout(int width, int height);
+    static std::size_t tile_index(const MipLevel& level, int x, int y);
+    // Byte offset of texel (x, y) of a level inside its tile
+    static std::size_t offset_in_tile(int x, int y);
+private:
+    const Image& image() const
+    {
+        return static_cast<const Image&>(*this);
+    }
+};
+
+template <typename Image>
+Color MipFiltering<Image>::bilinear(int level, double u, double v) const
+{
+    // Texel centers are at half-integer coordinates
+    const auto x = u * image().level(level).width - 0.5;
+    const auto y = v * image().level(level).height - 0.5;
+    const auto x0 = static_cast<int>(std::floor(x));
+    const auto y0 = static_cast<int>(std::floor(y));
+    const auto dx = x - x0;
+    const auto dy = y - y0;
+
+    return (1 - dx) * (1 - dy) * image().texel(level, x0, y0) + dx * (1 - dy) * image().texel(level, x0 + 1, y0)
+         + (1 - dx) * dy * image().texel(level, x0, y0 + 1) + dx * dy * image().texel(level, x0 + 1, y0 + 1);
+}
+
+/*
+    The level of detail is chosen so one texel of the level has roughly the size of
+    the footprint: lod = log2(footprint * size of level 0), then both nearest levels
+    are blended.
+*/
+template <typename Image>
+Color MipFiltering<Image>::trilinear(double u, double v, double footprint) const
+{
+    const auto texels = footprint * std::max(image().level(0).width, image().level(0).height);
+    const auto lod = texels > 1.0 ? std::log2(texels) : 0.0;
+    const auto max_level = image().levels() - 1;
+
+    if (lod >= max_level)
+    {
+        return bilinear(max_level, u, v);
+    }
+
+    const auto level = static_cast<int>(lod);
+    const auto blend = lod - level;
+
+    if (blend == 0.0)
+    {
+        return bilinear(level, u, v);
+    }
+
+    return (1 - blend) * bilinear(level, u, v) + blend * bilinear(level + 1, u, v);
+}
+
+// Levels down to 1x1, each one half the size of the previous (rounded down)
+template <typename Image>
+std::vector<MipLevel> MipFiltering<Image>::layout(int width, int height)
+{
+    std::vector<MipLevel> levels;
+    std::size_t first_tile = 0;
+
+    while (true)
+    {
+        const auto tiles_per_row = (width + tile_size - 1) / tile_size;
+        const auto tiles_per_column = (height + tile_size - 1) / tile_size;
+        levels.push_back(MipLevel{width, height, tiles_per_row, first_tile});
+        first_tile += static_cast<std::size_t>(tiles_per_row) * tiles_per_column;
+
+        if (width == 1 && height == 1)
+        {
+            break;
+        }
+
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+
+    return levels;
+}
+
+template <typename Image>
+std::size_t MipFiltering<Image>::tile_index(const MipLevel& level, int x, int y)
+{
+    return level.first_tile + static_cast<std::size_t>(y / tile_size) * level.tiles_per_row + x / tile_size;
+}
+
+// Interleaves the bits of the coordinates inside the tile: ...y1 x1 y0 x0
+template <typename Image>
+std::size_t MipFiltering<Image>::offset_in_tile(int x, int y)
+{
+    x %= tile_size;
+    y %= tile_size;
+    std::size_t index = 0;
+
+    for (int bit = 0; (1 << bit) < tile_size; ++bit)
+    {
+        index |= static_cast<std::size_t>((x >> bit) & 1) << (2 * bit);
+        index |= static_cast<std::size_t>((y >> bit) & 1) << (2 * bit + 1);
+    }
+
+    return index * bytes_per_pixel;
+}
+
+// MIP pyramid of an RGB 8-bit image fully resident in memory
+class MipMap: public MipFiltering<MipMap>
+{
+public:
+    MipMap() {}
+    // data is a row-major image with bytes_per_pixel bytes per pixel
+    MipMap(const unsigned char* data, int width, int height);
+
+    bool empty() const;
+    int levels() const;
+    const MipLevel& level(int index) const;
+    Color texel(int level, int x, int y) const;
+
+    std::size_t tile_count() const;
+    const unsigned char* tile(std::size_t index) const;
+private:
+    std::vector<MipLevel> pyramid;
+    std::vector<unsigned char> tiles;
+
+    void store_level(const MipLevel& level, const std::vector<unsigned char>& row_major);
+};
+
+MipMap::MipMap(const unsigned char* data, int width, int height): pyramid{layout(width, height)}
+{
+    tiles.resize(tile_count() * bytes_per_tile);
+
+    std::vector<unsigned char> current(data, data + static_cast<std::size_t>(width) * height * bytes_per_pixel);
+    store_level(pyramid[0], current);
+
+    // Each level is a 2x2 box filter of the previous one; odd sizes clamp the last row/column
+    for (std::size_t index = 1; index < pyramid.size(); ++index)
+    {
+        const auto next_width = pyramid[index].width;
+        const auto next_height = pyramid[index].height;
+        std::vector<unsigned char> next(static_cast<std::size_t>(next_width) * next_height * bytes_per_pixel);
+
+        for (int y = 0; y < next_height; ++y)
+        {
+            for (int x = 0; x < next_width; ++x)
+            {
+                const int x0 = std::min(2 * x, width - 1);
+                const int x1 = std::min(2 * x + 1, width - 1);
+                const int y0 = std::min(2 * y, height - 1);
+                const int y1 = std::min(2 * y + 1, height - 1);
+
+                for (int channel = 0; channel < bytes_per_pixel; ++channel)
+                {
+                    const int sum = current[(y0 * width + x0) * bytes_per_pixel + channel]
+                                  + current[(y0 * width + x1) * bytes_per_pixel + channel]
+                                  + current[(y1 * width + x0) * bytes_per_pixel + channel]
+                                  + current[(y1 * width + x1) * bytes_per_pixel + channel];
+                    next[(y * next_width + x) * bytes_per_pixel + channel] = static_cast<unsigned char>((sum + 2) / 4);
+                }
+            }
+        }
+
+        current = std::move(next);
+        width = next_width;
+        height = next_height;
+        store_level(pyramid[index], current);
+    }
+}
+
+void MipMap::store_level(const MipLevel& level, const std::vector<unsigned char>& row_major)
+{
+    for (int y = 0; y < level.height; ++y)
+    {
+        for (int x = 0; x < level.width; ++x)
+        {
+            const auto source = (static_cast<std::size_t>(y) * level.width + x) * bytes_per_pixel;
+            const auto target = tile_index(level, x, y) * bytes_per_tile + offset_in_tile(x, y);
+            std::copy_n(row_major.begin() + source, bytes_per_pixel, tiles.begin() + target);
+        }
+    }
+}
+
+bool MipMap::empty() const
+{
+    return pyramid.empty();
+}
+
+int MipMap::levels() const
+{
+    return static_cast<int>(pyramid.size());
+}
+
+const MipLevel& MipMap::level(int index) const
+{
+    return pyramid[index];
+}
+
+// Texel lookup with clamp-to-edge addressing
+Color MipMap::texel(int level, int x, int y) const
+{
+    const auto& current = pyramid[level];
+    x = std::clamp(x, 0, current.width - 1);
+    y = std::clamp(y, 0, current.height - 1);
+
+    const auto color_space = 1.0 / 255.0;
+    const auto offset = tile_index(current, x, y) * bytes_per_tile + offset_in_tile(x, y);
+
+    return Color{color_space * tiles[offset + 0], color_space * tiles[offset + 1], color_space * tiles[offset + 2]};
+}
+
+std::size_t MipMap::tile_count() const
+{
+    if (pyramid.empty())
+    {
+        return 0;
+    }
+
+    const auto& last = pyramid.back();
+    return last.first_tile + static_cast<std::size_t>(last.tiles_per_row) * ((last.height + tile_size - 1) / tile_size);
+}
+
+const unsigned char* MipMap::tile(std::size_t index) const
+{
+    return tiles.data() + index * bytes_per_tile;
+}
+
+#endif // MIPMAP_HPP
@@ -1,13 +1,23 @@
 #ifndef PERLIN_HPP
 #define PERLIN_HPP
 
+#include "simd.hpp"
 #include "vector3.hpp"
 #include "util.hpp"
 #include <algorithm>
 #include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 
-#include <iostream>
+/*
+    Perlin gradient noise, evaluated in single precision with 4-lane SIMD.
 
+    The lattice is generated exactly as before (same random unit gradients and
+    permutations for the same random sequence), so the pattern is unchanged; only
+    the interpolation runs in float. The lattice cell and the position inside it are
+    still computed in double, since points are scaled up to 2^depth by turbulence.
+*/
 class Perlin
 {
 public:
@@ -15,23 +25,34 @@ public:
 
     double noise(const Point3& point) const;
     double turbulence(const Point3& point, int depth = 7) const;
+    // Batch version of turbulence: results[i] = turbulence(points[i], depth)
+    void turbulence(const Point3* points, double* results, std::size_t count, int depth = 7) const;
 private:
     static constexpr int point_count{256};
-    std::array<Vector3, point_count> random_vec;
-    std::array<int, point_count> permutation_x;
-    std::array<int, point_count> permutation_y;
-    std::array<int, point_count> permutation_z;
-
-    static std::array<int, point_count> perlin_generate_permutation();
-    static void permute(std::array<int, point_count>& array, int size);
-    static double perlin_interpolation(Vector3 colors[2][2][2], double u, double v, double w);
+    // Random unit gradients stored as structure of arrays
+    std::array<float, point_count> gradient_x;
+    std::array<float, point_count> gradient_y;
+    std::array<float, point_count> gradient_z;
+    std::array<std::uint8_t, point_count> permutation_x;
+    std::array<std::uint8_t, point_count> permutation_y;
+    std::array<std::uint8_t, point_count> permutation_z;
+
+    static std::array<std::uint8_t, point_count> perlin_generate_permutation();
+    static void permute(std::array<std::uint8_t, point_count>& array, int size);
+
+    // Noise at a point, given the lattice cell (i, j, k) and the position (u, v, w) inside it
+    float cell_noise(int i, int j, int k, float u, float v, float w) const;
+    static void split(double coordinate, int& cell, float& fraction);
 };
 
 Perlin::Perlin()
 {
     for (int i = 0; i < point_count; ++i)
     {
-        random_vec[i] = unit_vector(Vector3::random(-1, 1));
+        auto gradient = unit_vector(Vector3::random(-1, 1));
+        gradient_x[i] = static_cast<float>(gradient.x());
+        gradient_y[i] = static_cast<float>(gradient.y());
+        gradient_z[i] = static_cast<float>(gradient.z());
     }
 
     permutation_x = perlin_generate_permutation();
@@ -39,13 +60,13 @@ Perlin::Perlin()
     permutation_z = perlin_generate_permutation();
 }
 
-std::array<int, Perlin::point_count> Perlin::perlin_generate_permutation()
+std::array<std::uint8_t, Perlin::point_count> Perlin::perlin_generate_permutation()
 {
-    std::array<int, point_count> array;
+    std::array<std::uint8_t, point_count> array;
 
     for (int i = 0; i < point_count; ++i)
     {
-        array[i] = i;
+        array[i] = static_cast<std::uint8_t>(i);
     }
 
     permute(array, point_count);
@@ -53,7 +74,7 @@ std::array<int, Perlin::point_count> Perlin::perlin_generate_permutation()
     return array;
 }
 
-void Perlin::permute(std::array<int, Perlin::point_count>& array, int size)
+void Perlin::permute(std::array<std::uint8_t, Perlin::point_count>& array, int size)
 {
     for (int i = size - 1; i > 0; --i)
     {
@@ -62,72 +83,186 @@ void Perlin::permute(std::array<int, Perlin::point_count>& array, int size)
     }
 }
 
-double Perlin::noise(const Point3& point) const 
+// Floor without a libm call (std::floor isn't inlined without SSE4.1)
+void Perlin::split(double coordinate, int& cell, float& fraction)
 {
-    auto i = static_cast<int>(std::floor(point.x())) & 255;
-    auto j = static_cast<int>(std::floor(point.y())) & 255;
-    auto k = static_cast<int>(std::floor(point.z())) & 255;
-    Vector3 colors[2][2][2];
+    auto floor = static_cast<long long>(coordinate);
+    floor -= coordinate < floor;
+    cell = static_cast<int>(floor & 255);
+    fraction = static_cast<float>(coordinate - floor);
+}
+
+/*
+    The 8 lattice corners are evaluated together in two groups of 4 lanes: the
+    first group holds the corners with delta_i = 0 and the second with delta_i = 1,
+    and inside each group the lanes are (delta_j, delta_k) = (0, 0), (0, 1), (1, 0), (1, 1).
 
-    //return random_float[permutation_x[i] ^ permutation_y[j] ^permutation_z[k]];
-    for (int delta_i = 0; delta_i < 2; ++delta_i)
+    For each corner, the gradient is dotted with the offset from the corner,
+    (u - delta_i, v - delta_j, w - delta_k), and weighted by the Hermite-smoothed
+    trilinear weights; the noise is the sum over the corners.
+*/
+float Perlin::cell_noise(int i, int j, int k, float u, float v, float w) const
+{
+    const int x[2] = {permutation_x[i], permutation_x[(i + 1) & 255]};
+    const int y[2] = {permutation_y[j], permutation_y[(j + 1) & 255]};
+    const int z[2] = {permutation_z[k], permutation_z[(k + 1) & 255]};
+
+    int index[8];
+    for (int corner = 0; corner < 8; ++corner)
     {
-        for (int delta_j = 0; delta_j < 2; ++delta_j)
-        {
-            for (int delta_k = 0; delta_k < 2; ++delta_k)
-            {
-                auto index = permutation_x[(i + delta_i) & 255] ^ permutation_y[(j + delta_j) & 255] ^ permutation_z[(k + delta_k) & 255];
-                colors[delta_i][delta_j][delta_k] = random_vec[index];
-            }
-        }
+        index[corner] = x[corner >> 2] ^ y[(corner >> 1) & 1] ^ z[corner & 1];
     }
 
-    auto u = point.x() - std::floor(point.x());
-    auto v = point.y() - std::floor(point.y());
-    auto w = point.z() - std::floor(point.z());
-    
-    return perlin_interpolation(colors, u, v, w);
+    const Float4 gx0{gradient_x[index[0]], gradient_x[index[1]], gradient_x[index[2]], gradient_x[index[3]]};
+    const Float4 gx1{gradient_x[index[4]], gradient_x[index[5]], gradient_x[index[6]], gradient_x[index[7]]};
+    const Float4 gy0{gradient_y[index[0]], gradient_y[index[1]], gradient_y[index[2]], gradient_y[index[3]]};
+    const Float4 gy1{gradient_y[index[4]], gradient_y[index[5]], gradient_y[index[6]], gradient_y[index[7]]};
+    const Float4 gz0{gradient_z[index[0]], gradient_z[index[1]], gradient_z[index[2]], gradient_z[index[3]]};
+    const Float4 gz1{gradient_z[index[4]], gradient_z[index[5]], gradient_z[index[6]], gradient_z[index[7]]};
+
+    // Offsets from the corners; only the x offset differs between both groups
+    const Float4 offset_y{v, v, v - 1.0f, v - 1.0f};
+    const Float4 offset_z{w, w - 1.0f, w, w - 1.0f};
+    const Float4 yz_dot0 = gy0 * offset_y + gz0 * offset_z;
+    const Float4 yz_dot1 = gy1 * offset_y + gz1 * offset_z;
+    const Float4 dot0 = gx0 * Float4{u} + yz_dot0;
+    const Float4 dot1 = gx1 * Float4{u - 1.0f} + yz_dot1;
+
+    // Hermitian cubic smoothing
+    const auto uu = u * u * (3 - 2 * u);
+    const auto vv = v * v * (3 - 2 * v);
+    const auto ww = w * w * (3 - 2 * w);
+    const Float4 weight_yz = Float4{1 - vv, 1 - vv, vv, vv} * Float4{1 - ww, ww, 1 - ww, ww};
+
+    return ((dot0 * Float4{1 - uu} + dot1 * Float4{uu}) * weight_yz).sum();
 }
 
-double Perlin::perlin_interpolation(Vector3 colors[2][2][2], double u, double v, double w)
+double Perlin::noise(const Point3& point) const
 {
-    // Hermitian cubic smoothing
-    auto uu = u * u * (3 - 2 * u);
-    auto vv = v * v * (3 - 2 * v);
-    auto ww = w * w * (3 - 2 * w);
-    auto accum = 0.0;
+    int i, j, k;
+    float u, v, w;
+    split(point.x(), i, u);
+    split(point.y(), j, v);
+    split(point.z(), k, w);
+
+    return cell_noise(i, j, k, u, v, w);
+}
+
+// All octaves in one loop: the point is scaled in double and the sum accumulates in float
+double Perlin::turbulence(const Point3& point, int depth) const
+{
+    auto accum = 0.0f;
+    auto weight = 1.0f;
+    auto x = point.x();
+    auto y = point.y();
+    auto z = point.z();
 
-    for (int i = 0; i < 2; ++i)
+    for (int octave = 0; octave < depth; ++octave)
     {
-        for (int j = 0; j < 2; ++j)
-        {
-            for (int k = 0; k < 2; ++k)
-            {
-                Vector3 weight_v{u - i, v - j, w - k};
-                accum += (i * uu + (1 - i) * (1 - uu)) 
-                       * (j * vv + (1 - j) * (1 - vv)) 
-                       * (k * ww + (1 - k) * (1 - ww))
-                       * dot(colors[i][j][k], weight_v);
-            }
-        }
+        int i, j, k;
+        float u, v, w;
+        split(x, i, u);
+        split(y, j, v);
+        split(z, k, w);
+
+        accum += weight * cell_noise(i, j, k, u, v, w);
+        weight *= 0.5f;
+        x *= 2;
+        y *= 2;
+        z *= 2;
     }
 
-    return accum;
+    return std::fabs(accum);
 }
 
-double Perlin::turbulence(const Point3& point, int depth) const
+/*
+    The batch version vectorizes across points instead of across corners: each lane
+    holds one of 4 points, and the 8 corners are visited in turn, so the smoothing
+    weights and the dot products are computed once for 4 points.
+*/
+void Perlin::turbulence(const Point3* points, double* results, std::size_t count, int depth) const
 {
-    auto accum = 0.0;
-    auto temp_point = point;
-    auto weight = 1.0;
-    
-    for (int i = 0; i < depth; ++i)
+    constexpr std::size_t lanes = 4;
+    std::size_t first = 0;
+
+    for (; first + lanes <= count; first += lanes)
     {
-        accum += weight * noise(temp_point);
-        weight *= 0.5;
-        temp_point *= 2;
+        Float4 accum{0.0f};
+        auto weight = 1.0f;
+        auto scale = 1.0;
+
+        for (int octave = 0; octave < depth; ++octave)
+        {
+            int corner_index[8][lanes];
+            float fraction[3][lanes];
+
+            for (std::size_t lane = 0; lane < lanes; ++lane)
+            {
+                int i, j, k;
+                split(scale * points[first + lane].x(), i, fraction[0][lane]);
+                split(scale * points[first + lane].y(), j, fraction[1][lane]);
+                split(scale * points[first + lane].z(), k, fraction[2][lane]);
+
+                const int x[2] = {permutation_x[i], permutation_x[(i + 1) & 255]};
+                const int y[2] = {permutation_y[j], permutation_y[(j + 1) & 255]};
+                const int z[2] = {permutation_z[k], permutation_z[(k + 1) & 255]};
+
+                for (int corner = 0; corner < 8; ++corner)
+                {
+                    corner_index[corner][lane] = x[corner >> 2] ^ y[(corner >> 1) & 1] ^ z[corner & 1];
+                }
+            }
+
+            const auto u = Float4::load(fraction[0]);
+            const auto v = Float4::load(fraction[1]);
+            const auto w = Float4::load(fraction[2]);
+            const Float4 one{1.0f};
+            const Float4 three{3.0f};
+            const Float4 two{2.0f};
+            const auto uu = u * u * (three - two * u);
+            const auto vv = v * v * (three - two * v);
+            const auto ww = w * w * (three - two * w);
+            const Float4 offset_x[2] = {u, u - one};
+            const Float4 offset_y[2] = {v, v - one};
+            const Float4 offset_z[2] = {w, w - one};
+            const Float4 weight_x[2] = {one - uu, uu};
+            const Float4 weight_y[2] = {one - vv, vv};
+            const Float4 weight_z[2] = {one - ww, ww};
+
+            Float4 octave_noise{0.0f};
+
+            for (int corner = 0; corner < 8; ++corner)
+            {
+                const int delta_i = corner >> 2;
+                const int delta_j = (corner >> 1) & 1;
+                const int delta_k = corner & 1;
+                const auto* index = corner_index[corner];
+
+                const Float4 gx{gradient_x[index[0]], gradient_x[index[1]], gradient_x[index[2]], gradient_x[index[3]]};
+                const Float4 gy{gradient_y[index[0]], gradient_y[index[1]], gradient_y[index[2]], gradient_y[index[3]]};
+                const Float4 gz{gradient_z[index[0]], gradient_z[index[1]], gradient_z[index[2]], gradient_z[index[3]]};
+
+                const auto dot = gx * offset_x[delta_i] + gy * offset_y[delta_j] + gz * offset_z[delta_k];
+                octave_noise = octave_noise + weight_x[delta_i] * weight_y[delta_j] * weight_z[delta_k] * dot;
+            }
+
+            accum = accum + Float4{weight} * octave_noise;
+            weight *= 0.5f;
+            scale *= 2;
+        }
+
+        float sums[lanes];
+        accum.store(sums);
+        for (std::size_t lane = 0; lane < lanes; ++lane)
+        {
+            results[first + lane] = std::fabs(sums[lane]);
+        }
     }
 
-    return std::fabs(accum);
+    for (; first < count; ++first)
+    {
+        results[first] = turbulence(points[first], depth);
+    }
 }
-#endif // PERLIN_HPP
\ No newline at end of file
+
+#endif // PERLIN_HPP
@@ -3,17 +3,34 @@
 
 #include "vector3.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+/*
+    Smallest parameter at which a ray hit counts. Rays leaving a surface start off it (see
+    Ray::offset_origin), so this only absorbs the rounding of the hit parameters computed
+    by the primitives, not the error of the hit point itself.
+*/
+constexpr double min_hit_parameter = 1e-4;
+
 class Ray
 {
 public:
     Point3 orig;
     Vector3 dir;
     double tm;
+    // Ray cone used to estimate texture footprints: width at the origin and spread angle (radians)
+    double cone_width{0.0};
+    double cone_spread{0.0};
 
     Ray() {}
     Ray(const Point3& origin_point, const Vector3& direction_vector, double time): 
         orig{origin_point}, dir{direction_vector}, tm{time}
     {}
+    Ray(const Point3& origin_point, const Vector3& direction_vector, double time, double width, double spread): 
+        orig{origin_point}, dir{direction_vector}, tm{time}, cone_width{width}, cone_spread{spread}
+    {}
 
     Point3 origin() const 
     {
@@ -34,6 +51,52 @@ public:
     {
         return orig + parameter * dir;
     }
+
+    // Width of the ray cone at the given parameter
+    double cone_width_at(double parameter) const
+    {
+        return cone_width + parameter * dir.length() * cone_spread;
+    }
+
+    /*
+        Ray leaving the surface hit at the given parameter; it keeps the time and
+        continues the ray cone from its width at the hit point (surface curvature
+        is ignored, so the spread angle is unchanged).
+    */
+    Ray scattered(const Point3& point, const Vector3& direction, double parameter) const
+    {
+        return Ray{point, direction, tm, cone_width_at(parameter), cone_spread};
+    }
+
+    // Same, with the origin offset from the surface of the given normal (see offset_origin)
+    Ray scattered(const Point3& point, const Vector3& normal, const Vector3& direction, double parameter) const
+    {
+        return scattered(offset_origin(point, normal, direction, parameter), direction, parameter);
+    }
+
+    /*
+        Origin for a ray leaving the surface this ray hit at point, at the given parameter:
+        the computed point is off the surface by its rounding error, on either side, so
+        it's moved along the normal to the side the new direction leaves towards by a
+        bound on that error. at(parameter) is within a few units in the last place of
+        |origin| + parameter * |direction| (per axis, at most the largest of them), and
+        the primitives and transforms that computed the point from it add a few more, so
+        the bound is error_ulps of that magnitude. In double it's far below anything
+        visible; in float it's what keeps secondary rays from hitting the surface they
+        leave, which a fixed minimum hit parameter can't do at every scene scale.
+    */
+    Point3 offset_origin(const Point3& point, const Vector3& normal, const Vector3& direction, double parameter) const
+    {
+        constexpr double error_ulps = 64.0;
+        const auto largest = [](const Vector3& vector)
+        {
+            return std::max({std::fabs(vector.x()), std::fabs(vector.y()), std::fabs(vector.z())});
+        };
+
+        const auto magnitude = std::max(largest(orig) + std::fabs(parameter) * largest(dir), static_cast<double>(largest(point)));
+        const auto distance = error_ulps * std::numeric_limits<real>::epsilon() * magnitude;
+        return point + (dot(direction, normal) < 0 ? -distance : distance) * normal;
+    }
 };
 
 #endif // RAY_HPP
\ No newline at end of file
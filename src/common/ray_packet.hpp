@@ -0,0 +1,207 @@
+#ifndef RAY_PACKET_HPP
+#define RAY_PACKET_HPP
+
+#include "aabb.hpp"
+#include "ray.hpp"
+#include "simd.hpp"
+#include "statistics.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+/*
+    Packet of up to 16 coherent rays, typically the camera rays of a block of pixels,
+    traced through the BVH together: every node is tested once for the whole packet
+    instead of once per ray.
+
+    Lanes are selected with bit masks (bit i is lane i). Besides the rays themselves,
+    the packet keeps float copies of the origins and inverse directions in structure of
+    arrays layout, 4 lanes at a time for the SIMD box tests, and the bounds of the
+    origins and inverse directions over the whole packet for culling nodes with
+    interval arithmetic.
+*/
+class RayPacket
+{
+public:
+    static constexpr int max_size{16};
+
+    // Number of lanes, a multiple of 4
+    int size{0};
+    Ray rays[max_size];
+
+    alignas(16) float origin[3][max_size];
+    alignas(16) float inverse_direction[3][max_size];
+
+    // Whether the directions of the packet have one sign per axis; the bounds are only valid then
+    bool coherent{false};
+    float origin_min[3];
+    float origin_max[3];
+    float inverse_min[3];
+    float inverse_max[3];
+
+    // Fills the float copies and the bounds from rays[0, size[; lanes outside active are ignored
+    void prepare(std::uint32_t active);
+
+    static int count(std::uint32_t lanes);
+};
+
+/*
+    Bounding box rounded outwards to float for the packet tests, so they stay
+    conservative: a packet test may keep a node a double precision test would reject,
+    which only costs time, but never the other way around.
+*/
+class PacketBox
+{
+public:
+    float minimum[3];
+    float maximum[3];
+
+    PacketBox() {}
+    explicit PacketBox(const AABB& box);
+
+    /*
+        Lanes of active whose ray overlaps the box between min_parameter and their own
+        max_parameters[lane] (the closest hit found so far).
+    */
+    std::uint32_t hit(const RayPacket& packet, std::uint32_t active, float min_parameter, const float* max_parameters) const;
+    // True if no ray of a coherent packet can overlap the box beyond min_parameter
+    bool culls(const RayPacket& packet, float min_parameter) const;
+};
+
+void RayPacket::prepare(std::uint32_t active)
+{
+    // Zero direction components get a large finite inverse, so slab tests never compute 0 * infinity
+    const auto inverse = [](double direction)
+    {
+        return static_cast<float>(std::clamp(1.0 / direction, -1e30, 1e30));
+    };
+
+    coherent = active != 0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        origin_min[axis] = inverse_min[axis] = std::numeric_limits<float>::infinity();
+        origin_max[axis] = inverse_max[axis] = -std::numeric_limits<float>::infinity();
+
+        for (int lane = 0; lane < size; ++lane)
+        {
+            if (!(active & (1u << lane)))
+            {
+                origin[axis][lane] = 0.0f;
+                inverse_direction[axis][lane] = 1.0f;
+                continue;
+            }
+
+            origin[axis][lane] = static_cast<float>(rays[lane].origin()[axis]);
+            inverse_direction[axis][lane] = inverse(rays[lane].direction()[axis]);
+
+            origin_min[axis] = std::min(origin_min[axis], origin[axis][lane]);
+            origin_max[axis] = std::max(origin_max[axis], origin[axis][lane]);
+            inverse_min[axis] = std::min(inverse_min[axis], inverse_direction[axis][lane]);
+            inverse_max[axis] = std::max(inverse_max[axis], inverse_direction[axis][lane]);
+        }
+
+        // The inverse directions only form an interval if they don't straddle zero
+        coherent = coherent && (inverse_min[axis] > 0.0f || inverse_max[axis] < 0.0f);
+    }
+}
+
+int RayPacket::count(std::uint32_t lanes)
+{
+    return static_cast<int>(std::bitset<32>{lanes}.count());
+}
+
+/*
+    Besides rounding outwards, the bounds are padded by a relative 2^-18, which covers
+    the rounding of the ray origins to float for origins up to a few times further from
+    the scene origin than the box itself.
+*/
+PacketBox::PacketBox(const AABB& box)
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const auto padding = std::ldexp(std::fmax(1.0, std::fmax(std::fabs(box.min()[axis]), std::fabs(box.max()[axis]))), -18);
+        minimum[axis] = std::nextafter(static_cast<float>(box.min()[axis] - padding), -std::numeric_limits<float>::infinity());
+        maximum[axis] = std::nextafter(static_cast<float>(box.max()[axis] + padding), std::numeric_limits<float>::infinity());
+    }
+}
+
+/*
+    Slab test of 4 lanes at a time: along every axis, the ray is inside the slab between
+    the parameters t0 = (minimum - origin) / direction and t1 = (maximum - origin) / direction,
+    and it overlaps the box if the latest entry is before the earliest exit. Groups of 4
+    lanes with no active lane are skipped.
+*/
+std::uint32_t PacketBox::hit(const RayPacket& packet, std::uint32_t active, float min_parameter, const float* max_parameters) const
+{
+    std::uint32_t result = 0;
+
+    for (int group = 0; group < packet.size; group += 4)
+    {
+        const auto group_lanes = (active >> group) & 0xfu;
+        if (!group_lanes)
+        {
+            continue;
+        }
+        RT_STATISTIC(thread_counters().box_tests += RayPacket::count(group_lanes));
+
+        auto entry = Float4{min_parameter};
+        auto exit = Float4::load(max_parameters + group);
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const auto origin = Float4::load(packet.origin[axis] + group);
+            const auto inverse_direction = Float4::load(packet.inverse_direction[axis] + group);
+            const auto t0 = (Float4{minimum[axis]} - origin) * inverse_direction;
+            const auto t1 = (Float4{maximum[axis]} - origin) * inverse_direction;
+
+            entry = max(entry, min(t0, t1));
+            exit = min(exit, max(t0, t1));
+        }
+
+        // Touching the box counts as a hit, to stay conservative
+        const auto hits = ~static_cast<std::uint32_t>(less_mask(exit, entry)) & group_lanes;
+        RT_STATISTIC(thread_counters().box_hits += RayPacket::count(hits));
+        result |= hits << group;
+    }
+
+    return result;
+}
+
+/*
+    Interval arithmetic over the packet bounds: for every ray of the packet, the entry
+    parameter along an axis is at least the lower bound of
+        [near - origin_max; near - origin_min] * [inverse_min; inverse_max]
+    and the exit parameter at most the upper bound of the same product with the far plane,
+    where near and far are the planes the directions face. If the largest entry bound is
+    beyond the smallest exit bound, or every exit is before min_parameter, no ray can
+    overlap the box.
+*/
+bool PacketBox::culls(const RayPacket& packet, float min_parameter) const
+{
+    float entry = min_parameter;
+    float exit = std::numeric_limits<float>::infinity();
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const bool positive = packet.inverse_min[axis] > 0.0f;
+        const auto near_plane = positive ? minimum[axis] : maximum[axis];
+        const auto far_plane = positive ? maximum[axis] : minimum[axis];
+
+        const float near_low = near_plane - packet.origin_max[axis];
+        const float near_high = near_plane - packet.origin_min[axis];
+        const float far_low = far_plane - packet.origin_max[axis];
+        const float far_high = far_plane - packet.origin_min[axis];
+
+        entry = std::max({entry, std::min({near_low * packet.inverse_min[axis], near_low * packet.inverse_max[axis],
+                                           near_high * packet.inverse_min[axis], near_high * packet.inverse_max[axis]})});
+        exit = std::min({exit, std::max({far_low * packet.inverse_min[axis], far_low * packet.inverse_max[axis],
+                                         far_high * packet.inverse_min[axis], far_high * packet.inverse_max[axis]})});
+    }
+
+    return exit < entry;
+}
+
+#endif // RAY_PACKET_HPP
@@ -0,0 +1,237 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <cmath>
+
+/*
+    Minimal portable 4-lane float vector: SSE on x86-64 (always available there),
+    NEON on ARM, and a plain array otherwise. Only the operations needed by the
+    vectorized kernels are provided.
+*/
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define RT_SIMD_SSE
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+    #define RT_SIMD_NEON
+    #include <arm_neon.h>
+#endif
+
+class Float4
+{
+public:
+    Float4() {}
+    Float4(float value);
+    Float4(float first, float second, float third, float fourth);
+
+    // Unaligned load/store of 4 consecutive floats
+    static Float4 load(const float* values);
+    void store(float* values) const;
+    // Same, for 16 byte aligned values
+    static Float4 load_aligned(const float* values);
+    void store_aligned(float* values) const;
+
+    // Sum of the four lanes
+    float sum() const;
+    // Sum of the first three lanes, for 3D vectors padded with a fourth lane
+    float sum3() const;
+    // Lanes (y, z, x, w) of (x, y, z, w)
+    Float4 yzx() const;
+
+    friend Float4 operator+(const Float4& a, const Float4& b);
+    friend Float4 operator-(const Float4& a, const Float4& b);
+    friend Float4 operator*(const Float4& a, const Float4& b);
+    friend Float4 operator/(const Float4& a, const Float4& b);
+    friend Float4 sqrt(const Float4& a);
+    // Estimate of 1 / sqrt(a) refined by one Newton-Raphson step, within about 2 ulp
+    friend Float4 reciprocal_sqrt(const Float4& a);
+    friend Float4 min(const Float4& a, const Float4& b);
+    friend Float4 max(const Float4& a, const Float4& b);
+    // Bit i is set when lane i of a is less than lane i of b
+    friend int less_mask(const Float4& a, const Float4& b);
+private:
+#if defined(RT_SIMD_SSE)
+    __m128 lanes;
+    explicit Float4(__m128 values): lanes{values} {}
+#elif defined(RT_SIMD_NEON)
+    float32x4_t lanes;
+    explicit Float4(float32x4_t values): lanes{values} {}
+#else
+    float lanes[4];
+#endif
+};
+
+#if defined(RT_SIMD_SSE)
+
+inline Float4::Float4(float value): lanes{_mm_set1_ps(value)} {}
+inline Float4::Float4(float first, float second, float third, float fourth): lanes{_mm_setr_ps(first, second, third, fourth)} {}
+inline Float4 Float4::load(const float* values) { return Float4{_mm_loadu_ps(values)}; }
+inline void Float4::store(float* values) const { _mm_storeu_ps(values, lanes); }
+inline Float4 Float4::load_aligned(const float* values) { return Float4{_mm_load_ps(values)}; }
+inline void Float4::store_aligned(float* values) const { _mm_store_ps(values, lanes); }
+
+inline float Float4::sum() const
+{
+    __m128 shuffled = _mm_shuffle_ps(lanes, lanes, _MM_SHUFFLE(2, 3, 0, 1)); // (b, a, d, c)
+    __m128 pairs = _mm_add_ps(lanes, shuffled);                             // (a+b, a+b, c+d, c+d)
+    shuffled = _mm_movehl_ps(shuffled, pairs);                              // (c+d, c+d, ...)
+    return _mm_cvtss_f32(_mm_add_ss(pairs, shuffled));
+}
+
+inline float Float4::sum3() const
+{
+    const __m128 y = _mm_shuffle_ps(lanes, lanes, _MM_SHUFFLE(1, 1, 1, 1));
+    const __m128 z = _mm_movehl_ps(lanes, lanes);
+    return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(lanes, y), z));
+}
+
+inline Float4 Float4::yzx() const { return Float4{_mm_shuffle_ps(lanes, lanes, _MM_SHUFFLE(3, 0, 2, 1))}; }
+
+inline Float4 operator+(const Float4& a, const Float4& b) { return Float4{_mm_add_ps(a.lanes, b.lanes)}; }
+inline Float4 operator-(const Float4& a, const Float4& b) { return Float4{_mm_sub_ps(a.lanes, b.lanes)}; }
+inline Float4 operator*(const Float4& a, const Float4& b) { return Float4{_mm_mul_ps(a.lanes, b.lanes)}; }
+inline Float4 operator/(const Float4& a, const Float4& b) { return Float4{_mm_div_ps(a.lanes, b.lanes)}; }
+inline Float4 sqrt(const Float4& a) { return Float4{_mm_sqrt_ps(a.lanes)}; }
+
+// y' = y * (3 - a * y^2) / 2
+inline Float4 reciprocal_sqrt(const Float4& a)
+{
+    const __m128 estimate = _mm_rsqrt_ps(a.lanes);
+    const __m128 correction = _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_mul_ps(a.lanes, estimate), estimate));
+    return Float4{_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), estimate), correction)};
+}
+
+inline Float4 min(const Float4& a, const Float4& b) { return Float4{_mm_min_ps(a.lanes, b.lanes)}; }
+inline Float4 max(const Float4& a, const Float4& b) { return Float4{_mm_max_ps(a.lanes, b.lanes)}; }
+inline int less_mask(const Float4& a, const Float4& b) { return _mm_movemask_ps(_mm_cmplt_ps(a.lanes, b.lanes)); }
+
+#elif defined(RT_SIMD_NEON)
+
+inline Float4::Float4(float value): lanes{vdupq_n_f32(value)} {}
+inline Float4::Float4(float first, float second, float third, float fourth)
+{
+    const float values[4] = {first, second, third, fourth};
+    lanes = vld1q_f32(values);
+}
+inline Float4 Float4::load(const float* values) { return Float4{vld1q_f32(values)}; }
+inline void Float4::store(float* values) const { vst1q_f32(values, lanes); }
+inline Float4 Float4::load_aligned(const float* values) { return Float4{vld1q_f32(values)}; }
+inline void Float4::store_aligned(float* values) const { vst1q_f32(values, lanes); }
+
+inline float Float4::sum() const
+{
+    float32x2_t pairs = vadd_f32(vget_low_f32(lanes), vget_high_f32(lanes));
+    return vget_lane_f32(vpadd_f32(pairs, pairs), 0);
+}
+
+inline float Float4::sum3() const
+{
+    const float32x2_t low = vget_low_f32(lanes);
+    return vget_lane_f32(vpadd_f32(low, low), 0) + vgetq_lane_f32(lanes, 2);
+}
+
+inline Float4 Float4::yzx() const
+{
+    float32x4_t rotated = vextq_f32(lanes, lanes, 1);                            // (y, z, w, x)
+    rotated = vsetq_lane_f32(vgetq_lane_f32(lanes, 0), rotated, 2);              // (y, z, x, x)
+    return Float4{vsetq_lane_f32(vgetq_lane_f32(lanes, 3), rotated, 3)};         // (y, z, x, w)
+}
+
+inline Float4 operator+(const Float4& a, const Float4& b) { return Float4{vaddq_f32(a.lanes, b.lanes)}; }
+inline Float4 operator-(const Float4& a, const Float4& b) { return Float4{vsubq_f32(a.lanes, b.lanes)}; }
+inline Float4 operator*(const Float4& a, const Float4& b) { return Float4{vmulq_f32(a.lanes, b.lanes)}; }
+
+// ARMv7 NEON has no division or square root, so they're computed from the reciprocal estimates
+inline Float4 operator/(const Float4& a, const Float4& b)
+{
+    float32x4_t reciprocal = vrecpeq_f32(b.lanes);
+    reciprocal = vmulq_f32(vrecpsq_f32(b.lanes, reciprocal), reciprocal);
+    reciprocal = vmulq_f32(vrecpsq_f32(b.lanes, reciprocal), reciprocal);
+    return Float4{vmulq_f32(a.lanes, reciprocal)};
+}
+
+inline Float4 reciprocal_sqrt(const Float4& a)
+{
+    const float32x4_t estimate = vrsqrteq_f32(a.lanes);
+    return Float4{vmulq_f32(vrsqrtsq_f32(vmulq_f32(a.lanes, estimate), estimate), estimate)};
+}
+
+inline Float4 sqrt(const Float4& a)
+{
+    // sqrt(a) = a / sqrt(a), with 0 kept as 0 instead of 0 * infinity
+    const uint32x4_t zero = vceqq_f32(a.lanes, vdupq_n_f32(0.0f));
+    const float32x4_t root = vmulq_f32(a.lanes, reciprocal_sqrt(a).lanes);
+    return Float4{vbslq_f32(zero, a.lanes, root)};
+}
+
+inline Float4 min(const Float4& a, const Float4& b) { return Float4{vminq_f32(a.lanes, b.lanes)}; }
+inline Float4 max(const Float4& a, const Float4& b) { return Float4{vmaxq_f32(a.lanes, b.lanes)}; }
+
+inline int less_mask(const Float4& a, const Float4& b)
+{
+    const uint32x4_t less = vcltq_f32(a.lanes, b.lanes);
+    return static_cast<int>((vgetq_lane_u32(less, 0) & 1) | (vgetq_lane_u32(less, 1) & 2) | (vgetq_lane_u32(less, 2) & 4) | (vgetq_lane_u32(less, 3) & 8));
+}
+
+#else
+
+inline Float4::Float4(float value): lanes{value, value, value, value} {}
+inline Float4::Float4(float first, float second, float third, float fourth): lanes{first, second, third, fourth} {}
+inline Float4 Float4::load(const float* values) { return Float4{values[0], values[1], values[2], values[3]}; }
+inline void Float4::store(float* values) const
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        values[i] = lanes[i];
+    }
+}
+
+inline Float4 Float4::load_aligned(const float* values) { return load(values); }
+inline void Float4::store_aligned(float* values) const { store(values); }
+
+inline float Float4::sum() const
+{
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+inline float Float4::sum3() const
+{
+    return (lanes[0] + lanes[1]) + lanes[2];
+}
+
+inline Float4 Float4::yzx() const
+{
+    return Float4{lanes[1], lanes[2], lanes[0], lanes[3]};
+}
+
+inline Float4 operator+(const Float4& a, const Float4& b) { return Float4{a.lanes[0] + b.lanes[0], a.lanes[1] + b.lanes[1], a.lanes[2] + b.lanes[2], a.lanes[3] + b.lanes[3]}; }
+inline Float4 operator-(const Float4& a, const Float4& b) { return Float4{a.lanes[0] - b.lanes[0], a.lanes[1] - b.lanes[1], a.lanes[2] - b.lanes[2], a.lanes[3] - b.lanes[3]}; }
+inline Float4 operator*(const Float4& a, const Float4& b) { return Float4{a.lanes[0] * b.lanes[0], a.lanes[1] * b.lanes[1], a.lanes[2] * b.lanes[2], a.lanes[3] * b.lanes[3]}; }
+inline Float4 operator/(const Float4& a, const Float4& b) { return Float4{a.lanes[0] / b.lanes[0], a.lanes[1] / b.lanes[1], a.lanes[2] / b.lanes[2], a.lanes[3] / b.lanes[3]}; }
+inline Float4 sqrt(const Float4& a) { return Float4{std::sqrt(a.lanes[0]), std::sqrt(a.lanes[1]), std::sqrt(a.lanes[2]), std::sqrt(a.lanes[3])}; }
+inline Float4 reciprocal_sqrt(const Float4& a) { return Float4{1.0f} / sqrt(a); }
+
+inline Float4 min(const Float4& a, const Float4& b)
+{
+    return Float4{a.lanes[0] < b.lanes[0] ? a.lanes[0] : b.lanes[0], a.lanes[1] < b.lanes[1] ? a.lanes[1] : b.lanes[1],
+                  a.lanes[2] < b.lanes[2] ? a.lanes[2] : b.lanes[2], a.lanes[3] < b.lanes[3] ? a.lanes[3] : b.lanes[3]};
+}
+
+inline Float4 max(const Float4& a, const Float4& b)
+{
+    return Float4{a.lanes[0] > b.lanes[0] ? a.lanes[0] : b.lanes[0], a.lanes[1] > b.lanes[1] ? a.lanes[1] : b.lanes[1],
+                  a.lanes[2] > b.lanes[2] ? a.lanes[2] : b.lanes[2], a.lanes[3] > b.lanes[3] ? a.lanes[3] : b.lanes[3]};
+}
+
+inline int less_mask(const Float4& a, const Float4& b)
+{
+    int mask = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        mask |= a.lanes[i] < b.lanes[i] ? 1 << i : 0;
+    }
+    return mask;
+}
+
+#endif
+
+#endif // SIMD_HPP
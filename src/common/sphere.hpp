@@ -2,6 +2,7 @@
 #define SPHERE_HPP
 
 #include "hittable.hpp"
+#include "material.hpp"
 #include "ray.hpp"
 #include "util.hpp"
 #include <cmath>
@@ -19,6 +20,11 @@ public:
 
     virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const override;
     virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const override;
+    virtual void surface_interaction(const Ray& ray, HitRecord& record) const override;
+    virtual bool occluded(const Ray& ray, double min_parameter, double max_parameter) const override;
+
+    // Point on the surface with UV coordinates (u, v); inverse of the mapping used by hit
+    Point3 surface_point(double u, double v) const;
 private:
     static void get_sphere_uv(const Point3& point, double& u, double& v);
 };
@@ -32,11 +38,13 @@ private:
     
     Return true if the ray hits the sphere, false otherwise.
     
-    If the ray hitted the sphere, the intersection point, the surface normal at the
-    intersection point and the root/parameter are stored in HitRecord.
+    If the ray hitted the sphere, the root/parameter is stored in HitRecord; the rest is
+    left to surface_interaction.
 */
 bool Sphere::hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const
 {
+    RT_STATISTIC(count_primitive_test(PrimitiveKind::Sphere));
+
     Vector3 center_to_origin = ray.origin() - center; // A - C in the equation
     auto quadratic_coefficient = ray.direction().length_squared();
     auto half_linear_coefficient = dot(ray.direction(), center_to_origin);
@@ -61,12 +69,52 @@ bool Sphere::hit(const Ray& ray, double min_parameter, double max_parameter, Hit
     }
 
     record.parameter = root;
-    record.point = ray.at(root);
+    record.object = this;
+    
+    RT_STATISTIC(count_primitive_hit(PrimitiveKind::Sphere));
+    return true;
+}
+
+void Sphere::surface_interaction(const Ray& ray, HitRecord& record) const
+{
+    record.point = ray.at(record.parameter);
     Vector3 outward_normal = (record.point - center) / radius; // Unit length normal
     record.set_face_normal(ray, outward_normal);
-    get_sphere_uv(outward_normal, record.u, record.v);
     record.material = material;
-    
+
+    if (material->uses_uv())
+    {
+        get_sphere_uv(outward_normal, record.u, record.v);
+        // A unit of v spans half a great circle, the shortest of both UV directions
+        record.set_footprint(ray, pi * std::fabs(radius));
+    }
+}
+
+// Same roots as hit; either one within the interval occludes
+bool Sphere::occluded(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    RT_STATISTIC(count_primitive_test(PrimitiveKind::Sphere));
+
+    Vector3 center_to_origin = ray.origin() - center;
+    auto quadratic_coefficient = ray.direction().length_squared();
+    auto half_linear_coefficient = dot(ray.direction(), center_to_origin);
+    auto constant_coefficient = center_to_origin.length_squared() - radius * radius;
+
+    auto discriminant = half_linear_coefficient * half_linear_coefficient - quadratic_coefficient * constant_coefficient;
+    if (discriminant < 0.0)
+    {
+        return false;
+    }
+
+    auto sqrt_discriminant = std::sqrt(discriminant);
+    auto near_root = (-half_linear_coefficient - sqrt_discriminant) / quadratic_coefficient;
+    auto far_root = (-half_linear_coefficient + sqrt_discriminant) / quadratic_coefficient;
+    if ((near_root < min_parameter || near_root > max_parameter) && (far_root < min_parameter || far_root > max_parameter))
+    {
+        return false;
+    }
+
+    RT_STATISTIC(count_primitive_hit(PrimitiveKind::Sphere));
     return true;
 }
 
@@ -105,4 +153,12 @@ void Sphere::get_sphere_uv(const Point3& point, double& u, double& v)
     v = theta / pi;
 }
 
+Point3 Sphere::surface_point(double u, double v) const
+{
+    auto phi = 2 * pi * u - pi;
+    auto theta = pi * v;
+
+    return center + radius * Vector3{std::cos(phi) * std::sin(theta), -std::cos(theta), -std::sin(phi) * std::sin(theta)};
+}
+
 #endif // SPHERE_HPP
\ No newline at end of file
@@ -0,0 +1,342 @@
+#ifndef STATISTICS_HPP
+#define STATISTICS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/*
+    Render counters, compiled in only when RT_STATISTICS is defined (CMake option
+    RT_STATISTICS). Hooks are written as
+
+        RT_STATISTIC(count_box_test());
+
+    which expands to nothing otherwise, so a regular build pays nothing for them.
+
+    Every thread increments its own slot, without atomics; the slots belong to a global
+    registry that outlives the threads, and they're summed once rendering is done.
+    collect_counters and reset_counters must only be called while no thread is rendering.
+*/
+#ifdef RT_STATISTICS
+    #define RT_STATISTIC(statement) statement
+#else
+    #define RT_STATISTIC(statement)
+#endif
+
+enum class PrimitiveKind
+{
+    Sphere,
+    MovingSphere,
+    XYRect,
+    XZRect,
+    YZRect,
+    ConstantMedium,
+    GridMedium,
+    Count
+};
+
+enum class MaterialKind
+{
+    Lambertian,
+    Metal,
+    Dielectric,
+    DiffuseLight,
+    Isotropic,
+    Count
+};
+
+// Why a path stopped being traced
+enum class PathEnd
+{
+    Escaped,  // missed everything and took the background color
+    Absorbed, // the material didn't scatter (e.g. a light)
+    MaxDepth, // reached the maximum number of bounces
+    Count
+};
+
+struct TraversalCounters
+{
+    // Rays of deeper bounces are counted in the last slot
+    static constexpr std::size_t max_tracked_depth{64};
+    static constexpr std::size_t primitive_kinds{static_cast<std::size_t>(PrimitiveKind::Count)};
+    static constexpr std::size_t material_kinds{static_cast<std::size_t>(MaterialKind::Count)};
+    static constexpr std::size_t path_ends{static_cast<std::size_t>(PathEnd::Count)};
+
+    std::array<std::uint64_t, max_tracked_depth> rays_per_depth{};
+    std::uint64_t bvh_nodes_visited{0};
+    std::uint64_t box_tests{0};
+    std::uint64_t box_hits{0};
+    std::uint64_t list_visits{0};
+    std::array<std::uint64_t, primitive_kinds> primitive_tests{};
+    std::array<std::uint64_t, primitive_kinds> primitive_hits{};
+    std::array<std::uint64_t, material_kinds> scatter_calls{};
+    std::array<std::uint64_t, path_ends> path_end_counts{};
+
+    TraversalCounters& operator+=(const TraversalCounters& other);
+
+    std::uint64_t rays() const;
+};
+
+const char* primitive_name(PrimitiveKind kind);
+const char* material_name(MaterialKind kind);
+const char* path_end_name(PathEnd end);
+
+// Owns the per-thread slots
+class CounterRegistry
+{
+public:
+    static CounterRegistry& instance();
+
+    TraversalCounters* register_thread();
+    TraversalCounters collect() const;
+    void reset();
+private:
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<TraversalCounters>> slots;
+};
+
+TraversalCounters& TraversalCounters::operator+=(const TraversalCounters& other)
+{
+    for (std::size_t depth = 0; depth < max_tracked_depth; ++depth)
+    {
+        rays_per_depth[depth] += other.rays_per_depth[depth];
+    }
+
+    bvh_nodes_visited += other.bvh_nodes_visited;
+    box_tests += other.box_tests;
+    box_hits += other.box_hits;
+    list_visits += other.list_visits;
+
+    for (std::size_t kind = 0; kind < primitive_kinds; ++kind)
+    {
+        primitive_tests[kind] += other.primitive_tests[kind];
+        primitive_hits[kind] += other.primitive_hits[kind];
+    }
+
+    for (std::size_t kind = 0; kind < material_kinds; ++kind)
+    {
+        scatter_calls[kind] += other.scatter_calls[kind];
+    }
+
+    for (std::size_t end = 0; end < path_ends; ++end)
+    {
+        path_end_counts[end] += other.path_end_counts[end];
+    }
+
+    return *this;
+}
+
+std::uint64_t TraversalCounters::rays() const
+{
+    std::uint64_t total = 0;
+    for (auto rays: rays_per_depth)
+    {
+        total += rays;
+    }
+    return total;
+}
+
+const char* primitive_name(PrimitiveKind kind)
+{
+    switch (kind)
+    {
+    case PrimitiveKind::Sphere: return "Sphere";
+    case PrimitiveKind::MovingSphere: return "MovingSphere";
+    case PrimitiveKind::XYRect: return "XYRect";
+    case PrimitiveKind::XZRect: return "XZRect";
+    case PrimitiveKind::YZRect: return "YZRect";
+    case PrimitiveKind::ConstantMedium: return "ConstantMedium";
+    case PrimitiveKind::GridMedium: return "GridMedium";
+    default: return "";
+    }
+}
+
+const char* material_name(MaterialKind kind)
+{
+    switch (kind)
+    {
+    case MaterialKind::Lambertian: return "Lambertian";
+    case MaterialKind::Metal: return "Metal";
+    case MaterialKind::Dielectric: return "Dielectric";
+    case MaterialKind::DiffuseLight: return "DiffuseLight";
+    case MaterialKind::Isotropic: return "Isotropic";
+    default: return "";
+    }
+}
+
+const char* path_end_name(PathEnd end)
+{
+    switch (end)
+    {
+    case PathEnd::Escaped: return "escaped";
+    case PathEnd::Absorbed: return "absorbed";
+    case PathEnd::MaxDepth: return "max depth";
+    default: return "";
+    }
+}
+
+CounterRegistry& CounterRegistry::instance()
+{
+    static CounterRegistry registry;
+    return registry;
+}
+
+TraversalCounters* CounterRegistry::register_thread()
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    slots.push_back(std::make_unique<TraversalCounters>());
+    return slots.back().get();
+}
+
+TraversalCounters CounterRegistry::collect() const
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    TraversalCounters total;
+    for (const auto& slot: slots)
+    {
+        total += *slot;
+    }
+    return total;
+}
+
+void CounterRegistry::reset()
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    for (auto& slot: slots)
+    {
+        *slot = TraversalCounters{};
+    }
+}
+
+// Slot of the calling thread, registered on first use
+inline TraversalCounters& thread_counters()
+{
+    thread_local TraversalCounters* counters = CounterRegistry::instance().register_thread();
+    return *counters;
+}
+
+inline TraversalCounters collect_counters()
+{
+    return CounterRegistry::instance().collect();
+}
+
+inline void reset_counters()
+{
+    CounterRegistry::instance().reset();
+}
+
+inline void count_ray(int depth)
+{
+    const auto slot = std::min<std::size_t>(static_cast<std::size_t>(depth), TraversalCounters::max_tracked_depth - 1);
+    ++thread_counters().rays_per_depth[slot];
+}
+
+inline void count_bvh_node()
+{
+    ++thread_counters().bvh_nodes_visited;
+}
+
+inline void count_box_test()
+{
+    ++thread_counters().box_tests;
+}
+
+inline void count_box_hit()
+{
+    ++thread_counters().box_hits;
+}
+
+inline void count_list_visit()
+{
+    ++thread_counters().list_visits;
+}
+
+inline void count_primitive_test(PrimitiveKind kind)
+{
+    ++thread_counters().primitive_tests[static_cast<std::size_t>(kind)];
+}
+
+inline void count_primitive_hit(PrimitiveKind kind)
+{
+    ++thread_counters().primitive_hits[static_cast<std::size_t>(kind)];
+}
+
+inline void count_scatter(MaterialKind kind)
+{
+    ++thread_counters().scatter_calls[static_cast<std::size_t>(kind)];
+}
+
+inline void count_path_end(PathEnd end)
+{
+    ++thread_counters().path_end_counts[static_cast<std::size_t>(end)];
+}
+
+// Summary table; rows with a zero count are skipped
+void print_counters(std::ostream& out, const TraversalCounters& counters)
+{
+    const auto rays = counters.rays();
+    const auto ratio = [](std::uint64_t part, std::uint64_t whole) { return whole ? static_cast<double>(part) / whole : 0.0; };
+    const auto flags = out.flags();
+    const auto precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+
+    out << "Rays traced: " << rays << "\n";
+    for (std::size_t depth = 0; depth < TraversalCounters::max_tracked_depth; ++depth)
+    {
+        if (counters.rays_per_depth[depth])
+        {
+            out << "  depth " << std::setw(2) << depth << (depth + 1 == TraversalCounters::max_tracked_depth ? "+" : " ")
+                << std::setw(16) << counters.rays_per_depth[depth] << "\n";
+        }
+    }
+
+    out << "BVH nodes visited: " << counters.bvh_nodes_visited << " (" << ratio(counters.bvh_nodes_visited, rays) << " per ray)\n";
+    out << "Box tests: " << counters.box_tests << " (" << ratio(counters.box_tests, rays) << " per ray, hit ratio "
+        << ratio(counters.box_hits, counters.box_tests) << ")\n";
+    out << "List visits: " << counters.list_visits << "\n";
+
+    out << "Primitive tests:\n";
+    for (std::size_t kind = 0; kind < TraversalCounters::primitive_kinds; ++kind)
+    {
+        if (counters.primitive_tests[kind])
+        {
+            out << "  " << std::left << std::setw(16) << primitive_name(static_cast<PrimitiveKind>(kind)) << std::right
+                << std::setw(16) << counters.primitive_tests[kind] << "  hit ratio "
+                << ratio(counters.primitive_hits[kind], counters.primitive_tests[kind]) << "\n";
+        }
+    }
+
+    out << "Scatter calls:\n";
+    for (std::size_t kind = 0; kind < TraversalCounters::material_kinds; ++kind)
+    {
+        if (counters.scatter_calls[kind])
+        {
+            out << "  " << std::left << std::setw(16) << material_name(static_cast<MaterialKind>(kind)) << std::right
+                << std::setw(16) << counters.scatter_calls[kind] << "\n";
+        }
+    }
+
+    std::uint64_t paths = 0;
+    for (auto count: counters.path_end_counts)
+    {
+        paths += count;
+    }
+
+    out << "Path terminations:\n";
+    for (std::size_t end = 0; end < TraversalCounters::path_ends; ++end)
+    {
+        out << "  " << std::left << std::setw(16) << path_end_name(static_cast<PathEnd>(end)) << std::right
+            << std::setw(16) << counters.path_end_counts[end] << "  " << ratio(counters.path_end_counts[end], paths) << "\n";
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+#endif // STATISTICS_HPP
@@ -1,18 +1,65 @@
 #ifndef TEXTURE_HPP
 #define TEXTURE_HPP
 
+#include "aabb.hpp"
 #include "perlin.hpp"
-#include "rt_stb_image.hpp"
+#include "texture_cache.hpp"
 #include "vector3.hpp"
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstddef>
+#include <functional>
 #include <vector>
 
+// Arguments of a filtered_value lookup, for batches of lookups
+struct TextureLookup
+{
+    double u;
+    double v;
+    Point3 point;
+    double footprint;
+};
+
 class Texture
 {
 public:
     virtual Color value(double u, double v, const Point3& point) const = 0;
+
+    /*
+        Lookup filtered over a footprint given in UV units (see HitRecord::footprint);
+        textures that don't need filtering just return value(u, v, point).
+    */
+    virtual Color filtered_value(double u, double v, const Point3& point, double footprint) const;
+
+    // Batch form of filtered_value: values[i] is the lookup of lookups[i]
+    virtual void filtered_values(const TextureLookup* lookups, Color* values, std::size_t count) const;
+
+    /*
+        Whether the value depends on u, v or the footprint (which is in UV units); if not,
+        hits don't compute them (see Hittable::surface_interaction).
+    */
+    virtual bool uses_uv() const;
 };
 
+Color Texture::filtered_value(double u, double v, const Point3& point, double footprint) const
+{
+    return value(u, v, point);
+}
+
+void Texture::filtered_values(const TextureLookup* lookups, Color* values, std::size_t count) const
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        values[i] = filtered_value(lookups[i].u, lookups[i].v, lookups[i].point, lookups[i].footprint);
+    }
+}
+
+bool Texture::uses_uv() const
+{
+    return true;
+}
+
 class SolidColor: public Texture
 {
 public:
@@ -21,6 +68,8 @@ public:
     SolidColor(double red, double green, double blue): SolidColor(Color{red, green, blue}) {}
 
     virtual Color value(double u, double v, const Vector3& vector) const override;
+    virtual void filtered_values(const TextureLookup* lookups, Color* values, std::size_t count) const override;
+    virtual bool uses_uv() const override;
 private:
     Color color_value;
 };
@@ -30,6 +79,16 @@ Color SolidColor::value(double u, double v, const Vector3& vector) const
     return color_value;
 }
 
+void SolidColor::filtered_values(const TextureLookup* lookups, Color* values, std::size_t count) const
+{
+    std::fill(values, values + count, color_value);
+}
+
+bool SolidColor::uses_uv() const
+{
+    return false;
+}
+
 class CheckerTexture: public Texture
 {
 public:
@@ -44,17 +103,30 @@ public:
                    even{std::make_shared<SolidColor>(color1)}, odd{std::make_shared<SolidColor>(color2)} {}
 
     virtual Color value(double u, double v, const Point3& point) const override;
+    virtual Color filtered_value(double u, double v, const Point3& point, double footprint) const override;
+    virtual bool uses_uv() const override;
 };
 
 Color CheckerTexture::value(double u, double v, const Point3& point) const 
+{
+    return filtered_value(u, v, point, 0.0);
+}
+
+Color CheckerTexture::filtered_value(double u, double v, const Point3& point, double footprint) const 
 {
     auto sines = std::sin(10 * point.x()) * std::sin(10 * point.y()) * std::sin(10 * point.z());
     if (sines < 0)
     {
-        return odd->value(u, v, point);
+        return odd->filtered_value(u, v, point, footprint);
     }
     
-    return even->value(u, v, point);
+    return even->filtered_value(u, v, point, footprint);
+}
+
+// The checker pattern itself only depends on the point
+bool CheckerTexture::uses_uv() const
+{
+    return odd->uses_uv() || even->uses_uv();
 }
 
 class NoiseTexture: public Texture
@@ -67,6 +139,8 @@ public:
     explicit NoiseTexture(double scale): frequency_scale{scale} {}
 
     virtual Color value(double u, double v, const Point3& point) const override;
+    virtual void filtered_values(const TextureLookup* lookups, Color* values, std::size_t count) const override;
+    virtual bool uses_uv() const override;
 };
 
 Color NoiseTexture::value(double u, double v, const Point3& point) const 
@@ -74,43 +148,58 @@ Color NoiseTexture::value(double u, double v, const Point3& point) const
     return Color{1, 1, 1} * 0.5 * (1 + std::sin(frequency_scale * point.z() + 10 * noise.turbulence(point)));
 }
 
+// The turbulence of the whole batch is computed with the vectorized Perlin::turbulence, a chunk at a time
+void NoiseTexture::filtered_values(const TextureLookup* lookups, Color* values, std::size_t count) const
+{
+    constexpr std::size_t chunk_size{64};
+    Point3 points[chunk_size];
+    double turbulences[chunk_size];
+
+    for (std::size_t first = 0; first < count; first += chunk_size)
+    {
+        const auto chunk = std::min(chunk_size, count - first);
+        for (std::size_t i = 0; i < chunk; ++i)
+        {
+            points[i] = lookups[first + i].point;
+        }
+
+        noise.turbulence(points, turbulences, chunk);
+
+        for (std::size_t i = 0; i < chunk; ++i)
+        {
+            values[first + i] = Color{1, 1, 1} * 0.5 * (1 + std::sin(frequency_scale * points[i].z() + 10 * turbulences[i]));
+        }
+    }
+}
+
+bool NoiseTexture::uses_uv() const
+{
+    return false;
+}
+
 class ImageTexture: public Texture
 {
 public:
-    constexpr static int bytes_per_pixel{3};
-    
     ImageTexture() {}
     ImageTexture(const std::string& filename);
 
     virtual Color value(double u, double v, const Vector3& point) const override;
+    virtual Color filtered_value(double u, double v, const Point3& point, double footprint) const override;
 private:
-    std::vector<unsigned char> image;
-    int width{0};
-    int height{0};
-    int bytes_per_scanline{0};
+    // MIP pyramid shared through the TextureCache; its tiles are paged in on demand
+    std::shared_ptr<const CachedTexture> image;
 };
 
-ImageTexture::ImageTexture(const std::string& filename)
-{
-    auto components_per_pixel = bytes_per_pixel;
-
-    auto data_ptr = stbi_load(filename.c_str(), &width, &height, &components_per_pixel, components_per_pixel);
+ImageTexture::ImageTexture(const std::string& filename): image{TextureCache::instance().acquire(filename)} {}
 
-    if (!data_ptr)
-    {
-        std::cerr << "ERROR: could not load texture image file " << filename << ".\n";
-        width = 0;
-        height = 0;
-    }
-    
-    image = std::vector<unsigned char>(data_ptr, data_ptr + width * height * bytes_per_pixel);
-    delete data_ptr;
-    bytes_per_scanline = bytes_per_pixel * width;
+Color ImageTexture::value(double u, double v, const Point3& point) const 
+{
+    return filtered_value(u, v, point, 0.0);
 }
 
-Color ImageTexture::value(double u, double v, const Point3& point) const 
+Color ImageTexture::filtered_value(double u, double v, const Point3& point, double footprint) const 
 {
-    if (image.empty()) // No texture
+    if (!image) // No texture
     {
         return Color{0, 1, 1}; // Return solid cyan for debugging
     }
@@ -119,26 +208,213 @@ Color ImageTexture::value(double u, double v, const Point3& point) const
     u = clamp(u, 0.0, 1.0);
     v = 1.0 - clamp(v, 0.0, 1.0);
 
-    auto i = static_cast<int>(u * width);
-    auto j = static_cast<int>(v * height);
+    return image->trilinear(u, v, footprint);
+}
+
+// Accuracy and cost of a BakedTexture compared with the texture it was baked from
+struct BakeReport
+{
+    double rms_error;
+    double max_error;
+    std::size_t memory_bytes;
+    double bake_milliseconds;
+};
+
+/*
+    Procedural texture sampled once into a grid, so lookups become a trilinear (volume)
+    or bilinear (UV atlas) fetch instead of a full evaluation; meant for static and
+    expensive textures such as NoiseTexture, whose turbulence costs 7 Perlin octaves.
 
-    if (i >= width)
+    - Volume bakes sample the texture at the centers of cubic cells covering a box
+      (resolution cells along the longest axis); lookups use the hit point.
+    - UV bakes sample resolution x resolution texels at surface(u, v); lookups use (u, v).
+
+    Baking low-pass filters the texture: details smaller than a cell are lost and
+    discontinuities (e.g. CheckerTexture edges) get blurred; report() measures the
+    error against the source texture.
+*/
+class BakedTexture: public Texture
+{
+public:
+    std::shared_ptr<Texture> source;
+
+    BakedTexture(std::shared_ptr<Texture> texture, const AABB& bounds, int resolution);
+    BakedTexture(std::shared_ptr<Texture> texture, std::function<Point3(double, double)> surface, int resolution);
+
+    virtual Color value(double u, double v, const Point3& point) const override;
+    virtual bool uses_uv() const override;
+
+    std::size_t memory_usage() const;
+    // Compares the bake with the source texture at samples random points of its domain
+    BakeReport report(int samples = 100000) const;
+private:
+    bool uv_domain;
+    AABB box;
+    std::function<Point3(double, double)> surface_point;
+    int size[3]{1, 1, 1};
+    double bake_time{0.0};
+    std::vector<float> texels; // RGB, x fastest
+
+    Color fetch(int x, int y, int z) const;
+    Color sample(double x, double y, double z) const;
+    void bake();
+};
+
+BakedTexture::BakedTexture(std::shared_ptr<Texture> texture, const AABB& bounds, int resolution):
+    source{texture}, uv_domain{false}, box{bounds}
+{
+    const auto extent = bounds.max() - bounds.min();
+    const auto longest = std::fmax(extent.x(), std::fmax(extent.y(), extent.z()));
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        size[axis] = std::max(1, static_cast<int>(std::ceil(resolution * extent[axis] / longest)));
+    }
+
+    bake();
+}
+
+BakedTexture::BakedTexture(std::shared_ptr<Texture> texture, std::function<Point3(double, double)> surface, int resolution):
+    source{texture}, uv_domain{true}, surface_point{surface}, size{resolution, resolution, 1}
+{
+    bake();
+}
+
+void BakedTexture::bake()
+{
+    const auto start = std::chrono::steady_clock::now();
+    texels.resize(static_cast<std::size_t>(size[0]) * size[1] * size[2] * 3);
+
+    for (int z = 0; z < size[2]; ++z)
+    {
+        for (int y = 0; y < size[1]; ++y)
+        {
+            for (int x = 0; x < size[0]; ++x)
+            {
+                Color color;
+
+                if (uv_domain)
+                {
+                    const auto u = (x + 0.5) / size[0];
+                    const auto v = (y + 0.5) / size[1];
+                    color = source->value(u, v, surface_point(u, v));
+                }
+                else
+                {
+                    const auto extent = box.max() - box.min();
+                    const Point3 point{box.min().x() + (x + 0.5) / size[0] * extent.x(),
+                                       box.min().y() + (y + 0.5) / size[1] * extent.y(),
+                                       box.min().z() + (z + 0.5) / size[2] * extent.z()};
+                    color = source->value(0, 0, point);
+                }
+
+                const auto offset = ((static_cast<std::size_t>(z) * size[1] + y) * size[0] + x) * 3;
+                for (int channel = 0; channel < 3; ++channel)
+                {
+                    texels[offset + channel] = static_cast<float>(color[channel]);
+                }
+            }
+        }
+    }
+
+    bake_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Cell lookup with clamp-to-edge addressing
+Color BakedTexture::fetch(int x, int y, int z) const
+{
+    x = std::clamp(x, 0, size[0] - 1);
+    y = std::clamp(y, 0, size[1] - 1);
+    z = std::clamp(z, 0, size[2] - 1);
+
+    const auto offset = ((static_cast<std::size_t>(z) * size[1] + y) * size[0] + x) * 3;
+    return Color{texels[offset + 0], texels[offset + 1], texels[offset + 2]};
+}
+
+// Trilinear interpolation at grid coordinates (cell centers are at half-integers)
+Color BakedTexture::sample(double x, double y, double z) const
+{
+    x -= 0.5;
+    y -= 0.5;
+    z -= 0.5;
+    const auto x0 = static_cast<int>(std::floor(x));
+    const auto y0 = static_cast<int>(std::floor(y));
+    const auto z0 = static_cast<int>(std::floor(z));
+    const auto dx = x - x0;
+    const auto dy = y - y0;
+    const auto dz = z - z0;
+
+    Color accum{0, 0, 0};
+
+    for (int k = 0; k < (size[2] > 1 ? 2 : 1); ++k)
     {
-        i = width - 1;
+        const auto weight_z = size[2] > 1 ? (k ? dz : 1 - dz) : 1.0;
+        const auto lower = (1 - dx) * fetch(x0, y0, z0 + k) + dx * fetch(x0 + 1, y0, z0 + k);
+        const auto upper = (1 - dx) * fetch(x0, y0 + 1, z0 + k) + dx * fetch(x0 + 1, y0 + 1, z0 + k);
+        accum += weight_z * ((1 - dy) * lower + dy * upper);
     }
 
-    if (j >= height)
+    return accum;
+}
+
+Color BakedTexture::value(double u, double v, const Point3& point) const
+{
+    if (uv_domain)
     {
-        j = height - 1;
+        return sample(u * size[0], v * size[1], 0.5);
     }
 
-    const auto color_space = 1.0 / 255.0;
-    const int pixel_index = j * bytes_per_scanline + i * bytes_per_pixel;
-    const auto red = image[pixel_index + 0];
-    const auto green = image[pixel_index + 1];
-    const auto blue = image[pixel_index + 2];
+    const auto extent = box.max() - box.min();
+    return sample((point.x() - box.min().x()) / extent.x() * size[0],
+                  (point.y() - box.min().y()) / extent.y() * size[1],
+                  (point.z() - box.min().z()) / extent.z() * size[2]);
+}
+
+bool BakedTexture::uses_uv() const
+{
+    return uv_domain;
+}
+
+std::size_t BakedTexture::memory_usage() const
+{
+    return texels.size() * sizeof(float);
+}
+
+/*
+    The error of a sample is the largest difference over the three channels. The points
+    come from a generator of their own: reports are made while scenes are built, and
+    drawing from the thread's generator would change the scenes built after the bake.
+*/
+BakeReport BakedTexture::report(int samples) const
+{
+    RandomGenerator generator;
+    auto random_double = [&generator]() { return generator.next() * (1.0 / 4294967296.0); };
+    auto squared_sum = 0.0;
+    auto max_error = 0.0;
+
+    for (int sample = 0; sample < samples; ++sample)
+    {
+        const auto u = random_double();
+        const auto v = random_double();
+        Point3 point;
+
+        if (uv_domain)
+        {
+            point = surface_point(u, v);
+        }
+        else
+        {
+            const auto extent = box.max() - box.min();
+            point = box.min() + Vector3{u * extent.x(), v * extent.y(), random_double() * extent.z()};
+        }
+
+        const auto difference = value(u, v, point) - source->value(u, v, point);
+        const auto error = std::fmax(std::fabs(difference.x()), std::fmax(std::fabs(difference.y()), std::fabs(difference.z())));
+        squared_sum += error * error;
+        max_error = std::fmax(max_error, error);
+    }
 
-    return Color{color_space * red, color_space * green, color_space * blue};
+    return BakeReport{std::sqrt(squared_sum / samples), max_error, memory_usage(), bake_time};
 }
 
 #endif // TEXTURE_HPP
\ No newline at end of file
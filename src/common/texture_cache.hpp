@@ -0,0 +1,557 @@
+#ifndef TEXTURE_CACHE_HPP
+#define TEXTURE_CACHE_HPP
+
+#include "mipmap.hpp"
+#include "rt_stb_image.hpp"
+#include "trace.hpp"
+#include "vector3.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+    #include <process.h>
+#else
+    #include <unistd.h>
+#endif
+
+class TextureCache;
+
+// Id of the running process, which names its temporary files
+inline long long process_id()
+{
+#ifdef _WIN32
+    return _getpid();
+#else
+    return getpid();
+#endif
+}
+
+/*
+    Image texture whose MIP pyramid lives in a tiled cache file on disk; its tiles
+    are paged in on demand by the TextureCache, which keeps them under a memory budget.
+
+    If the cache file couldn't be written, the pyramid is kept resident instead.
+*/
+class CachedTexture: public MipFiltering<CachedTexture>
+{
+public:
+    using Tile = std::vector<unsigned char>;
+
+    explicit CachedTexture(std::uint64_t texture_id): id{texture_id} {}
+
+    int levels() const;
+    const MipLevel& level(int index) const;
+    Color texel(int level, int x, int y) const;
+private:
+    friend class TextureCache;
+
+    std::uint64_t id;
+    std::vector<MipLevel> pyramid;
+    std::filesystem::path cache_filename;
+    std::size_t tiles_offset{0};
+    mutable std::ifstream cache_file;
+    mutable std::mutex file_mutex;
+    // Under file_mutex; failed reads are retried at every lookup, but only reported once
+    mutable bool read_failed{false};
+    MipMap resident;
+
+    bool open(const std::filesystem::path& filename);
+    void keep_resident(MipMap&& mipmap);
+    // Null if the tile couldn't be read from the cache file
+    std::shared_ptr<const Tile> read_tile(std::size_t index) const;
+    const unsigned char* fetch_tile(std::size_t index) const;
+};
+
+/*
+    Process-wide cache of image textures, shared by every ImageTexture and safe to use
+    from any number of render threads.
+
+    - Textures are keyed by path, and files with identical contents are deduplicated
+      (the content hash names the cache file), so every image is decoded at most once.
+    - Decoded images are converted once into a tiled cache file (see MipFiltering for the
+      layout) in the cache directory; later runs open the cache file without decoding.
+    - Tiles are read on demand and kept in memory up to the memory budget; the least
+      recently used tiles are evicted first.
+
+    File format (native endianness):
+        "RTTC", version, tile size, level count (32-bit unsigned each),
+        width and height of each level (32-bit unsigned each),
+        then every tile of every level, bytes_per_tile bytes each.
+*/
+class TextureCache
+{
+public:
+    static TextureCache& instance();
+
+    // Returns nullptr (and prints an error) if the image can't be loaded
+    std::shared_ptr<const CachedTexture> acquire(const std::string& filename);
+
+    void set_memory_budget(std::size_t bytes);
+    void set_cache_directory(const std::filesystem::path& directory);
+
+    std::size_t resident_bytes() const;
+    std::size_t tile_misses() const;
+
+    // Null if the tile couldn't be read; it isn't cached then, so the next lookup reads it again
+    std::shared_ptr<const CachedTexture::Tile> tile(const CachedTexture& texture, std::size_t index);
+private:
+    friend class CachedTexture;
+
+    static constexpr char magic[4] = {'R', 'T', 'T', 'C'};
+    static constexpr std::uint32_t version{1};
+
+    struct Entry
+    {
+        std::shared_ptr<const CachedTexture::Tile> data;
+        std::list<std::uint64_t>::iterator position;
+    };
+
+    // Protects the texture tables; never held while loading a texture
+    std::mutex textures_mutex;
+    std::unordered_map<std::string, std::shared_ptr<CachedTexture>> by_path;
+    std::unordered_map<std::uint64_t, std::shared_ptr<CachedTexture>> by_content;
+    // Paths being loaded, see acquire
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<CachedTexture>>> loading;
+    std::uint64_t next_id{1};
+    std::filesystem::path cache_directory{std::filesystem::temp_directory_path() / "rt_texture_cache"};
+
+    // Protects the resident tiles; never held during I/O
+    mutable std::mutex tiles_mutex;
+    std::unordered_map<std::uint64_t, Entry> tiles;
+    std::list<std::uint64_t> recently_used; // front is the most recently used tile
+    std::size_t budget{std::size_t{256} << 20};
+    std::size_t resident{0};
+    std::size_t misses{0};
+
+    TextureCache() {}
+
+    std::shared_ptr<CachedTexture> load(const std::string& filename, const std::filesystem::path& directory);
+    void evict();
+    static bool hash_file(const std::string& filename, std::uint64_t& hash);
+    static bool write_cache_file(const std::filesystem::path& filename, const MipMap& mipmap);
+};
+
+int CachedTexture::levels() const
+{
+    return static_cast<int>(pyramid.size());
+}
+
+const MipLevel& CachedTexture::level(int index) const
+{
+    return pyramid[index];
+}
+
+// Texel lookup with clamp-to-edge addressing
+Color CachedTexture::texel(int level, int x, int y) const
+{
+    const auto& current = pyramid[level];
+    x = std::clamp(x, 0, current.width - 1);
+    y = std::clamp(y, 0, current.height - 1);
+
+    const auto color_space = 1.0 / 255.0;
+    const auto texels = fetch_tile(tile_index(current, x, y)) + offset_in_tile(x, y);
+
+    return Color{color_space * texels[0], color_space * texels[1], color_space * texels[2]};
+}
+
+bool CachedTexture::open(const std::filesystem::path& filename)
+{
+    cache_file = std::ifstream{filename, std::ios::binary};
+    if (!cache_file.is_open())
+    {
+        return false;
+    }
+
+    char file_magic[4];
+    std::uint32_t header[3];
+    cache_file.read(file_magic, sizeof(file_magic));
+    cache_file.read(reinterpret_cast<char*>(header), sizeof(header));
+
+    if (!cache_file || std::memcmp(file_magic, TextureCache::magic, sizeof(file_magic)) != 0
+        || header[0] != TextureCache::version || header[1] != tile_size || header[2] == 0)
+    {
+        cache_file.close();
+        return false;
+    }
+
+    std::vector<std::uint32_t> sizes(2 * header[2]);
+    cache_file.read(reinterpret_cast<char*>(sizes.data()), sizes.size() * sizeof(std::uint32_t));
+    if (!cache_file)
+    {
+        cache_file.close();
+        return false;
+    }
+
+    pyramid = layout(static_cast<int>(sizes[0]), static_cast<int>(sizes[1]));
+    if (pyramid.size() != header[2])
+    {
+        cache_file.close();
+        return false;
+    }
+
+    cache_filename = filename;
+    tiles_offset = sizeof(file_magic) + sizeof(header) + sizes.size() * sizeof(std::uint32_t);
+    return true;
+}
+
+void CachedTexture::keep_resident(MipMap&& mipmap)
+{
+    resident = std::move(mipmap);
+    pyramid.clear();
+
+    for (int index = 0; index < resident.levels(); ++index)
+    {
+        pyramid.push_back(resident.level(index));
+    }
+}
+
+std::shared_ptr<const CachedTexture::Tile> CachedTexture::read_tile(std::size_t index) const
+{
+    auto tile = std::make_shared<Tile>(bytes_per_tile);
+
+    if (!resident.empty())
+    {
+        std::copy_n(resident.tile(index), bytes_per_tile, tile->begin());
+        return tile;
+    }
+
+    std::lock_guard<std::mutex> lock{file_mutex};
+    cache_file.seekg(tiles_offset + index * bytes_per_tile);
+    cache_file.read(reinterpret_cast<char*>(tile->data()), bytes_per_tile);
+
+    if (!cache_file)
+    {
+        if (!read_failed)
+        {
+            std::cerr << "ERROR: could not read tile " << index << " from texture cache file " << cache_filename << ".\n";
+            read_failed = true;
+        }
+        cache_file.clear();
+        return nullptr;
+    }
+
+    return tile;
+}
+
+/*
+    Every thread remembers the last few tiles it used, so consecutive lookups in the
+    same tiles (e.g. the four texels of a bilinear lookup) don't go through the cache lock.
+    The remembered tiles stay valid even if the cache evicts them meanwhile.
+*/
+const unsigned char* CachedTexture::fetch_tile(std::size_t index) const
+{
+    struct RecentTile
+    {
+        std::uint64_t texture_id{0};
+        std::size_t index{0};
+        std::shared_ptr<const Tile> data;
+    };
+
+    constexpr std::size_t recent_tiles = 4;
+    thread_local RecentTile recent[recent_tiles];
+
+    auto& slot = recent[index % recent_tiles];
+    if (slot.texture_id != id || slot.index != index)
+    {
+        auto data = TextureCache::instance().tile(*this, index);
+        if (!data)
+        {
+            // Black until a later lookup reads the tile
+            static const Tile unreadable(bytes_per_tile);
+            return unreadable.data();
+        }
+        slot = RecentTile{id, index, std::move(data)};
+    }
+
+    return slot.data->data();
+}
+
+TextureCache& TextureCache::instance()
+{
+    static TextureCache cache;
+    return cache;
+}
+
+/*
+    The texture tables are only locked to look textures up and add them: a texture is
+    hashed and decoded without the lock, so lookups of loaded textures never wait for a
+    cold one. A path being loaded has a future in loading, which the threads acquiring
+    the same path meanwhile wait on instead of loading it again. If loading throws, the
+    waiting threads get the exception too, and the next acquire loads the path again.
+*/
+std::shared_ptr<const CachedTexture> TextureCache::acquire(const std::string& filename)
+{
+    std::error_code error;
+    auto path_key = std::filesystem::weakly_canonical(filename, error).string();
+    if (error)
+    {
+        path_key = filename;
+    }
+
+    std::promise<std::shared_ptr<CachedTexture>> loaded;
+    std::filesystem::path directory;
+    {
+        std::unique_lock<std::mutex> lock{textures_mutex};
+        auto known_path = by_path.find(path_key);
+        if (known_path != by_path.end())
+        {
+            return known_path->second;
+        }
+
+        auto pending = loading.find(path_key);
+        if (pending != loading.end())
+        {
+            auto future = pending->second;
+            lock.unlock();
+            return future.get();
+        }
+
+        loading.emplace(path_key, loaded.get_future().share());
+        directory = cache_directory;
+    }
+
+    std::shared_ptr<CachedTexture> texture;
+    try
+    {
+        texture = load(filename, directory);
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock{textures_mutex};
+        loading.erase(path_key);
+        loaded.set_exception(std::current_exception());
+        throw;
+    }
+
+    std::lock_guard<std::mutex> lock{textures_mutex};
+    if (texture)
+    {
+        by_path[path_key] = texture;
+    }
+    loading.erase(path_key);
+    loaded.set_value(texture);
+    return texture;
+}
+
+// Texture of filename, from its cache file in directory or decoded; called without the tables locked
+std::shared_ptr<CachedTexture> TextureCache::load(const std::string& filename, const std::filesystem::path& directory)
+{
+    std::uint64_t hash;
+    if (!hash_file(filename, hash))
+    {
+        std::cerr << "ERROR: could not load texture image file " << filename << ".\n";
+        return nullptr;
+    }
+
+    std::shared_ptr<CachedTexture> texture;
+    {
+        std::lock_guard<std::mutex> lock{textures_mutex};
+        auto known_content = by_content.find(hash);
+        if (known_content != by_content.end())
+        {
+            return known_content->second;
+        }
+        texture = std::make_shared<CachedTexture>(next_id++);
+    }
+
+    char hash_name[17];
+    std::snprintf(hash_name, sizeof(hash_name), "%016llx", static_cast<unsigned long long>(hash));
+    const auto cache_filename = directory / (std::string{hash_name} + ".rttc");
+
+    if (!texture->open(cache_filename))
+    {
+        ScopedTrace trace{"texture", "decode", filename};
+        int width{0};
+        int height{0};
+        int components_per_pixel{CachedTexture::bytes_per_pixel};
+
+        auto data_ptr = stbi_load(filename.c_str(), &width, &height, &components_per_pixel, CachedTexture::bytes_per_pixel);
+        if (!data_ptr)
+        {
+            std::cerr << "ERROR: could not load texture image file " << filename << ".\n";
+            return nullptr;
+        }
+
+        MipMap mipmap{data_ptr, width, height};
+        stbi_image_free(data_ptr);
+
+        if (!write_cache_file(cache_filename, mipmap) || !texture->open(cache_filename))
+        {
+            std::cerr << "WARNING: could not write texture cache file " << cache_filename << ", keeping " << filename << " in memory.\n";
+            texture->keep_resident(std::move(mipmap));
+        }
+    }
+
+    // Another path with the same contents may have been loaded meanwhile: the first one is shared
+    std::lock_guard<std::mutex> lock{textures_mutex};
+    auto [entry, inserted] = by_content.try_emplace(hash, texture);
+    return entry->second;
+}
+
+void TextureCache::set_memory_budget(std::size_t bytes)
+{
+    std::lock_guard<std::mutex> lock{tiles_mutex};
+    budget = bytes;
+    evict();
+}
+
+void TextureCache::set_cache_directory(const std::filesystem::path& directory)
+{
+    std::lock_guard<std::mutex> lock{textures_mutex};
+    cache_directory = directory;
+}
+
+std::size_t TextureCache::resident_bytes() const
+{
+    std::lock_guard<std::mutex> lock{tiles_mutex};
+    return resident;
+}
+
+std::size_t TextureCache::tile_misses() const
+{
+    std::lock_guard<std::mutex> lock{tiles_mutex};
+    return misses;
+}
+
+std::shared_ptr<const CachedTexture::Tile> TextureCache::tile(const CachedTexture& texture, std::size_t index)
+{
+    // Texture ids and tile indices both fit in 32 bits for any realistic scene
+    const auto key = (texture.id << 32) | index;
+
+    {
+        std::lock_guard<std::mutex> lock{tiles_mutex};
+        auto found = tiles.find(key);
+        if (found != tiles.end())
+        {
+            recently_used.splice(recently_used.begin(), recently_used, found->second.position);
+            return found->second.data;
+        }
+    }
+
+    // Read without holding the lock; if another thread loaded the same tile meanwhile, its copy wins
+    auto data = texture.read_tile(index);
+    if (!data)
+    {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock{tiles_mutex};
+    auto [entry, inserted] = tiles.try_emplace(key);
+    if (!inserted)
+    {
+        recently_used.splice(recently_used.begin(), recently_used, entry->second.position);
+        return entry->second.data;
+    }
+
+    recently_used.push_front(key);
+    entry->second = Entry{data, recently_used.begin()};
+    resident += CachedTexture::bytes_per_tile;
+    ++misses;
+    evict();
+
+    return data;
+}
+
+// Must be called with tiles_mutex held; the most recently used tile is always kept
+void TextureCache::evict()
+{
+    while (resident > budget && recently_used.size() > 1)
+    {
+        tiles.erase(recently_used.back());
+        recently_used.pop_back();
+        resident -= CachedTexture::bytes_per_tile;
+    }
+}
+
+// 64-bit FNV-1a hash of the file contents
+bool TextureCache::hash_file(const std::string& filename, std::uint64_t& hash)
+{
+    std::ifstream input_file{filename, std::ios::binary};
+    if (!input_file.is_open())
+    {
+        return false;
+    }
+
+    hash = 14695981039346656037ull;
+    char buffer[1 << 16];
+
+    while (input_file)
+    {
+        input_file.read(buffer, sizeof(buffer));
+        for (std::streamsize i = 0; i < input_file.gcount(); ++i)
+        {
+            hash ^= static_cast<unsigned char>(buffer[i]);
+            hash *= 1099511628211ull;
+        }
+    }
+
+    return true;
+}
+
+/*
+    Writes to a temporary file first, so concurrent processes never see a partial cache
+    file. The temporary file is named after the process and a count of the files it
+    wrote, since processes forked from one another (see distributed.hpp) write the same
+    cache file at the same time.
+*/
+bool TextureCache::write_cache_file(const std::filesystem::path& filename, const MipMap& mipmap)
+{
+    static std::atomic<std::uint64_t> written_files{0};
+
+    std::error_code error;
+    std::filesystem::create_directories(filename.parent_path(), error);
+
+    auto temporary_filename = filename;
+    temporary_filename += ".tmp" + std::to_string(process_id()) + "_" + std::to_string(written_files++);
+
+    {
+        std::ofstream output_file{temporary_filename, std::ios::binary};
+        if (!output_file.is_open())
+        {
+            return false;
+        }
+
+        const std::uint32_t header[3] = {version, CachedTexture::tile_size, static_cast<std::uint32_t>(mipmap.levels())};
+        output_file.write(magic, sizeof(magic));
+        output_file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+        for (int index = 0; index < mipmap.levels(); ++index)
+        {
+            const std::uint32_t size[2] = {static_cast<std::uint32_t>(mipmap.level(index).width), static_cast<std::uint32_t>(mipmap.level(index).height)};
+            output_file.write(reinterpret_cast<const char*>(size), sizeof(size));
+        }
+
+        output_file.write(reinterpret_cast<const char*>(mipmap.tile(0)), mipmap.tile_count() * CachedTexture::bytes_per_tile);
+
+        if (!output_file)
+        {
+            output_file.close();
+            std::filesystem::remove(temporary_filename, error);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(temporary_filename, filename, error);
+    if (error)
+    {
+        std::error_code remove_error;
+        std::filesystem::remove(temporary_filename, remove_error);
+        return false;
+    }
+    return true;
+}
+
+#endif // TEXTURE_CACHE_HPP
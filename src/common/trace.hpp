@@ -0,0 +1,221 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+    Timeline of scoped events, written in the Chrome trace event format (JSON), which
+    chrome://tracing and ui.perfetto.dev open directly.
+
+        ScopedTrace trace{"render", "tile", tile_index};
+
+    records the lifetime of trace as a complete ("X") event on the calling thread's
+    track. Tracing is off until enable_tracing() is called; while it's off an event
+    costs one branch. While it's on, each thread appends to its own buffer, without
+    locks or atomics, so it's cheap enough to keep in production runs; the mutex is
+    only taken the first time a thread records an event.
+
+    Names and categories must be string literals (or otherwise outlive the trace);
+    detail is copied and shown as an argument of the event.
+
+    write_trace must only be called while no thread is recording events.
+*/
+struct TraceEvent
+{
+    const char* category;
+    const char* name;
+    std::int64_t id;
+    std::string detail;
+    std::uint64_t start_nanoseconds;
+    std::uint64_t duration_nanoseconds;
+};
+
+class Tracer
+{
+public:
+    static Tracer& instance();
+
+    bool enabled{false};
+    // Thread that enabled tracing, shown as "main" in the timeline
+    std::thread::id main_thread;
+
+    // Events of the calling thread, registered on first use
+    std::vector<TraceEvent>& thread_events();
+    std::uint64_t now() const;
+
+    bool write(const std::string& filename) const;
+    void clear();
+private:
+    struct ThreadBuffer
+    {
+        int thread_id;
+        std::string thread_name;
+        std::vector<TraceEvent> events;
+    };
+
+    const std::chrono::steady_clock::time_point epoch{std::chrono::steady_clock::now()};
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+    static void write_string(std::ostream& out, const std::string& value);
+};
+
+class ScopedTrace
+{
+public:
+    ScopedTrace(const char* category, const char* name, std::int64_t id = -1);
+    ScopedTrace(const char* category, const char* name, const std::string& detail);
+    ~ScopedTrace();
+
+    ScopedTrace(const ScopedTrace&) = delete;
+    ScopedTrace& operator=(const ScopedTrace&) = delete;
+private:
+    const char* category;
+    const char* name;
+    std::int64_t id;
+    std::string detail;
+    std::uint64_t start{0};
+    bool active;
+};
+
+Tracer& Tracer::instance()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+std::vector<TraceEvent>& Tracer::thread_events()
+{
+    thread_local ThreadBuffer* buffer = [this]
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        buffers.push_back(std::make_unique<ThreadBuffer>());
+        buffers.back()->thread_id = static_cast<int>(buffers.size());
+        buffers.back()->thread_name = std::this_thread::get_id() == main_thread ? "main" : "worker " + std::to_string(buffers.size());
+        buffers.back()->events.reserve(1024);
+        return buffers.back().get();
+    }();
+
+    return buffer->events;
+}
+
+std::uint64_t Tracer::now() const
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+}
+
+void Tracer::write_string(std::ostream& out, const std::string& value)
+{
+    out << '"';
+    for (auto character: value)
+    {
+        if (character == '"' || character == '\\')
+        {
+            out << '\\';
+        }
+        out << character;
+    }
+    out << '"';
+}
+
+// Timestamps are in microseconds, with nanosecond precision kept in the fraction
+bool Tracer::write(const std::string& filename) const
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    std::ofstream out{filename};
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    bool first = true;
+    for (const auto& buffer: buffers)
+    {
+        out << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << buffer->thread_id
+            << ",\"args\":{\"name\":\"" << buffer->thread_name << "\"}}";
+        first = false;
+
+        for (const auto& event: buffer->events)
+        {
+            out << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id << ",\"cat\":\"" << event.category
+                << "\",\"name\":\"" << event.name << "\",\"ts\":" << event.start_nanoseconds / 1000 << '.'
+                << std::to_string(1000 + event.start_nanoseconds % 1000).substr(1) << ",\"dur\":" << event.duration_nanoseconds / 1000
+                << '.' << std::to_string(1000 + event.duration_nanoseconds % 1000).substr(1);
+
+            if (event.id >= 0 || !event.detail.empty())
+            {
+                out << ",\"args\":{";
+                if (event.id >= 0)
+                {
+                    out << "\"id\":" << event.id << (event.detail.empty() ? "" : ",");
+                }
+                if (!event.detail.empty())
+                {
+                    out << "\"detail\":";
+                    write_string(out, event.detail);
+                }
+                out << '}';
+            }
+            out << '}';
+        }
+    }
+
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+void Tracer::clear()
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    for (auto& buffer: buffers)
+    {
+        buffer->events.clear();
+    }
+}
+
+ScopedTrace::ScopedTrace(const char* event_category, const char* event_name, std::int64_t event_id):
+    category{event_category}, name{event_name}, id{event_id}, active{Tracer::instance().enabled}
+{
+    if (active)
+    {
+        start = Tracer::instance().now();
+    }
+}
+
+ScopedTrace::ScopedTrace(const char* event_category, const char* event_name, const std::string& event_detail):
+    category{event_category}, name{event_name}, id{-1}, active{Tracer::instance().enabled}
+{
+    if (active)
+    {
+        detail = event_detail;
+        start = Tracer::instance().now();
+    }
+}
+
+ScopedTrace::~ScopedTrace()
+{
+    if (active)
+    {
+        auto& tracer = Tracer::instance();
+        const auto end = tracer.now();
+        tracer.thread_events().push_back(TraceEvent{category, name, id, std::move(detail), start, end - start});
+    }
+}
+
+// Must be called before the threads to trace are started
+inline void enable_tracing(bool enabled = true)
+{
+    Tracer::instance().main_thread = std::this_thread::get_id();
+    Tracer::instance().enabled = enabled;
+}
+
+inline bool write_trace(const std::string& filename)
+{
+    return Tracer::instance().write(filename);
+}
+
+#endif // TRACE_HPP
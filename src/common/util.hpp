@@ -2,9 +2,9 @@
 #define UTIL_HPP
 
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <memory>
-#include <random>
 
 constexpr double infinity = std::numeric_limits<double>::infinity();
 constexpr double pi = 3.1415926535897932385;
@@ -14,11 +14,59 @@ inline double degrees_to_radians(double degrees)
     return degrees * (pi / 180.0);
 }
 
+/*
+    PCG32 generator (O'Neill, "PCG: A Family of Simple Fast Space-Efficient Statistically
+    Good Algorithms for Random Number Generation"): 64-bit state, and seeding is just two
+    steps, so it can be reseeded per pixel sample. A (seed, stream) pair always gives the
+    same sequence, which makes renders reproducible regardless of how the work is split.
+*/
+class RandomGenerator
+{
+public:
+    RandomGenerator()
+    {
+        seed(0x853c49e6748fea9bull, 0xda3e39cb94b95bdbull);
+    }
+
+    void seed(std::uint64_t seed_value, std::uint64_t stream)
+    {
+        state = 0;
+        increment = (stream << 1) | 1;
+        next();
+        state += seed_value;
+        next();
+    }
+
+    std::uint32_t next()
+    {
+        auto old_state = state;
+        state = old_state * 6364136223846793005ull + increment;
+        auto xor_shifted = static_cast<std::uint32_t>(((old_state >> 18) ^ old_state) >> 27);
+        auto rotation = static_cast<std::uint32_t>(old_state >> 59);
+        return (xor_shifted >> rotation) | (xor_shifted << ((32 - rotation) & 31));
+    }
+private:
+    std::uint64_t state;
+    std::uint64_t increment;
+};
+
+// Each thread has its own generator, so rendering threads never share state
+inline RandomGenerator& random_generator()
+{
+    thread_local RandomGenerator generator;
+    return generator;
+}
+
+// Reseeds the generator of the calling thread
+inline void seed_random(std::uint64_t seed, std::uint64_t stream = 0)
+{
+    random_generator().seed(seed, stream);
+}
+
+// Returns a random double in range [0; 1[
 inline double random_double()
 {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+    return random_generator().next() * (1.0 / 4294967296.0);
 }
 
 // Returns a random double in range [min; max[
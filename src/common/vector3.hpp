@@ -1,50 +1,68 @@
 #ifndef VECTOR3_HPP
 #define VECTOR3_HPP
 
+#include "simd_vector3.hpp"
 #include "util.hpp"
 
 #include <cmath>
 #include <iostream>
 
-class Vector3
+/*
+    Scalar type of the geometry: vectors, points, colors, and through them rays, bounding
+    boxes, hit records and primitives. It's double by default and float when built with
+    RT_FLOAT (the CMake option of the same name), which halves the memory taken by BVH
+    nodes, point clouds and framebuffers. Ray parameters, times and cone widths stay double.
+    RT_SIMD_VECTOR (which implies float) stores them as SimdVector3 instead.
+*/
+#if defined(RT_FLOAT) || defined(RT_SIMD_VECTOR)
+using real = float;
+#else
+using real = double;
+#endif
+
+template <typename Scalar>
+class BasicVector3
 {
 public:
-    double coord[3];
+    using scalar = Scalar;
+
+    Scalar coord[3];
     
-    Vector3(): coord{0, 0, 0} {}
-    Vector3(double x, double y, double z): coord{x, y, z} {}
+    BasicVector3(): coord{0, 0, 0} {}
+    // Takes doubles, so the coordinates can be given in any arithmetic type without narrowing errors
+    BasicVector3(double x, double y, double z): coord{static_cast<Scalar>(x), static_cast<Scalar>(y), static_cast<Scalar>(z)} {}
 
-    double x() const
+    Scalar x() const
     {
         return coord[0];
     }
 
-    double y() const
+    Scalar y() const
     {
         return coord[1];
     }
 
-    double z() const
+    Scalar z() const
     {
         return coord[2];
     }
 
-    Vector3 operator-() const
+    BasicVector3 operator-() const
     {
-        return Vector3(-coord[0], -coord[1], -coord[2]);
+        return BasicVector3(-coord[0], -coord[1], -coord[2]);
     }
 
-    double operator[](int i) const
+    Scalar operator[](int i) const
     {
         return coord[i];
     }
 
-    double& operator[](int i)
+    Scalar& operator[](int i)
     {
         return coord[i];
     }
 
-    Vector3& operator+=(const Vector3& vector)
+    BasicVector3& operator+=(const BasicVector3& vector)
     {
         coord[0] += vector.coord[0];
         coord[1] += vector.coord[1];
@@ -52,7 +70,7 @@ public:
         return *this;
     }
 
-    Vector3& operator*=(const double scale)
+    BasicVector3& operator*=(const Scalar scale)
     {
         coord[0] *= scale;
         coord[1] *= scale;
@@ -60,18 +78,18 @@ public:
         return *this;
     }
 
-    Vector3& operator/=(const double scale)
+    BasicVector3& operator/=(const Scalar scale)
     {
         *this *= 1 / scale;
         return *this;
     }
 
-    double length() const
+    Scalar length() const
     {
         return std::sqrt(length_squared());
     }
 
-    double length_squared() const
+    Scalar length_squared() const
     {
         return coord[0] * coord[0] + coord[1] * coord[1] + coord[2] * coord[2];
     }
@@ -82,83 +100,105 @@ public:
         return std::fabs(coord[0] < epsilon) && std::fabs(coord[1] < epsilon) && std::fabs(coord[2] < epsilon);
     }
 
-    inline static Vector3 random()
+    inline static BasicVector3 random()
     {
-        return Vector3{random_double(), random_double(), random_double()};
+        return BasicVector3{random_double(), random_double(), random_double()};
     }
 
-    inline static Vector3 random(double min, double max)
+    inline static BasicVector3 random(double min, double max)
     {
-        return Vector3{random_double(min, max), random_double(min, max), random_double(min, max)};
+        return BasicVector3{random_double(min, max), random_double(min, max), random_double(min, max)};
     }
 };
 
+#ifdef RT_SIMD_VECTOR
+using Vector3 = SimdVector3;
+#else
+using Vector3 = BasicVector3<real>;
+#endif
 using Point3 = Vector3;
 using Color = Vector3;
 
-inline std::ostream& operator<<(std::ostream& output, const Vector3& vector)
+template <typename Scalar>
+inline std::ostream& operator<<(std::ostream& output, const BasicVector3<Scalar>& vector)
 {
     return output << vector.coord[0] << ' ' << vector.coord[1] << ' ' << vector.coord[2];
 }
 
-inline std::istream& operator>>(std::istream& input, Vector3& vector)
+template <typename Scalar>
+inline std::istream& operator>>(std::istream& input, BasicVector3<Scalar>& vector)
 {
     return input >> vector.coord[0] >> vector.coord[1] >> vector.coord[2];
 }
 
-inline Vector3 operator+(const Vector3& u, const Vector3& v)
+template <typename Scalar>
+inline BasicVector3<Scalar> operator+(const BasicVector3<Scalar>& u, const BasicVector3<Scalar>& v)
 {
-    return Vector3{u.coord[0] + v.coord[0], u.coord[1] + v.coord[1], u.coord[2] + v.coord[2]};
+    return BasicVector3<Scalar>{u.coord[0] + v.coord[0], u.coord[1] + v.coord[1], u.coord[2] + v.coord[2]};
 }
 
-inline Vector3 operator-(const Vector3& u, const Vector3& v)
+template <typename Scalar>
+inline BasicVector3<Scalar> operator-(const BasicVector3<Scalar>& u, const BasicVector3<Scalar>& v)
 {
-    return Vector3{u.coord[0] - v.coord[0], u.coord[1] - v.coord[1], u.coord[2] - v.coord[2]};
+    return BasicVector3<Scalar>{u.coord[0] - v.coord[0], u.coord[1] - v.coord[1], u.coord[2] - v.coord[2]};
 }
 
-inline Vector3 operator*(const Vector3& u, const Vector3& v)
+template <typename Scalar>
+inline BasicVector3<Scalar> operator*(const BasicVector3<Scalar>& u, const BasicVector3<Scalar>& v)
 {
-    return Vector3{u.coord[0] * v.coord[0], u.coord[1] * v.coord[1], u.coord[2] * v.coord[2]};
+    return BasicVector3<Scalar>{u.coord[0] * v.coord[0], u.coord[1] * v.coord[1], u.coord[2] * v.coord[2]};
 }
 
-inline Vector3 operator*(double scale, const Vector3& vec)
+/*
+    The scale takes the scalar type of the vector (the parameter isn't deduced from), so
+    a double scale doesn't turn float vector arithmetic into double.
+*/
+template <typename Scalar>
+inline BasicVector3<Scalar> operator*(typename BasicVector3<Scalar>::scalar scale, const BasicVector3<Scalar>& vec)
 {
-    return Vector3{scale * vec.coord[0], scale * vec.coord[1], scale * vec.coord[2]};
+    return BasicVector3<Scalar>{scale * vec.coord[0], scale * vec.coord[1], scale * vec.coord[2]};
 }
 
-inline Vector3 operator*(const Vector3& vec, double scale)
+template <typename Scalar>
+inline BasicVector3<Scalar> operator*(const BasicVector3<Scalar>& vec, typename BasicVector3<Scalar>::scalar scale)
 {
     return scale * vec;
 }
 
-inline Vector3 operator/(const Vector3& vec, double scale)
+template <typename Scalar>
+inline BasicVector3<Scalar> operator/(const BasicVector3<Scalar>& vec, typename BasicVector3<Scalar>::scalar scale)
 {
     return (1 / scale) * vec;
 }
 
-inline bool operator==(const Vector3& u, const Vector3& v)
+template <typename Scalar>
+inline bool operator==(const BasicVector3<Scalar>& u, const BasicVector3<Scalar>& v)
 {
     return u.coord[0] == v.coord[0] && u.coord[1] == v.coord[1] && u.coord[2] == v.coord[2];
 }
 
-inline bool operator !=(const Vector3& u, const Vector3& v)
+template <typename Scalar>
+inline bool operator !=(const BasicVector3<Scalar>& u, const BasicVector3<Scalar>& v)
 {
     return !(u == v);
 }
 
-inline double dot(const Vector3& u, const Vector3& v)
+template <typename Scalar>
+inline Scalar dot(const BasicVector3<Scalar>& u, const BasicVector3<Scalar>& v)
 {
     return u.coord[0] * v.coord[0] + u.coord[1] * v.coord[1] + u.coord[2] * v.coord[2];
 }
 
-inline Vector3 cross(const Vector3& u, const Vector3& v)
+template <typename Scalar>
+inline BasicVector3<Scalar> cross(const BasicVector3<Scalar>& u, const BasicVector3<Scalar>& v)
 {
-    return Vector3{u.coord[1] * v.coord[2] - u.coord[2] * v.coord[1],
+    return BasicVector3<Scalar>{u.coord[1] * v.coord[2] - u.coord[2] * v.coord[1],
                     u.coord[2] * v.coord[0] - u.coord[0] * v.coord[2],
                     u.coord[0] * v.coord[1] - u.coord[1] * v.coord[0]};
 }
 
-inline Vector3 unit_vector(const Vector3& vec)
+template <typename Scalar>
+inline BasicVector3<Scalar> unit_vector(const BasicVector3<Scalar>& vec)
 {
     return vec / vec.length();
 }
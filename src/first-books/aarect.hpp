@@ -3,6 +3,7 @@
 
 #include "aabb.hpp"
 #include "hittable.hpp"
+#include "material.hpp"
 #include "util.hpp"
 #include <memory>
 
@@ -22,6 +23,8 @@ public:
 
     virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const override;
     virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const override;
+    virtual void surface_interaction(const Ray& ray, HitRecord& record) const override;
+    virtual bool occluded(const Ray& ray, double min_parameter, double max_parameter) const override;
 };
 
 /*
@@ -36,6 +39,8 @@ public:
 */
 bool XYRect::hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const
 {
+    RT_STATISTIC(count_primitive_test(PrimitiveKind::XYRect));
+
     auto intersection_parameter = (z_plane_constant - ray.origin().z()) / ray.direction().z();
     if (intersection_parameter < min_parameter || intersection_parameter > max_parameter)
     {
@@ -49,14 +54,46 @@ bool XYRect::hit(const Ray& ray, double min_parameter, double max_parameter, Hit
         return false;
     }
 
-    record.u = (x - x0) / (x1 - x0);
-    record.v = (y - y0) / (y1 - y0);
     record.parameter = intersection_parameter;
+    record.object = this;
+
+    RT_STATISTIC(count_primitive_hit(PrimitiveKind::XYRect));
+    return true;
+}
+
+void XYRect::surface_interaction(const Ray& ray, HitRecord& record) const
+{
+    record.point = ray.at(record.parameter);
     auto outward_normal = Vector3{0, 0, 1};
     record.set_face_normal(ray, outward_normal);
     record.material = material;
-    record.point = ray.at(intersection_parameter);
 
+    if (material->uses_uv())
+    {
+        record.u = (record.point.x() - x0) / (x1 - x0);
+        record.v = (record.point.y() - y0) / (y1 - y0);
+        record.set_footprint(ray, std::fmin(x1 - x0, y1 - y0));
+    }
+}
+
+bool XYRect::occluded(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    RT_STATISTIC(count_primitive_test(PrimitiveKind::XYRect));
+
+    auto intersection_parameter = (z_plane_constant - ray.origin().z()) / ray.direction().z();
+    if (intersection_parameter < min_parameter || intersection_parameter > max_parameter)
+    {
+        return false;
+    }
+
+    auto x = ray.origin().x() + intersection_parameter * ray.direction().x();
+    auto y = ray.origin().y() + intersection_parameter * ray.direction().y();
+    if (x < x0 || x > x1 || y < y0 || y > y1)
+    {
+        return false;
+    }
+
+    RT_STATISTIC(count_primitive_hit(PrimitiveKind::XYRect));
     return true;
 }
 
@@ -87,10 +124,14 @@ public:
     
     virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const override;
     virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const override;
+    virtual void surface_interaction(const Ray& ray, HitRecord& record) const override;
+    virtual bool occluded(const Ray& ray, double min_parameter, double max_parameter) const override;
 };
 
 bool XZRect::hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const 
 {
+    RT_STATISTIC(count_primitive_test(PrimitiveKind::XZRect));
+
     auto intersection_parameter = (y_plane_constant - ray.origin().y()) / ray.direction().y();
     if (intersection_parameter < min_parameter || intersection_parameter > max_parameter)
     {
@@ -104,14 +145,46 @@ bool XZRect::hit(const Ray& ray, double min_parameter, double max_parameter, Hit
         return false;
     }
 
-    record.u = (x - x0) / (x1 - x0);
-    record.v = (z - z0) / (z1 - z0);
     record.parameter = intersection_parameter;
+    record.object = this;
+
+    RT_STATISTIC(count_primitive_hit(PrimitiveKind::XZRect));
+    return true;
+}
+
+void XZRect::surface_interaction(const Ray& ray, HitRecord& record) const
+{
+    record.point = ray.at(record.parameter);
     auto outward_normal = Vector3{0, 1, 0};
     record.set_face_normal(ray, outward_normal);
     record.material = material;
-    record.point = ray.at(intersection_parameter);
 
+    if (material->uses_uv())
+    {
+        record.u = (record.point.x() - x0) / (x1 - x0);
+        record.v = (record.point.z() - z0) / (z1 - z0);
+        record.set_footprint(ray, std::fmin(x1 - x0, z1 - z0));
+    }
+}
+
+bool XZRect::occluded(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    RT_STATISTIC(count_primitive_test(PrimitiveKind::XZRect));
+
+    auto intersection_parameter = (y_plane_constant - ray.origin().y()) / ray.direction().y();
+    if (intersection_parameter < min_parameter || intersection_parameter > max_parameter)
+    {
+        return false;
+    }
+
+    auto x = ray.origin().x() + intersection_parameter * ray.direction().x();
+    auto z = ray.origin().z() + intersection_parameter * ray.direction().z();
+    if (x < x0 || x > x1 || z < z0 || z > z1)
+    {
+        return false;
+    }
+
+    RT_STATISTIC(count_primitive_hit(PrimitiveKind::XZRect));
     return true;
 }
 
@@ -142,10 +215,14 @@ public:
     
     virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const override;
     virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const override;
+    virtual void surface_interaction(const Ray& ray, HitRecord& record) const override;
+    virtual bool occluded(const Ray& ray, double min_parameter, double max_parameter) const override;
 };
 
 bool YZRect::hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const
 {
+    RT_STATISTIC(count_primitive_test(PrimitiveKind::YZRect));
+
     auto intersection_parameter = (x_plane_constant - ray.origin().x()) / ray.direction().x();
     if (intersection_parameter < min_parameter || intersection_parameter > max_parameter)
     {
@@ -159,14 +236,46 @@ bool YZRect::hit(const Ray& ray, double min_parameter, double max_parameter, Hit
         return false;
     }
 
-    record.u = (y - y0) / (y1 - y0);
-    record.v = (z - z0) / (z1 - z0);
     record.parameter = intersection_parameter;
+    record.object = this;
+
+    RT_STATISTIC(count_primitive_hit(PrimitiveKind::YZRect));
+    return true;
+}
+
+void YZRect::surface_interaction(const Ray& ray, HitRecord& record) const
+{
+    record.point = ray.at(record.parameter);
     auto outward_normal = Vector3{1, 0, 0};
     record.set_face_normal(ray, outward_normal);
     record.material = material;
-    record.point = ray.at(intersection_parameter);
 
+    if (material->uses_uv())
+    {
+        record.u = (record.point.y() - y0) / (y1 - y0);
+        record.v = (record.point.z() - z0) / (z1 - z0);
+        record.set_footprint(ray, std::fmin(y1 - y0, z1 - z0));
+    }
+}
+
+bool YZRect::occluded(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    RT_STATISTIC(count_primitive_test(PrimitiveKind::YZRect));
+
+    auto intersection_parameter = (x_plane_constant - ray.origin().x()) / ray.direction().x();
+    if (intersection_parameter < min_parameter || intersection_parameter > max_parameter)
+    {
+        return false;
+    }
+
+    auto y = ray.origin().y() + intersection_parameter * ray.direction().y();
+    auto z = ray.origin().z() + intersection_parameter * ray.direction().z();
+    if (y < y0 || y > y1 || z < z0 || z > z1)
+    {
+        return false;
+    }
+
+    RT_STATISTIC(count_primitive_hit(PrimitiveKind::YZRect));
     return true;
 }
 
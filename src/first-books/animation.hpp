@@ -0,0 +1,212 @@
+#ifndef ANIMATION_HPP
+#define ANIMATION_HPP
+
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "constant_medium.hpp"
+#include "scenes.hpp"
+#include "trace.hpp"
+#include "transform.hpp"
+#include "util.hpp"
+#include "vector3.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// How a scene changes over a sequence of frames; the frame time goes from 0 to 1 (excluded) over the sequence
+struct AnimationSettings
+{
+    int frames{1};
+    // The camera orbits around look_at, about view_up, by orbit_degrees over the sequence
+    double orbit_degrees{360.0};
+    // Every rotated instance of the scene (RotateY) turns by spin_degrees over the sequence
+    double spin_degrees{0.0};
+    // The BVH is rebuilt instead of refitted once its SAH cost grows by this ratio over its cost when built
+    double rebuild_threshold{0.25};
+};
+
+/*
+    Scene posed frame after frame for rendering an animation in one process: the world,
+    its materials, textures and meshes are built once and stay resident, and every frame
+    only moves the camera and the animated instances.
+
+    The animated instances are found through the translations, media, lists and nested
+    BVHs around them. The BVH keeps its structure across frames: after the instances
+    moved, its boxes (and those of the nested BVHs holding them) are refitted bottom-up,
+    which costs a traversal of the tree instead of a build. The
+    objects drift away from where the tree grouped them, so its SAH cost is checked after
+    every refit, and the tree is rebuilt once the cost grew past the threshold.
+*/
+class AnimatedScene
+{
+public:
+    SceneSettings scene;
+    AnimationSettings animation;
+    MotionBVH world;
+
+    // Of the last pose
+    bool rebuilt{false};
+    double update_milliseconds{0.0};
+    double sah_cost{0.0};
+
+    AnimatedScene(SceneSettings scene_settings, const AnimationSettings& animation_settings);
+
+    // Moves the camera and the instances to where they are at frame, updates the BVH and returns the camera
+    Camera pose(int frame, int image_height);
+private:
+    // Animated instance and its angle at frame time 0, or nested tree holding animated instances
+    struct AnimatedNode
+    {
+        RotateY* rotation;
+        BVHNode* tree;
+        double angle;
+    };
+
+    // Outer nodes first
+    std::vector<AnimatedNode> animated;
+    Point3 start_look_from;
+    double built_cost{0.0};
+
+    // Returns whether object holds animated instances
+    bool find_rotations(Hittable* object);
+};
+
+// look_from rotated by angle degrees about the axis through look_at along view_up
+Point3 orbit(const Point3& look_from, const Point3& look_at, const Vector3& view_up, double angle);
+
+AnimatedScene::AnimatedScene(SceneSettings scene_settings, const AnimationSettings& animation_settings):
+scene{std::move(scene_settings)}, animation{animation_settings}, start_look_from{scene.look_from}
+{
+    world = MotionBVH{scene.world, scene.open_shutter_time, scene.close_shutter_time};
+    built_cost = world.sah_cost();
+
+    if (animation.spin_degrees != 0.0)
+    {
+        find_rotations(&scene.world);
+    }
+}
+
+// Instances are looked for through the wrappers, lists and trees the scenes use around them
+bool AnimatedScene::find_rotations(Hittable* object)
+{
+    if (auto rotation = dynamic_cast<RotateY*>(object))
+    {
+        animated.push_back(AnimatedNode{rotation, nullptr, rotation->angle});
+        find_rotations(rotation->instance.get());
+        return true;
+    }
+    if (auto translation = dynamic_cast<Translate*>(object))
+    {
+        return find_rotations(translation->instance.get());
+    }
+    if (auto medium = dynamic_cast<ConstantMedium*>(object))
+    {
+        return find_rotations(medium->boundary.get());
+    }
+    if (auto list = dynamic_cast<HittableList*>(object))
+    {
+        bool found = false;
+        for (const auto& child: list->objects)
+        {
+            found = find_rotations(child.get()) || found;
+        }
+        return found;
+    }
+    if (auto tree = dynamic_cast<BVHNode*>(object))
+    {
+        // Only the root of the tree is kept, its refit covers the inner nodes
+        const auto position = animated.size();
+        animated.push_back(AnimatedNode{nullptr, tree, 0.0});
+
+        bool found = false;
+        std::vector<BVHNode*> nodes{tree};
+        while (!nodes.empty())
+        {
+            const auto node = nodes.back();
+            nodes.pop_back();
+            if (!node->leaf)
+            {
+                nodes.push_back(static_cast<BVHNode*>(node->left.get()));
+                nodes.push_back(static_cast<BVHNode*>(node->right.get()));
+                continue;
+            }
+            found = find_rotations(node->left.get()) || found;
+            if (node->right != node->left)
+            {
+                found = find_rotations(node->right.get()) || found;
+            }
+        }
+
+        if (!found)
+        {
+            animated.erase(animated.begin() + static_cast<std::ptrdiff_t>(position));
+        }
+        return found;
+    }
+
+    return false;
+}
+
+Camera AnimatedScene::pose(int frame, int image_height)
+{
+    const auto time = static_cast<double>(frame) / animation.frames;
+    const auto start = std::chrono::steady_clock::now();
+
+    rebuilt = false;
+    if (!animated.empty())
+    {
+        // Inner nodes are updated first, so the boxes of the outer ones are computed from the moved inner ones
+        for (auto node = animated.rbegin(); node != animated.rend(); ++node)
+        {
+            if (node->rotation)
+            {
+                node->rotation->set_angle(node->angle + animation.spin_degrees * time);
+            }
+            else
+            {
+                node->tree->refit(scene.open_shutter_time, scene.close_shutter_time);
+            }
+        }
+
+        {
+            ScopedTrace trace{"bvh", "refit", frame};
+            world.refit();
+        }
+        sah_cost = world.sah_cost();
+
+        if (sah_cost > built_cost * (1.0 + animation.rebuild_threshold))
+        {
+            ScopedTrace trace{"bvh", "rebuild", frame};
+            world = MotionBVH{scene.world, scene.open_shutter_time, scene.close_shutter_time};
+            built_cost = sah_cost = world.sah_cost();
+            rebuilt = true;
+        }
+    }
+    else
+    {
+        sah_cost = built_cost;
+    }
+
+    update_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    scene.look_from = orbit(start_look_from, scene.look_at, scene.view_up, animation.orbit_degrees * time);
+    return scene.camera(image_height);
+}
+
+// Rodrigues' rotation formula
+Point3 orbit(const Point3& look_from, const Point3& look_at, const Vector3& view_up, double angle)
+{
+    const auto axis = unit_vector(view_up);
+    const auto offset = look_from - look_at;
+    const auto radians = degrees_to_radians(angle);
+    const auto cosine = std::cos(radians);
+    const auto sine = std::sin(radians);
+
+    return look_at + cosine * offset + sine * cross(axis, offset) + (1.0 - cosine) * dot(axis, offset) * axis;
+}
+
+#endif // ANIMATION_HPP
@@ -0,0 +1,443 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "renderer.hpp"
+#include "scenes.hpp"
+#include "trace.hpp"
+#include "util.hpp"
+#include "vector3.hpp"
+#include "wavefront.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+    Render of one view in a batch: the scene's default image and camera settings, with
+    the ones given in the job file instead.
+*/
+struct BatchJob
+{
+    Scenes scene;
+    std::string output;
+    std::optional<int> image_width;
+    std::optional<int> image_height;
+    std::optional<int> samples_per_pixel;
+    std::optional<int> max_depth;
+    std::optional<std::uint64_t> seed;
+    std::optional<Point3> look_from;
+    std::optional<Point3> look_at;
+    std::optional<double> vertical_fov;
+    std::optional<double> aperture;
+    std::optional<double> distance_to_focus;
+};
+
+/*
+    Reads a job file: one job per line, as key=value pairs separated by spaces, with
+    blank lines and lines starting with # ignored. scene (a scene name) and output (a PPM
+    filename) are required; width, height, spp, depth, seed, look_from and look_at (as
+    x,y,z), fov, aperture and focus are optional. For instance:
+
+        scene=random output=front.ppm width=400 spp=32
+        scene=random output=top.ppm width=400 spp=32 look_from=0,20,0.1 fov=40
+
+    Returns false, after reporting the line to std::cerr, on an invalid line.
+*/
+bool read_jobs(const std::string& filename, std::vector<BatchJob>& jobs);
+
+// Reads one job given as a line of a job file; returns false with the reason in error if it's invalid
+bool parse_job(const std::string& line, BatchJob& job, std::string& error);
+
+// Line of a job file that parse_job reads back as job
+std::string format_job(const BatchJob& job);
+
+// Settings of scene, with the camera and image settings of job instead
+SceneSettings job_view(const BatchJob& job, const SceneSettings& scene);
+
+// Render settings of job viewing view (see job_view), with the others (threads, tiles, seed...) from settings
+RenderSettings job_render_settings(const BatchJob& job, const SceneSettings& view, const RenderSettings& settings);
+
+/*
+    Renders every job, writing its image to its output file.
+
+    Every scene is built once, with its BVH, and shared read-only by all the jobs that
+    view it, so the objects, textures and meshes are loaded once per batch. The tiles of
+    all the jobs form a single queue, in job order, which the worker threads empty: the
+    threads that run out of tiles of a job start on the next one instead of waiting for
+    the last tiles of the job to finish, and the thread that finishes the last tile of a
+    job writes its image. Images are allocated when their first tile starts and freed
+    once written.
+
+    settings gives the threads, tile size, packet and wavefront options of every job.
+    Returns the process exit code: 0, or 1 if an image couldn't be written or a job has
+    no pixels (a width too small for the aspect ratio of its scene gives it no rows).
+*/
+int render_batch(const std::vector<BatchJob>& jobs, const RenderSettings& settings);
+
+bool read_jobs(const std::string& filename, std::vector<BatchJob>& jobs)
+{
+    std::ifstream file{filename};
+    if (!file)
+    {
+        std::cerr << "Unable to read job file " << filename << "\n";
+        return false;
+    }
+
+    std::string line;
+    for (int line_number = 1; std::getline(file, line); ++line_number)
+    {
+        std::istringstream fields{line};
+        std::string field;
+        if (!(fields >> field) || field[0] == '#')
+        {
+            continue;
+        }
+
+        BatchJob job;
+        std::string error;
+        if (!parse_job(line, job, error))
+        {
+            std::cerr << filename << ":" << line_number << ": " << error << "\n";
+            return false;
+        }
+
+        jobs.push_back(job);
+    }
+
+    return true;
+}
+
+bool parse_job(const std::string& line, BatchJob& job, std::string& error)
+{
+    const auto parse_point = [](const std::string& text, Point3& point)
+    {
+        std::istringstream stream{text};
+        char first_comma = 0;
+        char second_comma = 0;
+        double x;
+        double y;
+        double z;
+        stream >> x >> first_comma >> y >> second_comma >> z;
+        point = Point3{x, y, z};
+        return stream && first_comma == ',' && second_comma == ',' && stream.peek() == std::char_traits<char>::eof();
+    };
+
+    job = BatchJob{};
+    bool has_scene = false;
+    error.clear();
+
+    std::istringstream fields{line};
+    std::string field;
+    while (error.empty() && fields >> field)
+    {
+        const auto separator = field.find('=');
+        const auto key = field.substr(0, separator);
+        const auto value = separator == std::string::npos ? std::string{} : field.substr(separator + 1);
+        Point3 point;
+
+        try
+        {
+            if (key == "scene" && scene_from_name(value, job.scene))
+            {
+                has_scene = true;
+            }
+            else if (key == "output" && !value.empty())
+            {
+                job.output = value;
+            }
+            else if (key == "width" && std::stoi(value) > 0)
+            {
+                job.image_width = std::stoi(value);
+            }
+            else if (key == "height" && std::stoi(value) > 0)
+            {
+                job.image_height = std::stoi(value);
+            }
+            else if (key == "spp" && std::stoi(value) > 0)
+            {
+                job.samples_per_pixel = std::stoi(value);
+            }
+            else if (key == "depth" && std::stoi(value) > 0)
+            {
+                job.max_depth = std::stoi(value);
+            }
+            else if (key == "seed")
+            {
+                job.seed = std::stoull(value);
+            }
+            else if (key == "look_from" && parse_point(value, point))
+            {
+                job.look_from = point;
+            }
+            else if (key == "look_at" && parse_point(value, point))
+            {
+                job.look_at = point;
+            }
+            else if (key == "fov")
+            {
+                job.vertical_fov = std::stod(value);
+            }
+            else if (key == "aperture")
+            {
+                job.aperture = std::stod(value);
+            }
+            else if (key == "focus")
+            {
+                job.distance_to_focus = std::stod(value);
+            }
+            else
+            {
+                error = "invalid " + field;
+            }
+        }
+        catch (const std::exception&)
+        {
+            error = "invalid number in " + field;
+        }
+    }
+
+    if (error.empty() && (!has_scene || job.output.empty()))
+    {
+        error = "scene and output are required";
+    }
+    return error.empty();
+}
+
+std::string format_job(const BatchJob& job)
+{
+    std::ostringstream line;
+    line << std::setprecision(std::numeric_limits<double>::max_digits10);
+    line << "scene=" << scene_name(job.scene) << " output=" << job.output;
+
+    const auto format_point = [&line](const char* key, const Point3& point)
+    {
+        line << " " << key << "=" << point.x() << "," << point.y() << "," << point.z();
+    };
+
+    if (job.image_width)
+    {
+        line << " width=" << *job.image_width;
+    }
+    if (job.image_height)
+    {
+        line << " height=" << *job.image_height;
+    }
+    if (job.samples_per_pixel)
+    {
+        line << " spp=" << *job.samples_per_pixel;
+    }
+    if (job.max_depth)
+    {
+        line << " depth=" << *job.max_depth;
+    }
+    if (job.seed)
+    {
+        line << " seed=" << *job.seed;
+    }
+    if (job.look_from)
+    {
+        format_point("look_from", *job.look_from);
+    }
+    if (job.look_at)
+    {
+        format_point("look_at", *job.look_at);
+    }
+    if (job.vertical_fov)
+    {
+        line << " fov=" << *job.vertical_fov;
+    }
+    if (job.aperture)
+    {
+        line << " aperture=" << *job.aperture;
+    }
+    if (job.distance_to_focus)
+    {
+        line << " focus=" << *job.distance_to_focus;
+    }
+    return line.str();
+}
+
+SceneSettings job_view(const BatchJob& job, const SceneSettings& scene)
+{
+    auto view = scene;
+    view.look_from = job.look_from.value_or(view.look_from);
+    view.look_at = job.look_at.value_or(view.look_at);
+    view.vertical_fov = job.vertical_fov.value_or(view.vertical_fov);
+    view.aperture = job.aperture.value_or(view.aperture);
+    view.distance_to_focus = job.distance_to_focus.value_or(view.distance_to_focus);
+    view.image_width = job.image_width.value_or(view.image_width);
+    if (job.image_width && job.image_height)
+    {
+        view.aspect_ratio = static_cast<double>(*job.image_width) / *job.image_height;
+    }
+    return view;
+}
+
+RenderSettings job_render_settings(const BatchJob& job, const SceneSettings& view, const RenderSettings& settings)
+{
+    auto job_settings = settings;
+    job_settings.image_width = view.image_width;
+    job_settings.image_height = job.image_height.value_or(view.image_height());
+    job_settings.samples_per_pixel = job.samples_per_pixel.value_or(view.samples_per_pixel);
+    job_settings.max_depth = job.max_depth.value_or(view.max_depth);
+    job_settings.seed = job.seed.value_or(settings.seed);
+    return job_settings;
+}
+
+// World of a scene and its BVH, shared by the jobs viewing it
+struct BatchScene
+{
+    SceneSettings settings;
+    MotionBVH world;
+};
+
+// Render settings, camera and progress of a job
+struct BatchJobState
+{
+    const BatchJob* job;
+    const BatchScene* scene;
+    RenderSettings settings;
+    std::unique_ptr<Camera> camera;
+    // Tiles of the job in the batch queue: [first_tile; first_tile + tiles[
+    int first_tile{0};
+    int tiles{0};
+
+    std::once_flag allocated;
+    Framebuffer image;
+    std::chrono::steady_clock::time_point start;
+    std::atomic<int> finished_tiles{0};
+};
+
+int render_batch(const std::vector<BatchJob>& jobs, const RenderSettings& settings)
+{
+    // Every scene is built from the same random state, so its world doesn't depend on the other jobs
+    std::map<Scenes, std::unique_ptr<BatchScene>> scenes;
+    for (const auto& job: jobs)
+    {
+        auto& scene = scenes[job.scene];
+        if (!scene)
+        {
+            ScopedTrace trace{"scene", "build", scene_name(job.scene)};
+            random_generator() = RandomGenerator{};
+            scene = std::make_unique<BatchScene>();
+            scene->settings = scene_settings(job.scene);
+            scene->world = MotionBVH{scene->settings.world, scene->settings.open_shutter_time, scene->settings.close_shutter_time};
+        }
+    }
+
+    std::vector<std::unique_ptr<BatchJobState>> states;
+    int total_tiles = 0;
+    int empty_jobs = 0;
+    for (const auto& job: jobs)
+    {
+        auto state = std::make_unique<BatchJobState>();
+        state->job = &job;
+        state->scene = scenes[job.scene].get();
+
+        const auto view = job_view(job, state->scene->settings);
+        state->settings = job_render_settings(job, view, settings);
+        state->camera = std::make_unique<Camera>(view.camera(state->settings.image_height));
+
+        state->first_tile = total_tiles;
+        state->tiles = tile_count(state->settings);
+        total_tiles += state->tiles;
+        if (state->tiles == 0)
+        {
+            // It would never get a last tile, so it would never be written
+            std::cerr << "Job without pixels: " << scene_name(job.scene) << " " << state->settings.image_width << "x"
+                      << state->settings.image_height << ", " << job.output << " not written\n";
+            ++empty_jobs;
+        }
+        states.push_back(std::move(state));
+    }
+
+    auto thread_count = settings.threads != 0 ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+    thread_count = std::min<unsigned>(thread_count, std::max(total_tiles, 1));
+
+    std::atomic<int> next_tile{0};
+    std::atomic<int> finished_jobs{0};
+    std::atomic<int> failures{empty_jobs};
+    std::mutex output_mutex;
+    const auto batch_start = std::chrono::steady_clock::now();
+
+    auto worker = [&]()
+    {
+        Wavefront wavefront;
+        wavefront.reorder_rays = settings.reorder_rays;
+        std::size_t job_index = 0;
+
+        for (int tile = next_tile++; tile < total_tiles; tile = next_tile++)
+        {
+            // Tiles are taken in order, so the job of the next tile is never before the last one
+            while (tile >= states[job_index]->first_tile + states[job_index]->tiles)
+            {
+                ++job_index;
+            }
+            auto& state = *states[job_index];
+
+            std::call_once(state.allocated, [&state]
+            {
+                state.start = std::chrono::steady_clock::now();
+                state.image = Framebuffer{state.settings.image_width, state.settings.image_height};
+            });
+
+            render_tile(state.scene->world, *state.camera, state.scene->settings.background, state.settings, tile - state.first_tile,
+                        state.image, nullptr, wavefront);
+
+            if (++state.finished_tiles < state.tiles)
+            {
+                continue;
+            }
+
+            // Last tile of the job: every other tile is done, so the image is complete
+            bool written;
+            {
+                ScopedTrace trace{"output", "write_ppm", state.job->output};
+                std::ofstream file{state.job->output, std::ios::binary};
+                state.image.write_ppm(file, state.settings.samples_per_pixel);
+                written = static_cast<bool>(file);
+            }
+            state.image = Framebuffer{};
+            failures += !written;
+
+            const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - state.start).count();
+            std::lock_guard<std::mutex> lock{output_mutex};
+            std::cerr << "Job " << ++finished_jobs << "/" << states.size() - empty_jobs << ": " << scene_name(state.job->scene) << " "
+                      << state.settings.image_width << "x" << state.settings.image_height << " at " << state.settings.samples_per_pixel
+                      << " spp -> " << state.job->output << (written ? "" : " (unable to write)") << " in " << seconds << " s\n";
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned thread_index = 1; thread_index < thread_count; ++thread_index)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread: threads)
+    {
+        thread.join();
+    }
+
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batch_start).count();
+    std::cerr << states.size() - empty_jobs << " job(s) of " << scenes.size() << " scene(s) rendered in " << seconds << " s\n";
+
+    return failures > 0 ? 1 : 0;
+}
+
+#endif // BATCH_HPP
@@ -20,6 +20,7 @@ public:
 
     virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const override;
     virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const override;
+    virtual bool occluded(const Ray& ray, double min_parameter, double max_parameter) const override;
 };
 
 Box::Box(const Point3& point0, const Point3& point1, std::shared_ptr<Material> material): box_min{point0}, box_max{point1}
@@ -39,6 +40,11 @@ bool Box::hit(const Ray& ray, double min_parameter, double max_parameter, HitRec
     return sides.hit(ray, min_parameter, max_parameter, record);
 }
 
+bool Box::occluded(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    return sides.occluded(ray, min_parameter, max_parameter);
+}
+
 bool Box::bounding_box(double start_time, double end_time, AABB& output_box) const
 {
     output_box = AABB{box_min, box_max};
@@ -4,17 +4,21 @@
 #include "aabb.hpp"
 #include "hittable.hpp"
 #include "hittable_list.hpp"
+#include "trace.hpp"
 #include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <vector>
 
-inline bool box_compare(const std::shared_ptr<Hittable> first, const std::shared_ptr<Hittable> second, int axis)
+// Orders objects along axis by their boxes over [start_time; end_time], the ones the tree being built bounds them with
+inline bool box_compare(const std::shared_ptr<Hittable>& first, const std::shared_ptr<Hittable>& second, int axis, double start_time, double end_time)
 {
     AABB box_first;
     AABB box_second;
 
-    if (!first->bounding_box(0, 0, box_first) || !second->bounding_box(0, 0, box_second))
+    if (!first->bounding_box(start_time, end_time, box_first) || !second->bounding_box(start_time, end_time, box_second))
     {
         std::cerr << "No bounding box in BVHNode constructor\n";
     }
@@ -22,52 +26,75 @@ inline bool box_compare(const std::shared_ptr<Hittable> first, const std::shared
     return box_first.min().coord[axis] < box_second.min().coord[axis];
 }
 
-bool box_x_compare(const std::shared_ptr<Hittable> first, const std::shared_ptr<Hittable> second)
-{
-    return box_compare(first, second, 0);
-}
-
-bool box_y_compare(const std::shared_ptr<Hittable> first, const std::shared_ptr<Hittable> second)
-{
-    return box_compare(first, second, 1);
-}
-
-bool box_z_compare(const std::shared_ptr<Hittable> first, const std::shared_ptr<Hittable> second)
-{
-    return box_compare(first, second, 2);
-}
-
 class BVHNode: public Hittable
 {
 public:
     std::shared_ptr<Hittable> left;
     std::shared_ptr<Hittable> right;
     AABB box;
-    
+    PacketBox packet_box;
+    // Whether left and right are objects of the list rather than nodes built with the tree
+    bool leaf{false};
+
     BVHNode() {}
     BVHNode(const HittableList& list, double start_time, double end_time): BVHNode{list.objects, 0, list.objects.size(), start_time, end_time} {}
     BVHNode(const std::vector<std::shared_ptr<Hittable>>& src_objects, std::size_t start, std::size_t end, double start_time, double end_time);
 
     virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const override;
     virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const override;
+    virtual void hit_packet(const RayPacket& packet, std::uint32_t active, double min_parameter, PacketHits& hits) const override;
+    virtual bool occluded(const Ray& ray, double min_parameter, double max_parameter) const override;
+
+    /*
+        Recomputes the boxes of the tree bottom-up for objects that moved since it was
+        built, keeping its structure. Trees stored as objects are refitted too, but not
+        the ones inside other objects (instances, media): their boxes are cached by the
+        objects around them. It's much cheaper than building it again, but the tree gets
+        worse as the objects move away from where they were when it was built, which
+        sah_cost measures.
+    */
+    void refit(double start_time, double end_time);
+
+    /*
+        Surface area heuristic cost of the tree: the expected number of box and object
+        tests of a ray that hits the root, the share of those rays that hit a node being
+        the ratio of its surface area to the root's.
+    */
+    double sah_cost() const;
+private:
+    // Sum over the nodes of the tree of their surface area times their number of children
+    double child_test_area() const;
 };
 
 BVHNode::BVHNode(const std::vector<std::shared_ptr<Hittable>>& src_objects, std::size_t start, std::size_t end, double start_time, double end_time)
 {
+    // Only the root of the tree gets a trace event; the children are built with a subrange
+    std::unique_ptr<ScopedTrace> trace;
+    if (start == 0 && end == src_objects.size() && Tracer::instance().enabled)
+    {
+        trace = std::make_unique<ScopedTrace>("bvh", "BVHNode build", static_cast<std::int64_t>(end));
+    }
+
     auto objects = src_objects;
 
     int choosen_axis = random_int(0, 2);
-    auto comparator = (choosen_axis == 0) ? box_x_compare : (choosen_axis == 1) ? box_y_compare : box_z_compare;
+    // Every segment of a MotionBVH is split by where its objects are during that segment
+    auto comparator = [choosen_axis, start_time, end_time](const std::shared_ptr<Hittable>& first, const std::shared_ptr<Hittable>& second)
+    {
+        return box_compare(first, second, choosen_axis, start_time, end_time);
+    };
 
     std::size_t size = end - start;
 
     if (size == 1)
     {
+        leaf = true;
         left = objects[start];
         right = objects[start];
     }
     else if (size == 2)
     {
+        leaf = true;
         if (comparator(objects[start], objects[start + 1]))
         {
             left = objects[start];
@@ -97,10 +124,13 @@ BVHNode::BVHNode(const std::vector<std::shared_ptr<Hittable>>& src_objects, std:
     }
 
     box = surrounding_box(box_left, box_right);
+    packet_box = PacketBox{box};
 }
 
 bool BVHNode::hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const
 {
+    RT_STATISTIC(count_bvh_node());
+
     if (!box.hit(ray, min_parameter, max_parameter))
     {
         return false;
@@ -112,10 +142,290 @@ bool BVHNode::hit(const Ray& ray, double min_parameter, double max_parameter, Hi
     return hit_left || hit_right;
 }
 
+/*
+    The packet is first culled as a whole, then the node is tested against each active
+    lane; lanes that miss the node drop out of the packet for the whole subtree. Once a
+    quarter or less of the packet is left, the packet has lost its coherence and the
+    remaining lanes are traced one at a time from this node.
+*/
+void BVHNode::hit_packet(const RayPacket& packet, std::uint32_t active, double min_parameter, PacketHits& hits) const
+{
+    RT_STATISTIC(count_bvh_node());
+
+    const auto float_min_parameter = std::nextafter(static_cast<float>(min_parameter), -std::numeric_limits<float>::infinity());
+    if (packet.coherent && packet_box.culls(packet, float_min_parameter))
+    {
+        return;
+    }
+
+    active = packet_box.hit(packet, active, float_min_parameter, hits.max_parameter_bounds);
+    if (!active)
+    {
+        return;
+    }
+
+    if (RayPacket::count(active) <= std::max(1, packet.size / 4))
+    {
+        for (int lane = 0; lane < packet.size; ++lane)
+        {
+            if (active & (1u << lane))
+            {
+                hits.hit_lane(*left, packet, lane, min_parameter);
+                hits.hit_lane(*right, packet, lane, min_parameter);
+            }
+        }
+        return;
+    }
+
+    left->hit_packet(packet, active, min_parameter, hits);
+    right->hit_packet(packet, active, min_parameter, hits);
+}
+
+// Any hit will do, so the interval is never shortened and the right child is only visited if the left one is clear
+bool BVHNode::occluded(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    RT_STATISTIC(count_bvh_node());
+
+    if (!box.hit(ray, min_parameter, max_parameter))
+    {
+        return false;
+    }
+
+    return left->occluded(ray, min_parameter, max_parameter) || (right != left && right->occluded(ray, min_parameter, max_parameter));
+}
+
 bool BVHNode::bounding_box(double start_time, double end_time, AABB& output_box) const 
 {
     output_box = box;
     return true;
 }
 
+void BVHNode::refit(double start_time, double end_time)
+{
+    if (!leaf)
+    {
+        static_cast<BVHNode&>(*left).refit(start_time, end_time);
+        static_cast<BVHNode&>(*right).refit(start_time, end_time);
+    }
+    else
+    {
+        if (auto tree = dynamic_cast<BVHNode*>(left.get()))
+        {
+            tree->refit(start_time, end_time);
+        }
+        if (auto tree = dynamic_cast<BVHNode*>(right.get()); tree && right != left)
+        {
+            tree->refit(start_time, end_time);
+        }
+    }
+
+    AABB box_left;
+    AABB box_right;
+    left->bounding_box(start_time, end_time, box_left);
+    right->bounding_box(start_time, end_time, box_right);
+
+    box = surrounding_box(box_left, box_right);
+    packet_box = PacketBox{box};
+}
+
+double BVHNode::sah_cost() const
+{
+    const auto area = box.surface_area();
+    return area > 0.0 ? 1.0 + child_test_area() / area : 1.0;
+}
+
+double BVHNode::child_test_area() const
+{
+    const auto area = box.surface_area() * (right != left ? 2.0 : 1.0);
+    if (leaf)
+    {
+        return area;
+    }
+
+    return area + static_cast<const BVHNode&>(*left).child_test_area() + static_cast<const BVHNode&>(*right).child_test_area();
+}
+
+/*
+    Acceleration structure for the whole shutter interval of a scene with motion blur.
+
+    A BVHNode bounds every object by its box swept over the interval, so in a scene of
+    moving objects (random_scene with motion blur) the nodes are stretched along the
+    motion and overlap much more than in the same scene without it. Here the interval is
+    split into segment_count equal time segments with one BVHNode each, built with the
+    boxes swept over that segment alone, and a ray is traced through the tree of the
+    segment its time falls in: the boxes are nearly as tight as in a static scene, while
+    the traversal is the same as a BVHNode's, with no per-node cost for the time.
+
+    The inner nodes are duplicated in every tree, the objects are shared. A scene where
+    nothing moves gets a single tree.
+
+    Only objects whose box depends on the time benefit: moving objects, also through
+    translations, lists and media, which pass the time on. A nested BVHNode or a RotateY
+    has a single box for the whole shutter interval, so the motion of the objects inside
+    them is invisible here: it doesn't get the scene several segments (see has_motion),
+    and segments wouldn't make the boxes of those objects any tighter. Such objects are
+    to be moved out of nested trees and rotations to get tight boxes.
+*/
+class MotionBVH: public Hittable
+{
+public:
+    std::vector<BVHNode> segments;
+    double open_shutter_time{0.0};
+    double close_shutter_time{0.0};
+    AABB box;
+
+    MotionBVH() {}
+    MotionBVH(const HittableList& list, double start_time, double end_time, int segment_count = 8);
+
+    virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const override;
+    virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const override;
+    virtual void hit_packet(const RayPacket& packet, std::uint32_t active, double min_parameter, PacketHits& hits) const override;
+    virtual bool occluded(const Ray& ray, double min_parameter, double max_parameter) const override;
+
+    // Index of the segment whose tree traces rays at time
+    std::size_t segment(double time) const;
+
+    // Refits the tree of every segment (see BVHNode::refit)
+    void refit();
+    // Average SAH cost of the trees of the segments
+    double sah_cost() const;
+private:
+    // Time at which segment index starts (or the previous one ends) when the shutter is split in count segments
+    double segment_time(std::size_t index, std::size_t count) const;
+};
+
+/*
+    Whether the box of any object of list differs between start_time and end_time; the
+    motion inside nested BVHNodes and RotateYs doesn't count, their box being the same
+    at all times (see MotionBVH)
+*/
+bool has_motion(const HittableList& list, double start_time, double end_time);
+
+MotionBVH::MotionBVH(const HittableList& list, double start_time, double end_time, int segment_count):
+open_shutter_time{start_time}, close_shutter_time{end_time}
+{
+    if (start_time >= end_time || !has_motion(list, start_time, end_time))
+    {
+        segment_count = 1;
+    }
+
+    segments.reserve(segment_count);
+    for (int i = 0; i < segment_count; ++i)
+    {
+        segments.emplace_back(list, segment_time(i, segment_count), segment_time(i + 1, segment_count));
+    }
+
+    box = segments.front().box;
+    for (auto& tree: segments)
+    {
+        box = surrounding_box(box, tree.box);
+    }
+}
+
+double MotionBVH::segment_time(std::size_t index, std::size_t count) const
+{
+    return index == count ? close_shutter_time : open_shutter_time + (close_shutter_time - open_shutter_time) * index / count;
+}
+
+void MotionBVH::refit()
+{
+    for (std::size_t i = 0; i < segments.size(); ++i)
+    {
+        segments[i].refit(segment_time(i, segments.size()), segment_time(i + 1, segments.size()));
+    }
+
+    box = segments.front().box;
+    for (auto& tree: segments)
+    {
+        box = surrounding_box(box, tree.box);
+    }
+}
+
+double MotionBVH::sah_cost() const
+{
+    double cost = 0.0;
+    for (const auto& tree: segments)
+    {
+        cost += tree.sah_cost();
+    }
+
+    return cost / segments.size();
+}
+
+std::size_t MotionBVH::segment(double time) const
+{
+    if (segments.size() == 1)
+    {
+        return 0;
+    }
+
+    // Rays outside the shutter interval go to the closest segment
+    const auto index = std::floor((time - open_shutter_time) / (close_shutter_time - open_shutter_time) * segments.size());
+    return static_cast<std::size_t>(clamp(index, 0.0, static_cast<double>(segments.size() - 1)));
+}
+
+bool MotionBVH::hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const
+{
+    return segments[segment(ray.time())].hit(ray, min_parameter, max_parameter, record);
+}
+
+bool MotionBVH::occluded(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    return segments[segment(ray.time())].occluded(ray, min_parameter, max_parameter);
+}
+
+// The lanes of a packet have their own times, so each tree traces the lanes of its segment
+void MotionBVH::hit_packet(const RayPacket& packet, std::uint32_t active, double min_parameter, PacketHits& hits) const
+{
+    if (segments.size() == 1)
+    {
+        segments.front().hit_packet(packet, active, min_parameter, hits);
+        return;
+    }
+
+    while (active)
+    {
+        int first_lane = 0;
+        while (!(active & (1u << first_lane)))
+        {
+            ++first_lane;
+        }
+
+        const auto index = segment(packet.rays[first_lane].time());
+        std::uint32_t lanes = 0;
+        for (int lane = first_lane; lane < packet.size; ++lane)
+        {
+            if ((active & (1u << lane)) && segment(packet.rays[lane].time()) == index)
+            {
+                lanes |= 1u << lane;
+            }
+        }
+
+        segments[index].hit_packet(packet, lanes, min_parameter, hits);
+        active &= ~lanes;
+    }
+}
+
+bool MotionBVH::bounding_box(double start_time, double end_time, AABB& output_box) const
+{
+    output_box = box;
+    return true;
+}
+
+bool has_motion(const HittableList& list, double start_time, double end_time)
+{
+    for (const auto& object: list.objects)
+    {
+        AABB start_box;
+        AABB end_box;
+        if (object->bounding_box(start_time, start_time, start_box) && object->bounding_box(end_time, end_time, end_box)
+            && (start_box.min() != end_box.min() || start_box.max() != end_box.max()))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 #endif // BVH_HPP
\ No newline at end of file
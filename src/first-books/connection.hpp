@@ -0,0 +1,214 @@
+#ifndef CONNECTION_HPP
+#define CONNECTION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef __linux__
+    #include <arpa/inet.h>
+    #include <netdb.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <sys/socket.h>
+    #include <sys/types.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+
+/*
+    Sockets of the distributed renderer and the render daemon, which talk in text lines
+    sometimes followed by binary data. Only on Linux, like the rest of their code.
+*/
+#ifdef __linux__
+
+// Socket with the data received but not yet read
+class Connection
+{
+public:
+    int socket{-1};
+    std::string received;
+
+    explicit Connection(int socket_descriptor);
+    ~Connection();
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    // Sends all of data; false if the connection is closed
+    bool send(const std::string& data) const;
+    // Appends what's available, waiting for data if there's none; false at the end of the stream
+    bool receive();
+    // Moves the first complete line of received to line, without its end; false if there's none
+    bool take_line(std::string& line);
+};
+
+Connection::Connection(int socket_descriptor): socket{socket_descriptor}
+{
+    // Requests are small messages that shouldn't wait for more to send (Unix sockets don't wait anyway)
+    const int enable = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+}
+
+Connection::~Connection()
+{
+    close(socket);
+}
+
+bool Connection::send(const std::string& data) const
+{
+    std::size_t sent = 0;
+    while (sent < data.size())
+    {
+        // No SIGPIPE when the other side is gone, which is a failure to handle like any other
+        const auto count = ::send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (count <= 0)
+        {
+            return false;
+        }
+        sent += static_cast<std::size_t>(count);
+    }
+    return true;
+}
+
+bool Connection::receive()
+{
+    char buffer[65536];
+    const auto count = recv(socket, buffer, sizeof(buffer), 0);
+    if (count <= 0)
+    {
+        return false;
+    }
+    received.append(buffer, static_cast<std::size_t>(count));
+    return true;
+}
+
+bool Connection::take_line(std::string& line)
+{
+    const auto end = received.find('\n');
+    if (end == std::string::npos)
+    {
+        return false;
+    }
+    line = received.substr(0, end);
+    received.erase(0, end + 1);
+    return true;
+}
+
+
+// Socket listening on port of the IPv4 address (0.0.0.0 for every interface), or -1; port is then the one picked if it was 0
+int listen_on(const std::string& address, int& port)
+{
+    sockaddr_in socket_address{};
+    socket_address.sin_family = AF_INET;
+    socket_address.sin_port = htons(static_cast<std::uint16_t>(port));
+    if (inet_pton(AF_INET, address.c_str(), &socket_address.sin_addr) != 1)
+    {
+        return -1;
+    }
+
+    const auto listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        return -1;
+    }
+
+    const int enable = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    socklen_t length = sizeof(socket_address);
+    if (bind(listener, reinterpret_cast<sockaddr*>(&socket_address), length) != 0 || listen(listener, 64) != 0
+        || getsockname(listener, reinterpret_cast<sockaddr*>(&socket_address), &length) != 0)
+    {
+        close(listener);
+        return -1;
+    }
+
+    port = ntohs(socket_address.sin_port);
+    return listener;
+}
+
+// Socket connected to address (host:port), or -1
+int connect_to(const std::string& address)
+{
+    const auto separator = address.rfind(':');
+    if (separator == std::string::npos)
+    {
+        return -1;
+    }
+    const auto host = address.substr(0, separator);
+    const auto port = address.substr(separator + 1);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+    {
+        return -1;
+    }
+
+    int connection = -1;
+    for (auto candidate = addresses; candidate && connection < 0; candidate = candidate->ai_next)
+    {
+        connection = ::socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (connection >= 0 && connect(connection, candidate->ai_addr, candidate->ai_addrlen) != 0)
+        {
+            close(connection);
+            connection = -1;
+        }
+    }
+
+    freeaddrinfo(addresses);
+    return connection;
+}
+
+
+// Socket listening on the Unix domain socket at path, replacing any stale one, or -1
+int listen_on_unix(const std::string& path)
+{
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    path.copy(address.sun_path, path.size());
+
+    const auto listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        return -1;
+    }
+
+    unlink(path.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 64) != 0)
+    {
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+// Socket connected to the Unix domain socket at path, or -1
+int connect_to_unix(const std::string& path)
+{
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    path.copy(address.sun_path, path.size());
+
+    const auto connection = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection >= 0 && connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close(connection);
+        return -1;
+    }
+    return connection;
+}
+
+#endif
+
+#endif // CONNECTION_HPP
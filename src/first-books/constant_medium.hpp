@@ -23,9 +23,51 @@ public:
 
     virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const override;
     virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const override;
+    virtual bool occluded(const Ray& ray, double min_parameter, double max_parameter) const override;
+private:
+    // Samples the scattering event of hit; parameter is set to where it happens, if it does
+    bool collision(const Ray& ray, double min_parameter, double max_parameter, double& parameter) const;
 };
 
 bool ConstantMedium::hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const 
+{
+    RT_STATISTIC(count_primitive_test(PrimitiveKind::ConstantMedium));
+
+    if (!collision(ray, min_parameter, max_parameter, record.parameter))
+    {
+        return false;
+    }
+
+    record.point = ray.at(record.parameter);
+
+    record.normal = Vector3{1, 0, 0}; // arbitrary
+    record.front_face = true; // arbitrary
+    record.material = phase_function;
+    record.object = nullptr;
+
+    RT_STATISTIC(count_primitive_hit(PrimitiveKind::ConstantMedium));
+    return true;
+}
+
+/*
+    The medium is as opaque to visibility rays as to any other: they're occluded where
+    they would scatter.
+*/
+bool ConstantMedium::occluded(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    RT_STATISTIC(count_primitive_test(PrimitiveKind::ConstantMedium));
+
+    double parameter;
+    if (!collision(ray, min_parameter, max_parameter, parameter))
+    {
+        return false;
+    }
+
+    RT_STATISTIC(count_primitive_hit(PrimitiveKind::ConstantMedium));
+    return true;
+}
+
+bool ConstantMedium::collision(const Ray& ray, double min_parameter, double max_parameter, double& parameter) const
 {
     HitRecord min_hit;
     HitRecord max_hit;
@@ -63,13 +105,7 @@ bool ConstantMedium::hit(const Ray& ray, double min_parameter, double max_parame
         return false;
     }
 
-    record.parameter = min_hit.parameter + hit_distance / ray_length;
-    record.point = ray.at(record.parameter);
-
-    record.normal = Vector3{1, 0, 0}; // arbitrary
-    record.front_face = true; // arbitrary
-    record.material = phase_function;
-
+    parameter = min_hit.parameter + hit_distance / ray_length;
     return true;
 }
 
@@ -0,0 +1,693 @@
+#ifndef DAEMON_HPP
+#define DAEMON_HPP
+
+#include "batch.hpp"
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "connection.hpp"
+#include "renderer.hpp"
+#include "scenes.hpp"
+#include "trace.hpp"
+#include "util.hpp"
+#include "wavefront.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+    #include <sys/socket.h>
+    #include <unistd.h>
+#endif
+
+/*
+    Render daemon: a long-running process rendering the jobs (see BatchJob) its clients
+    send over a Unix domain socket, so a render pays neither for starting a process nor,
+    most of the time, for building its scene: the scenes of the last jobs stay built, with
+    their BVH and textures, in a least recently used cache.
+
+    The messages are text lines, and images follow their line:
+
+        client -> daemon    RENDER <priority> <job, as a line of a job file>
+        daemon -> client    QUEUED <id>
+                            PROGRESS <id> <tiles done> <tiles>   at every percent
+                            IMAGE <id> <bytes>                   then the image as a PPM file
+        client -> daemon    CANCEL <id>
+        daemon -> client    CANCELLED <id>
+                            ERROR <id> <reason>                  id 0 for an invalid request
+
+    The tiles of every queued job wait together: the render threads take their next tile
+    from the job of highest priority, then the oldest one, so a job of higher priority
+    (an interactive preview, say) starts on the next free thread instead of after the jobs
+    queued before it, which go on once it's done. A job is cancelled by its id, from any
+    client, or when the client that sent it disconnects: the tiles being rendered finish,
+    and the others are dropped. Messages to a client are queued for a thread of its own,
+    so a client that stops reading holds up that thread only, never a render thread.
+*/
+struct DaemonSettings
+{
+    // Scenes kept built between jobs
+    std::size_t cached_scenes{4};
+    // Jobs asking for more are refused, so one request can't exhaust the memory or the threads of the daemon
+    int max_image_size{16384};
+    long long max_pixels{1LL << 26};
+    int max_samples_per_pixel{1 << 16};
+    int max_depth{1000};
+};
+
+/*
+    Serves render jobs on the Unix domain socket at path until the process is stopped,
+    with the threads, tile size, seed, packet and wavefront options of settings. Returns
+    the process exit code if the socket couldn't be opened.
+*/
+int run_daemon(const std::string& path, const RenderSettings& settings, const DaemonSettings& daemon);
+
+/*
+    Sends job_line (a line of a job file) with priority to the daemon at path, reports its
+    progress and writes its image to the job's output file. Returns the process exit code:
+    0, or 1 if the job failed or was cancelled.
+*/
+int submit_job(const std::string& path, const std::string& job_line, int priority);
+
+// Cancels the job of the daemon at path with id; returns the process exit code
+int cancel_job(const std::string& path, int id);
+
+#ifdef __linux__
+
+// Scenes of the last jobs, with their BVH
+class SceneCache
+{
+public:
+    explicit SceneCache(std::size_t scene_capacity): capacity{std::max<std::size_t>(scene_capacity, 1)} {}
+
+    /*
+        The scene, from the cache or built, in which case the least recently used scene is
+        evicted if the cache is full; the jobs rendering it keep it alive until they're
+        done. The cache is only locked to look the scene up and add it: a scene is built
+        without the lock, so jobs of cached scenes don't wait for it, and the jobs asking
+        for the same scene meanwhile wait for that build instead of building it again.
+    */
+    std::shared_ptr<const BatchScene> get(Scenes scene, bool& cached);
+private:
+    using Build = std::shared_future<std::shared_ptr<const BatchScene>>;
+
+    std::mutex mutex;
+    std::size_t capacity;
+    // Most recently used first; scenes being built are added once built
+    std::list<std::pair<Scenes, std::shared_ptr<const BatchScene>>> scenes;
+    std::map<Scenes, Build> builds;
+};
+
+std::shared_ptr<const BatchScene> SceneCache::get(Scenes scene, bool& cached)
+{
+    std::promise<std::shared_ptr<const BatchScene>> built_scene;
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        const auto entry = std::find_if(scenes.begin(), scenes.end(), [scene](const auto& entry) { return entry.first == scene; });
+        cached = entry != scenes.end();
+        if (cached)
+        {
+            scenes.splice(scenes.begin(), scenes, entry);
+            return scenes.front().second;
+        }
+
+        const auto build = builds.find(scene);
+        if (build != builds.end())
+        {
+            auto pending = build->second;
+            lock.unlock();
+            return pending.get();
+        }
+        builds.emplace(scene, built_scene.get_future().share());
+    }
+
+    // Every scene is built from the same random state, so its world doesn't depend on the jobs before
+    auto built = std::make_shared<BatchScene>();
+    {
+        ScopedTrace trace{"scene", "build", scene_name(scene)};
+        random_generator() = RandomGenerator{};
+        built->settings = scene_settings(scene);
+        built->world = MotionBVH{built->settings.world, built->settings.open_shutter_time, built->settings.close_shutter_time};
+    }
+
+    std::lock_guard<std::mutex> lock{mutex};
+    scenes.emplace_front(scene, built);
+    if (scenes.size() > capacity)
+    {
+        scenes.pop_back();
+    }
+    builds.erase(scene);
+    built_scene.set_value(built);
+    return built;
+}
+
+// Connection to a client, shared by the jobs it sent
+class DaemonClient
+{
+public:
+    Connection connection;
+
+    explicit DaemonClient(int socket): connection{socket} {}
+
+    // Queues message for write_messages; messages of different jobs are sent whole, one after the other
+    void send(const std::string& message);
+    // Sends the queued messages, until close() or the client stops the connection
+    void write_messages();
+    // write_messages stops once the queued messages are sent
+    void close();
+private:
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::deque<std::string> outgoing;
+    bool closed{false};
+};
+
+void DaemonClient::send(const std::string& message)
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (closed)
+        {
+            return;
+        }
+        outgoing.push_back(message);
+    }
+    queued.notify_one();
+}
+
+void DaemonClient::write_messages()
+{
+    for (;;)
+    {
+        std::string message;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            queued.wait(lock, [this]() { return !outgoing.empty() || closed; });
+            if (outgoing.empty())
+            {
+                return;
+            }
+            message = std::move(outgoing.front());
+            outgoing.pop_front();
+        }
+
+        if (!connection.send(message))
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            closed = true;
+            outgoing.clear();
+            return;
+        }
+    }
+}
+
+void DaemonClient::close()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        closed = true;
+    }
+    queued.notify_one();
+}
+
+struct DaemonJob
+{
+    int id{0};
+    int priority{0};
+    BatchJob job;
+    std::shared_ptr<const BatchScene> scene;
+    std::shared_ptr<DaemonClient> client;
+    RenderSettings settings;
+    std::unique_ptr<Camera> camera;
+    Color background;
+    int tiles{0};
+
+    // Under the daemon's mutex
+    int next_tile{0};
+    int finished_tiles{0};
+    int reported_percent{-1};
+    bool cancelled{false};
+
+    // Allocated when the first tile starts
+    Framebuffer image;
+    std::chrono::steady_clock::time_point start;
+};
+
+class RenderDaemon
+{
+public:
+    RenderDaemon(const RenderSettings& render_settings, const DaemonSettings& daemon_settings);
+
+    // Accepts clients on listener and renders their jobs, forever
+    void serve(int listener);
+private:
+    RenderSettings settings;
+    DaemonSettings limits;
+    SceneCache cache;
+
+    std::mutex mutex;
+    std::condition_variable jobs_changed;
+    // Jobs with tiles left to render: highest priority first, then oldest first
+    std::vector<std::shared_ptr<DaemonJob>> jobs;
+    int next_id{1};
+
+    void serve_client(std::shared_ptr<DaemonClient> client);
+    void queue(const std::shared_ptr<DaemonClient>& client, int priority, const std::string& job_line);
+    void render_tiles();
+    // The job with id, removed from the queue, or null if it's done or unknown
+    std::shared_ptr<DaemonJob> cancel(int id);
+    void cancel_jobs_of(const DaemonClient* client);
+};
+
+RenderDaemon::RenderDaemon(const RenderSettings& render_settings, const DaemonSettings& daemon_settings):
+settings{render_settings}, limits{daemon_settings}, cache{daemon_settings.cached_scenes}
+{
+}
+
+void RenderDaemon::serve(int listener)
+{
+    const auto thread_count = settings.threads != 0 ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned thread_index = 0; thread_index < thread_count; ++thread_index)
+    {
+        std::thread{&RenderDaemon::render_tiles, this}.detach();
+    }
+
+    for (;;)
+    {
+        const auto socket = accept(listener, nullptr, nullptr);
+        if (socket >= 0)
+        {
+            const auto client = std::make_shared<DaemonClient>(socket);
+            std::thread{&DaemonClient::write_messages, client}.detach();
+            std::thread{&RenderDaemon::serve_client, this, client}.detach();
+        }
+    }
+}
+
+void RenderDaemon::serve_client(std::shared_ptr<DaemonClient> client)
+{
+    std::string line;
+    for (;;)
+    {
+        while (!client->connection.take_line(line))
+        {
+            if (!client->connection.receive())
+            {
+                cancel_jobs_of(client.get());
+                client->close();
+                return;
+            }
+        }
+
+        std::istringstream request{line};
+        std::string type;
+        request >> type;
+
+        if (type == "RENDER")
+        {
+            int priority = 0;
+            std::string job_line;
+            if (!(request >> priority) || !std::getline(request >> std::ws, job_line))
+            {
+                client->send("ERROR 0 invalid request " + line + "\n");
+                continue;
+            }
+            queue(client, priority, job_line);
+        }
+        else if (type == "CANCEL")
+        {
+            int id = 0;
+            request >> id;
+            if (const auto job = cancel(id))
+            {
+                job->client->send("CANCELLED " + std::to_string(id) + "\n");
+                if (job->client != client)
+                {
+                    client->send("CANCELLED " + std::to_string(id) + "\n");
+                }
+            }
+            else
+            {
+                client->send("ERROR " + std::to_string(id) + " no such job in the queue\n");
+            }
+        }
+        else
+        {
+            client->send("ERROR 0 invalid request " + line + "\n");
+        }
+    }
+}
+
+void RenderDaemon::queue(const std::shared_ptr<DaemonClient>& client, int priority, const std::string& job_line)
+{
+    auto job = std::make_shared<DaemonJob>();
+    std::string error;
+    if (!parse_job(job_line, job->job, error))
+    {
+        client->send("ERROR 0 " + error + "\n");
+        return;
+    }
+
+    const auto build_start = std::chrono::steady_clock::now();
+    bool cached;
+    job->scene = cache.get(job->job.scene, cached);
+    const auto build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count();
+    if (job->scene->settings.world.objects.empty())
+    {
+        client->send("ERROR 0 empty scene " + std::string{scene_name(job->job.scene)} + "\n");
+        return;
+    }
+
+    const auto view = job_view(job->job, job->scene->settings);
+    job->priority = priority;
+    job->client = client;
+    job->settings = job_render_settings(job->job, view, settings);
+    if (job->settings.image_width > limits.max_image_size || job->settings.image_height > limits.max_image_size
+        || static_cast<long long>(job->settings.image_width) * job->settings.image_height > limits.max_pixels
+        || job->settings.samples_per_pixel > limits.max_samples_per_pixel || job->settings.max_depth > limits.max_depth)
+    {
+        client->send("ERROR 0 job too large: at most " + std::to_string(limits.max_image_size) + " pixels across, "
+                     + std::to_string(limits.max_pixels) + " pixels, " + std::to_string(limits.max_samples_per_pixel) + " spp and depth "
+                     + std::to_string(limits.max_depth) + "\n");
+        return;
+    }
+    job->tiles = tile_count(job->settings);
+    if (job->settings.image_width < 1 || job->settings.image_height < 1 || job->tiles == 0)
+    {
+        // A job without tiles would never be rendered, nor leave the queue
+        client->send("ERROR 0 job without pixels: " + std::to_string(job->settings.image_width) + "x"
+                     + std::to_string(job->settings.image_height) + "\n");
+        return;
+    }
+    job->camera = std::make_unique<Camera>(view.camera(job->settings.image_height));
+    job->background = view.background;
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        job->id = next_id++;
+    }
+
+    // Queued only once the client knows its id, so the progress of the job comes after
+    client->send("QUEUED " + std::to_string(job->id) + "\n");
+    std::cerr << "Job " << job->id << ": " << scene_name(job->job.scene) << " " << job->settings.image_width << "x"
+              << job->settings.image_height << " at " << job->settings.samples_per_pixel << " spp, priority " << priority << ", scene "
+              << (cached ? "cached" : "built in " + std::to_string(build_seconds) + " s") << "\n";
+
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        const auto position = std::find_if(jobs.begin(), jobs.end(), [priority](const auto& queued) { return queued->priority < priority; });
+        jobs.insert(position, job);
+    }
+    jobs_changed.notify_all();
+}
+
+void RenderDaemon::render_tiles()
+{
+    Wavefront wavefront;
+    wavefront.reorder_rays = settings.reorder_rays;
+
+    for (;;)
+    {
+        std::shared_ptr<DaemonJob> job;
+        int tile;
+        bool out_of_memory = false;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            const auto has_tiles = [](const auto& queued) { return queued->next_tile < queued->tiles; };
+            jobs_changed.wait(lock, [&]() { return std::any_of(jobs.begin(), jobs.end(), has_tiles); });
+
+            job = *std::find_if(jobs.begin(), jobs.end(), has_tiles);
+            tile = job->next_tile++;
+            if (tile == 0)
+            {
+                job->start = std::chrono::steady_clock::now();
+                try
+                {
+                    job->image = Framebuffer{job->settings.image_width, job->settings.image_height};
+                }
+                catch (const std::bad_alloc&)
+                {
+                    // Within the limits but more than the memory left: the job fails, not the daemon
+                    out_of_memory = true;
+                    job->cancelled = true;
+                    jobs.erase(std::find(jobs.begin(), jobs.end(), job));
+                }
+            }
+        }
+
+        if (out_of_memory)
+        {
+            std::cerr << "Job " << job->id << " failed, not enough memory for its image\n";
+            job->client->send("ERROR " + std::to_string(job->id) + " not enough memory for the image\n");
+            continue;
+        }
+
+        render_tile(job->scene->world, *job->camera, job->background, job->settings, tile, job->image, nullptr, wavefront);
+
+        std::string progress;
+        bool finished = false;
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            ++job->finished_tiles;
+            if (job->cancelled)
+            {
+                continue;
+            }
+
+            const auto percent = 100 * job->finished_tiles / job->tiles;
+            if (percent != job->reported_percent)
+            {
+                job->reported_percent = percent;
+                progress = "PROGRESS " + std::to_string(job->id) + " " + std::to_string(job->finished_tiles) + " "
+                    + std::to_string(job->tiles) + "\n";
+            }
+
+            // Every other tile is done, so the image is complete
+            finished = job->finished_tiles == job->tiles;
+            if (finished)
+            {
+                jobs.erase(std::find(jobs.begin(), jobs.end(), job));
+            }
+        }
+
+        if (!progress.empty())
+        {
+            job->client->send(progress);
+        }
+        if (!finished)
+        {
+            continue;
+        }
+
+        std::ostringstream image;
+        {
+            ScopedTrace trace{"output", "write_ppm", job->id};
+            job->image.write_ppm(image, job->settings.samples_per_pixel);
+        }
+        job->image = Framebuffer{};
+        const auto data = image.str();
+        job->client->send("IMAGE " + std::to_string(job->id) + " " + std::to_string(data.size()) + "\n" + data);
+
+        const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job->start).count();
+        std::cerr << "Job " << job->id << " rendered in " << seconds << " s\n";
+    }
+}
+
+std::shared_ptr<DaemonJob> RenderDaemon::cancel(int id)
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    const auto job = std::find_if(jobs.begin(), jobs.end(), [id](const auto& queued) { return queued->id == id; });
+    if (job == jobs.end())
+    {
+        return nullptr;
+    }
+
+    auto cancelled = *job;
+    cancelled->cancelled = true;
+    jobs.erase(job);
+    std::cerr << "Job " << id << " cancelled after " << cancelled->finished_tiles << "/" << cancelled->tiles << " tiles\n";
+    return cancelled;
+}
+
+void RenderDaemon::cancel_jobs_of(const DaemonClient* client)
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    for (auto job = jobs.begin(); job != jobs.end();)
+    {
+        if ((*job)->client.get() != client)
+        {
+            ++job;
+            continue;
+        }
+
+        (*job)->cancelled = true;
+        std::cerr << "Job " << (*job)->id << " cancelled, its client disconnected\n";
+        job = jobs.erase(job);
+    }
+}
+
+int run_daemon(const std::string& path, const RenderSettings& settings, const DaemonSettings& daemon)
+{
+    const auto listener = listen_on_unix(path);
+    if (listener < 0)
+    {
+        std::cerr << "Unable to listen on " << path << "\n";
+        return 1;
+    }
+    std::cerr << "Daemon listening on " << path << "\n";
+
+    RenderDaemon render_daemon{settings, daemon};
+    render_daemon.serve(listener);
+    return 0;
+}
+
+int submit_job(const std::string& path, const std::string& job_line, int priority)
+{
+    BatchJob job;
+    std::string error;
+    if (!parse_job(job_line, job, error))
+    {
+        std::cerr << "Invalid job: " << error << "\n";
+        return 1;
+    }
+
+    const auto socket = connect_to_unix(path);
+    if (socket < 0)
+    {
+        std::cerr << "Unable to connect to the daemon at " << path << "\n";
+        return 1;
+    }
+    Connection connection{socket};
+    if (!connection.send("RENDER " + std::to_string(priority) + " " + job_line + "\n"))
+    {
+        std::cerr << "Unable to send the job to the daemon\n";
+        return 1;
+    }
+
+    std::string line;
+    for (;;)
+    {
+        if (!connection.take_line(line))
+        {
+            if (!connection.receive())
+            {
+                std::cerr << "\nThe daemon disconnected\n";
+                return 1;
+            }
+            continue;
+        }
+
+        std::istringstream message{line};
+        std::string type;
+        int id = 0;
+        message >> type >> id;
+
+        if (type == "QUEUED")
+        {
+            std::cerr << "Job " << id << " queued\n";
+        }
+        else if (type == "PROGRESS")
+        {
+            int finished_tiles;
+            int tiles;
+            message >> finished_tiles >> tiles;
+            std::cerr << "\rJob " << id << ": " << finished_tiles << "/" << tiles << " tiles " << std::flush;
+        }
+        else if (type == "IMAGE")
+        {
+            std::size_t size = 0;
+            message >> size;
+            while (connection.received.size() < size)
+            {
+                if (!connection.receive())
+                {
+                    std::cerr << "\nThe daemon disconnected\n";
+                    return 1;
+                }
+            }
+
+            std::ofstream file{job.output, std::ios::binary};
+            file.write(connection.received.data(), static_cast<std::streamsize>(size));
+            if (!file)
+            {
+                std::cerr << "\nUnable to write " << job.output << "\n";
+                return 1;
+            }
+            std::cerr << "\nJob " << id << " -> " << job.output << "\n";
+            return 0;
+        }
+        else if (type == "CANCELLED")
+        {
+            std::cerr << "\nJob " << id << " cancelled\n";
+            return 1;
+        }
+        else
+        {
+            std::cerr << "\n" << line << "\n";
+            return 1;
+        }
+    }
+}
+
+int cancel_job(const std::string& path, int id)
+{
+    const auto socket = connect_to_unix(path);
+    if (socket < 0)
+    {
+        std::cerr << "Unable to connect to the daemon at " << path << "\n";
+        return 1;
+    }
+    Connection connection{socket};
+    connection.send("CANCEL " + std::to_string(id) + "\n");
+
+    std::string line;
+    while (!connection.take_line(line))
+    {
+        if (!connection.receive())
+        {
+            std::cerr << "The daemon disconnected\n";
+            return 1;
+        }
+    }
+
+    std::cerr << line << "\n";
+    return line.rfind("CANCELLED", 0) == 0 ? 0 : 1;
+}
+
+#else
+
+int run_daemon(const std::string&, const RenderSettings&, const DaemonSettings&)
+{
+    std::cerr << "The render daemon is only supported on Linux\n";
+    return 1;
+}
+
+int submit_job(const std::string&, const std::string&, int)
+{
+    std::cerr << "The render daemon is only supported on Linux\n";
+    return 1;
+}
+
+int cancel_job(const std::string&, int)
+{
+    std::cerr << "The render daemon is only supported on Linux\n";
+    return 1;
+}
+
+#endif
+
+#endif // DAEMON_HPP
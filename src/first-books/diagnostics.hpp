@@ -0,0 +1,215 @@
+#ifndef DIAGNOSTICS_HPP
+#define DIAGNOSTICS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define RT_HAS_RDTSC
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #else
+        #include <x86intrin.h>
+    #endif
+#endif
+
+/*
+    Cycle counter for per-pixel timings: the time stamp counter on x86, the virtual
+    counter on ARM64, and nanoseconds from steady_clock elsewhere. Only differences
+    between two reads on the same thread are meaningful.
+*/
+inline std::uint64_t read_cycle_counter()
+{
+#if defined(RT_HAS_RDTSC)
+    return __rdtsc();
+#elif defined(__aarch64__) && defined(__GNUC__)
+    std::uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+/*
+    Per-pixel cost of a render, kept alongside the color output: cycles spent on the
+    pixel, BVH nodes visited by its rays and average path length of its samples.
+
+    BVH node visits come from the render counters, so they're only recorded in builds
+    with RT_STATISTICS; otherwise that channel stays zero and isn't written.
+
+    Like Framebuffer, row 0 is the bottom of the image.
+*/
+class DiagnosticBuffer
+{
+public:
+    enum class Channel { Cycles, BVHNodes, PathLength };
+
+    int width{0};
+    int height{0};
+    std::vector<float> cycles;
+    std::vector<float> bvh_nodes;
+    std::vector<float> path_length;
+
+    DiagnosticBuffer() {}
+    DiagnosticBuffer(int image_width, int image_height);
+
+    void record(int row, int column, std::uint64_t pixel_cycles, std::uint64_t pixel_bvh_nodes, double average_path_length);
+    const std::vector<float>& channel(Channel which) const;
+
+    /*
+        Writes every recorded channel as <prefix>_<channel>.pfm (raw floats) and
+        <prefix>_<channel>.ppm (false colour). Returns false if a file couldn't be written.
+    */
+    bool write(const std::string& prefix) const;
+
+    static const char* channel_name(Channel which);
+    // Whether this build records the channel
+    static bool recorded(Channel which);
+    // Grayscale PFM: little-endian floats, bottom row first
+    static bool write_pfm(const std::string& filename, int width, int height, const std::vector<float>& values);
+    // Binary PPM, from black (cheap) through blue, red and yellow to white (expensive)
+    static bool write_heatmap(const std::string& filename, int width, int height, const std::vector<float>& values);
+private:
+    static void heat_color(double value, unsigned char color[3]);
+};
+
+DiagnosticBuffer::DiagnosticBuffer(int image_width, int image_height):
+    width{image_width}, height{image_height},
+    cycles(static_cast<std::size_t>(image_width) * image_height),
+    bvh_nodes(static_cast<std::size_t>(image_width) * image_height),
+    path_length(static_cast<std::size_t>(image_width) * image_height)
+{}
+
+void DiagnosticBuffer::record(int row, int column, std::uint64_t pixel_cycles, std::uint64_t pixel_bvh_nodes, double average_path_length)
+{
+    const auto index = static_cast<std::size_t>(row) * width + column;
+    cycles[index] = static_cast<float>(pixel_cycles);
+    bvh_nodes[index] = static_cast<float>(pixel_bvh_nodes);
+    path_length[index] = static_cast<float>(average_path_length);
+}
+
+const std::vector<float>& DiagnosticBuffer::channel(Channel which) const
+{
+    switch (which)
+    {
+    case Channel::Cycles: return cycles;
+    case Channel::BVHNodes: return bvh_nodes;
+    default: return path_length;
+    }
+}
+
+const char* DiagnosticBuffer::channel_name(Channel which)
+{
+    switch (which)
+    {
+    case Channel::Cycles: return "cycles";
+    case Channel::BVHNodes: return "bvh_nodes";
+    default: return "path_length";
+    }
+}
+
+bool DiagnosticBuffer::recorded(Channel which)
+{
+#ifdef RT_STATISTICS
+    return true;
+#else
+    return which != Channel::BVHNodes;
+#endif
+}
+
+bool DiagnosticBuffer::write(const std::string& prefix) const
+{
+    bool written = true;
+
+    for (auto which: {Channel::Cycles, Channel::BVHNodes, Channel::PathLength})
+    {
+        if (!recorded(which))
+        {
+            continue;
+        }
+
+        const auto base = prefix + "_" + channel_name(which);
+        written = write_pfm(base + ".pfm", width, height, channel(which)) && written;
+        written = write_heatmap(base + ".ppm", width, height, channel(which)) && written;
+    }
+
+    return written;
+}
+
+bool DiagnosticBuffer::write_pfm(const std::string& filename, int width, int height, const std::vector<float>& values)
+{
+    std::ofstream file{filename, std::ios::binary};
+    // A negative scale means little-endian
+    file << "Pf\n" << width << " " << height << "\n-1.0\n";
+
+    for (auto value: values)
+    {
+        unsigned char bytes[4];
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        for (int i = 0; i < 4; ++i)
+        {
+            bytes[i] = static_cast<unsigned char>(bits >> (8 * i));
+        }
+        file.write(reinterpret_cast<const char*>(bytes), 4);
+    }
+
+    return static_cast<bool>(file);
+}
+
+/*
+    Values are normalized by the 99th percentile rather than the maximum, so a few
+    outlier pixels (e.g. a preempted thread) don't turn the rest of the map black.
+*/
+bool DiagnosticBuffer::write_heatmap(const std::string& filename, int width, int height, const std::vector<float>& values)
+{
+    if (values.empty())
+    {
+        return false;
+    }
+
+    auto sorted = values;
+    const auto percentile = sorted.begin() + static_cast<std::ptrdiff_t>(0.99 * (sorted.size() - 1));
+    std::nth_element(sorted.begin(), percentile, sorted.end());
+    const auto scale = *percentile > 0.0f ? 1.0 / *percentile : 0.0;
+
+    std::ofstream file{filename, std::ios::binary};
+    file << "P6\n" << width << " " << height << "\n255\n";
+
+    for (int row = height - 1; row >= 0; --row)
+    {
+        for (int column = 0; column < width; ++column)
+        {
+            unsigned char color[3];
+            heat_color(values[static_cast<std::size_t>(row) * width + column] * scale, color);
+            file.write(reinterpret_cast<const char*>(color), 3);
+        }
+    }
+
+    return static_cast<bool>(file);
+}
+
+// Piecewise linear ramp over black, blue, red, yellow and white for value in [0; 1]
+void DiagnosticBuffer::heat_color(double value, unsigned char color[3])
+{
+    static const double ramp[5][3] = {{0, 0, 0}, {0, 0, 1}, {1, 0, 0}, {1, 1, 0}, {1, 1, 1}};
+
+    const auto position = std::clamp(value, 0.0, 1.0) * 4;
+    const auto segment = std::min(static_cast<int>(position), 3);
+    const auto fraction = position - segment;
+
+    for (int channel = 0; channel < 3; ++channel)
+    {
+        const auto component = (1 - fraction) * ramp[segment][channel] + fraction * ramp[segment + 1][channel];
+        color[channel] = static_cast<unsigned char>(255.0 * component + 0.5);
+    }
+}
+
+#endif // DIAGNOSTICS_HPP
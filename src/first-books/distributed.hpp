@@ -0,0 +1,652 @@
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+
+#include "batch.hpp"
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "connection.hpp"
+#include "renderer.hpp"
+#include "scenes.hpp"
+#include "trace.hpp"
+#include "util.hpp"
+#include "wavefront.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+
+/*
+    Distributed rendering of one job (see BatchJob): a coordinator process hands the tiles
+    of the image to worker processes over TCP, and copies the pixel sums they send back
+    into its framebuffer. Workers are started by the coordinator on the same machine, or
+    by hand anywhere that can reach its port, and can join at any time. The coordinator
+    only listens on the loopback interface unless given another address: rendering on
+    other machines is opted into, since anyone reaching the port can join.
+
+    The messages are text lines, and tile results are followed by their pixels:
+
+        coordinator -> worker   JOB <seed> <tile size> <job, as a line of a job file>
+        worker -> coordinator   READY <threads>        once its scene and BVH are built
+        coordinator -> worker   TILES <tile>...        any number of times
+        worker -> coordinator   TILE <tile> <pixels>   then the sum of the samples of every
+                                                       pixel, from the top row down and left
+                                                       to right, as 3 little-endian doubles
+        coordinator -> worker   DONE
+
+    Every worker is kept two tiles per thread ahead, so its threads never wait for the
+    next tiles. Every sample is seeded from the seed and its pixel (see seed_pixel_sample),
+    so a tile has the same pixels whichever worker renders it: the image is the same as
+    rendered in one process. This is also what makes failures simple to handle: the tiles
+    of a worker that disconnects, or sends nothing for longer than the timeout, are handed
+    to the other workers, and the coordinator renders the remaining tiles itself when no
+    worker is left for a while. A connection that never gets ready (a worker stuck in its
+    scene build, another program) is dropped after the same timeout, and doesn't count as
+    a worker meanwhile.
+*/
+struct DistributedSettings
+{
+    // IPv4 address the coordinator listens on; 0.0.0.0 for every interface
+    std::string bind_address{"127.0.0.1"};
+    // TCP port the coordinator listens on; 0 picks a free one
+    int port{0};
+    // Worker processes the coordinator starts on this machine
+    int local_workers{0};
+    // Render threads of every local worker; 0 shares the hardware threads among them
+    unsigned worker_threads{0};
+    // A worker with tiles to render, or not ready yet, that sends nothing for this long is dropped
+    double timeout_seconds{60.0};
+    // With no ready worker for this long, the coordinator renders the remaining tiles
+    double idle_seconds{10.0};
+};
+
+/*
+    Renders job as the coordinator, writing its image to its output file. settings gives
+    the seed and tile size of the job (sent to the workers) and the threads, packet and
+    wavefront options of the tiles the coordinator renders itself. Returns the process
+    exit code: 0, or 1 if the port couldn't be opened or the image couldn't be written.
+*/
+int run_coordinator(const BatchJob& job, const RenderSettings& settings, const DistributedSettings& distributed);
+
+/*
+    Renders the tiles the coordinator at address (host:port) hands out until it's done,
+    with the threads, packet and wavefront options of settings. Returns the process exit
+    code: 0, or 1 if the coordinator couldn't be reached or sent an invalid job.
+*/
+int run_worker(const std::string& address, const RenderSettings& settings);
+
+#ifdef __linux__
+
+// Appends the TILE message of tile, rendered in window
+void append_tile(std::string& message, int tile, const Framebuffer& window)
+{
+    message += "TILE " + std::to_string(tile) + " " + std::to_string(window.pixels.size()) + "\n";
+
+    for (int row = window.first_row + window.height - 1; row >= window.first_row; --row)
+    {
+        for (int column = window.first_column; column < window.first_column + window.width; ++column)
+        {
+            for (int channel = 0; channel < 3; ++channel)
+            {
+                const double value = window.at(row, column)[channel];
+                std::uint64_t bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                for (int byte = 0; byte < 8; ++byte)
+                {
+                    message.push_back(static_cast<char>(bits >> (8 * byte)));
+                }
+            }
+        }
+    }
+}
+
+// Copies the pixels of a TILE message, read from data, to the tile at top, left of image
+void read_tile(const char* data, int top, int left, int bottom, int right, Framebuffer& image)
+{
+    for (int row = top; row >= bottom; --row)
+    {
+        for (int column = left; column < right; ++column)
+        {
+            for (int channel = 0; channel < 3; ++channel)
+            {
+                std::uint64_t bits = 0;
+                for (int byte = 0; byte < 8; ++byte)
+                {
+                    bits |= static_cast<std::uint64_t>(static_cast<unsigned char>(*data++)) << (8 * byte);
+                }
+                double value;
+                std::memcpy(&value, &bits, sizeof(value));
+                image.at(row, column)[channel] = value;
+            }
+        }
+    }
+}
+
+// Worker as seen by the coordinator
+struct RemoteWorker
+{
+    int number{0};
+    std::unique_ptr<Connection> connection;
+    // 0 until the worker is ready
+    unsigned threads{0};
+    // Handed out and not received yet
+    std::vector<int> tiles;
+    std::chrono::steady_clock::time_point last_heard{};
+};
+
+int run_coordinator(const BatchJob& job, const RenderSettings& settings, const DistributedSettings& distributed)
+{
+    auto port = distributed.port;
+    const auto listener = listen_on(distributed.bind_address, port);
+    if (listener < 0)
+    {
+        std::cerr << "Unable to listen on " << distributed.bind_address << " port " << distributed.port << "\n";
+        return 1;
+    }
+    std::cerr << "Coordinator listening on " << distributed.bind_address << " port " << port << "\n";
+
+    // The local workers are started before the scene is built, so they don't inherit it
+    RenderSettings worker_settings = settings;
+    worker_settings.threads = distributed.worker_threads != 0
+        ? distributed.worker_threads
+        : std::max(1u, std::thread::hardware_concurrency() / static_cast<unsigned>(std::max(distributed.local_workers, 1)));
+    const auto local_address = (distributed.bind_address == "0.0.0.0" ? std::string{"127.0.0.1"} : distributed.bind_address) + ":"
+        + std::to_string(port);
+    std::vector<pid_t> children;
+    std::cout.flush();
+    std::cerr.flush();
+    for (int worker = 0; worker < distributed.local_workers; ++worker)
+    {
+        const auto child = fork();
+        if (child == 0)
+        {
+            close(listener);
+            _exit(run_worker(local_address, worker_settings));
+        }
+        if (child > 0)
+        {
+            children.push_back(child);
+        }
+    }
+
+    SceneSettings scene;
+    {
+        ScopedTrace trace{"scene", "build", scene_name(job.scene)};
+        random_generator() = RandomGenerator{};
+        scene = scene_settings(job.scene);
+    }
+    const auto view = job_view(job, scene);
+    const auto job_settings = job_render_settings(job, view, settings);
+    const auto camera = view.camera(job_settings.image_height);
+    const auto tiles = tile_count(job_settings);
+    if (tiles == 0)
+    {
+        std::cerr << scene_name(job.scene) << " " << job_settings.image_width << "x" << job_settings.image_height << " has no pixels\n";
+        close(listener);
+        for (auto child: children)
+        {
+            waitpid(child, nullptr, 0);
+        }
+        return 1;
+    }
+
+    const auto job_message = "JOB " + std::to_string(job_settings.seed) + " " + std::to_string(job_settings.tile_size) + " "
+        + format_job(job) + "\n";
+
+    const auto start = std::chrono::steady_clock::now();
+    Framebuffer image{job_settings.image_width, job_settings.image_height};
+    std::vector<char> finished(tiles, 0);
+    int remaining = tiles;
+    std::deque<int> pending;
+    for (int tile = 0; tile < tiles; ++tile)
+    {
+        pending.push_back(tile);
+    }
+
+    std::vector<RemoteWorker> workers;
+    int connected_workers = 0;
+    auto last_worker_seen = std::chrono::steady_clock::now();
+    int shown_remaining = -1;
+    std::size_t shown_workers = 0;
+
+    const auto drop = [&](std::size_t index, const char* reason)
+    {
+        auto& worker = workers[index];
+        int requeued = 0;
+        for (auto tile = worker.tiles.rbegin(); tile != worker.tiles.rend(); ++tile)
+        {
+            if (!finished[*tile])
+            {
+                pending.push_front(*tile);
+                ++requeued;
+            }
+        }
+        std::cerr << "\nWorker " << worker.number << " " << reason << ", handing its " << requeued << " tile(s) out again\n";
+        workers.erase(workers.begin() + static_cast<std::ptrdiff_t>(index));
+    };
+
+    // Takes the complete messages received from worker; false if one is invalid
+    const auto read_messages = [&](RemoteWorker& worker)
+    {
+        auto& connection = *worker.connection;
+        for (;;)
+        {
+            const auto end = connection.received.find('\n');
+            if (end == std::string::npos)
+            {
+                return true;
+            }
+
+            std::istringstream header{connection.received.substr(0, end)};
+            std::string type;
+            header >> type;
+            if (type == "READY")
+            {
+                header >> worker.threads;
+                worker.threads = std::max(worker.threads, 1u);
+                connection.received.erase(0, end + 1);
+                std::cerr << "\nWorker " << worker.number << " ready with " << worker.threads << " thread(s)\n";
+                continue;
+            }
+
+            int tile = -1;
+            std::size_t pixels = 0;
+            header >> tile >> pixels;
+            const auto assigned = std::find(worker.tiles.begin(), worker.tiles.end(), tile);
+            if (type != "TILE" || !header || assigned == worker.tiles.end())
+            {
+                return false;
+            }
+
+            int top;
+            int left;
+            int bottom;
+            int right;
+            tile_bounds(job_settings, tile, top, left, bottom, right);
+            if (pixels != static_cast<std::size_t>(top - bottom + 1) * (right - left))
+            {
+                return false;
+            }
+
+            const auto size = end + 1 + pixels * 3 * 8;
+            if (connection.received.size() < size)
+            {
+                return true;
+            }
+
+            if (!finished[tile])
+            {
+                read_tile(connection.received.data() + end + 1, top, left, bottom, right, image);
+                finished[tile] = 1;
+                --remaining;
+            }
+            worker.tiles.erase(assigned);
+            connection.received.erase(0, size);
+        }
+    };
+
+    while (remaining > 0)
+    {
+        std::vector<pollfd> descriptors{pollfd{listener, POLLIN, 0}};
+        for (const auto& worker: workers)
+        {
+            descriptors.push_back(pollfd{worker.connection->socket, POLLIN, 0});
+        }
+        poll(descriptors.data(), descriptors.size(), 100);
+        const auto now = std::chrono::steady_clock::now();
+
+        // Messages of the workers first, since descriptors follows their order
+        for (auto index = workers.size(); index-- > 0;)
+        {
+            auto& worker = workers[index];
+            if (descriptors[index + 1].revents == 0)
+            {
+                continue;
+            }
+            worker.last_heard = now;
+            if (!worker.connection->receive())
+            {
+                drop(index, "disconnected");
+            }
+            else if (!read_messages(worker))
+            {
+                drop(index, "sent an invalid message");
+            }
+        }
+
+        if (descriptors[0].revents & POLLIN)
+        {
+            const auto socket = accept(listener, nullptr, nullptr);
+            if (socket >= 0)
+            {
+                RemoteWorker worker;
+                worker.number = ++connected_workers;
+                worker.connection = std::make_unique<Connection>(socket);
+                worker.last_heard = now;
+                if (worker.connection->send(job_message))
+                {
+                    workers.push_back(std::move(worker));
+                }
+            }
+        }
+
+        for (auto index = workers.size(); index-- > 0;)
+        {
+            const auto silence = std::chrono::duration<double>(now - workers[index].last_heard).count();
+            const auto waited_for = workers[index].threads == 0 || !workers[index].tiles.empty();
+            if (waited_for && silence > distributed.timeout_seconds)
+            {
+                drop(index, workers[index].threads == 0 ? "never got ready" : "timed out");
+            }
+        }
+
+        // Every ready worker is kept two tiles per thread ahead
+        for (auto index = workers.size(); index-- > 0;)
+        {
+            auto& worker = workers[index];
+            if (worker.threads == 0 || worker.tiles.size() > worker.threads || pending.empty())
+            {
+                continue;
+            }
+
+            if (worker.tiles.empty())
+            {
+                worker.last_heard = now;
+            }
+            std::string request = "TILES";
+            while (worker.tiles.size() < 2 * worker.threads && !pending.empty())
+            {
+                const auto tile = pending.front();
+                pending.pop_front();
+                if (!finished[tile])
+                {
+                    worker.tiles.push_back(tile);
+                    request += " " + std::to_string(tile);
+                }
+            }
+
+            if (!worker.connection->send(request + "\n"))
+            {
+                drop(index, "disconnected");
+            }
+        }
+
+        if (std::any_of(workers.begin(), workers.end(), [](const auto& worker) { return worker.threads != 0; }))
+        {
+            last_worker_seen = now;
+        }
+        else if (std::chrono::duration<double>(now - last_worker_seen).count() > distributed.idle_seconds)
+        {
+            break;
+        }
+
+        if (settings.show_progress && (remaining != shown_remaining || workers.size() != shown_workers))
+        {
+            shown_remaining = remaining;
+            shown_workers = workers.size();
+            std::cerr << "\rTiles remaining: " << remaining << ", workers: " << workers.size() << ' ' << std::flush;
+        }
+    }
+    if (settings.show_progress)
+    {
+        std::cerr << "\n";
+    }
+
+    if (remaining > 0)
+    {
+        std::cerr << "\nNo worker left, rendering the " << remaining << " remaining tile(s) here\n";
+
+        MotionBVH world;
+        {
+            ScopedTrace trace{"bvh", "build"};
+            world = MotionBVH{scene.world, scene.open_shutter_time, scene.close_shutter_time};
+        }
+
+        std::vector<int> left_over;
+        for (int tile = 0; tile < tiles; ++tile)
+        {
+            if (!finished[tile])
+            {
+                left_over.push_back(tile);
+            }
+        }
+
+        std::atomic<std::size_t> next_tile{0};
+        auto render_left_over = [&]()
+        {
+            Wavefront wavefront;
+            wavefront.reorder_rays = settings.reorder_rays;
+            for (auto index = next_tile++; index < left_over.size(); index = next_tile++)
+            {
+                render_tile(world, camera, view.background, job_settings, left_over[index], image, nullptr, wavefront);
+            }
+        };
+
+        auto thread_count = settings.threads != 0 ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> threads;
+        for (unsigned thread_index = 1; thread_index < thread_count; ++thread_index)
+        {
+            threads.emplace_back(render_left_over);
+        }
+        render_left_over();
+        for (auto& thread: threads)
+        {
+            thread.join();
+        }
+    }
+
+    for (const auto& worker: workers)
+    {
+        worker.connection->send("DONE\n");
+    }
+    workers.clear();
+    close(listener);
+    for (auto child: children)
+    {
+        waitpid(child, nullptr, 0);
+    }
+
+    bool written;
+    {
+        ScopedTrace trace{"output", "write_ppm", job.output};
+        std::ofstream file{job.output, std::ios::binary};
+        image.write_ppm(file, job_settings.samples_per_pixel);
+        written = static_cast<bool>(file);
+    }
+
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << scene_name(job.scene) << " " << job_settings.image_width << "x" << job_settings.image_height << " at "
+              << job_settings.samples_per_pixel << " spp -> " << job.output << (written ? "" : " (unable to write)") << " in "
+              << seconds << " s with " << connected_workers << " worker(s)\n";
+    return written ? 0 : 1;
+}
+
+int run_worker(const std::string& address, const RenderSettings& settings)
+{
+    const auto socket = connect_to(address);
+    if (socket < 0)
+    {
+        std::cerr << "Worker " << getpid() << ": unable to connect to " << address << "\n";
+        return 1;
+    }
+    Connection connection{socket};
+
+    std::string line;
+    while (!connection.take_line(line))
+    {
+        if (!connection.receive())
+        {
+            std::cerr << "Worker " << getpid() << ": disconnected before receiving a job\n";
+            return 1;
+        }
+    }
+
+    std::istringstream header{line};
+    std::string type;
+    std::uint64_t seed = 0;
+    int tile_size = 0;
+    header >> type >> seed >> tile_size;
+    std::string job_line;
+    std::getline(header >> std::ws, job_line);
+
+    BatchJob job;
+    std::string error;
+    if (type != "JOB" || !header || tile_size <= 0 || !parse_job(job_line, job, error))
+    {
+        std::cerr << "Worker " << getpid() << ": invalid job " << line << "\n";
+        return 1;
+    }
+
+    // The same world as the coordinator's and every other worker's, whatever this process did before
+    BatchScene scene;
+    {
+        ScopedTrace trace{"scene", "build", scene_name(job.scene)};
+        random_generator() = RandomGenerator{};
+        scene.settings = scene_settings(job.scene);
+        scene.world = MotionBVH{scene.settings.world, scene.settings.open_shutter_time, scene.settings.close_shutter_time};
+    }
+
+    auto base_settings = settings;
+    base_settings.seed = seed;
+    base_settings.tile_size = tile_size;
+    const auto view = job_view(job, scene.settings);
+    const auto job_settings = job_render_settings(job, view, base_settings);
+    const auto camera = view.camera(job_settings.image_height);
+    const auto tiles = tile_count(job_settings);
+
+    const auto thread_count = settings.threads != 0 ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+    if (!connection.send("READY " + std::to_string(thread_count) + "\n"))
+    {
+        return 1;
+    }
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_changed;
+    std::deque<int> queue;
+    bool stopped = false;
+    std::mutex send_mutex;
+
+    auto render_tiles = [&]()
+    {
+        Wavefront wavefront;
+        wavefront.reorder_rays = settings.reorder_rays;
+        std::string message;
+
+        for (;;)
+        {
+            int tile;
+            {
+                std::unique_lock<std::mutex> lock{queue_mutex};
+                queue_changed.wait(lock, [&]() { return stopped || !queue.empty(); });
+                if (stopped)
+                {
+                    return;
+                }
+                tile = queue.front();
+                queue.pop_front();
+            }
+
+            int top;
+            int left;
+            int bottom;
+            int right;
+            tile_bounds(job_settings, tile, top, left, bottom, right);
+            Framebuffer window{right - left, top - bottom + 1, bottom, left};
+            render_tile(scene.world, camera, view.background, job_settings, tile, window, nullptr, wavefront);
+
+            message.clear();
+            append_tile(message, tile, window);
+            std::lock_guard<std::mutex> lock{send_mutex};
+            connection.send(message);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned thread_index = 0; thread_index < thread_count; ++thread_index)
+    {
+        threads.emplace_back(render_tiles);
+    }
+
+    // Requests are read until the coordinator is done, or gone
+    int rendered = 0;
+    for (;;)
+    {
+        if (!connection.take_line(line))
+        {
+            if (!connection.receive())
+            {
+                break;
+            }
+            continue;
+        }
+
+        std::istringstream request{line};
+        request >> type;
+        if (type != "TILES")
+        {
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock{queue_mutex};
+        for (int tile; request >> tile;)
+        {
+            if (tile >= 0 && tile < tiles)
+            {
+                queue.push_back(tile);
+                ++rendered;
+            }
+        }
+        queue_changed.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{queue_mutex};
+        stopped = true;
+    }
+    queue_changed.notify_all();
+    for (auto& thread: threads)
+    {
+        thread.join();
+    }
+
+    std::cerr << "Worker " << getpid() << ": " << rendered << " tile(s) rendered\n";
+    return 0;
+}
+
+#else
+
+int run_coordinator(const BatchJob&, const RenderSettings&, const DistributedSettings&)
+{
+    std::cerr << "Distributed rendering is only supported on Linux\n";
+    return 1;
+}
+
+int run_worker(const std::string&, const RenderSettings&)
+{
+    std::cerr << "Distributed rendering is only supported on Linux\n";
+    return 1;
+}
+
+#endif
+
+#endif // DISTRIBUTED_HPP
@@ -0,0 +1,505 @@
+#ifndef GRID_MEDIUM_HPP
+#define GRID_MEDIUM_HPP
+
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "material.hpp"
+#include "ray.hpp"
+#include "texture.hpp"
+#include "trace.hpp"
+#include "util.hpp"
+#include "vector3.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+    Voxel grid of densities, stored either densely (one float per voxel, x-fastest)
+    or sparsely as bricks of brick_size^3 voxels where bricks that are entirely
+    empty are not allocated.
+
+    Voxels are piecewise constant, i.e. the density at a point is the density of the
+    voxel containing it; this keeps the majorant of a region exact (maximum over its voxels).
+*/
+class DensityGrid
+{
+public:
+    static constexpr int brick_size{8};
+
+    DensityGrid() {}
+    DensityGrid(int size_x, int size_y, int size_z, const std::vector<float>& densities, bool sparse = false);
+
+    /*
+        Loads a raw volume file: size_x * size_y * size_z little-endian 32-bit floats,
+        with x varying fastest, then y, then z. There's no header, so the dimensions
+        must be known by the caller.
+
+        On failure an empty grid is returned and an error is printed.
+    */
+    static DensityGrid load_raw(const std::string& filename, int size_x, int size_y, int size_z, bool sparse = false);
+
+    float density(int x, int y, int z) const;
+    float max_density(int begin_x, int begin_y, int begin_z, int end_x, int end_y, int end_z) const;
+    bool empty() const;
+    int size(int axis) const;
+    std::size_t memory_usage() const;
+private:
+    int dimensions[3]{0, 0, 0};
+    int bricks[3]{0, 0, 0};
+    bool is_sparse{false};
+    std::vector<float> dense_data;
+    // Sparse storage: brick_index maps a brick to its offset in brick_data, or -1 if empty
+    std::vector<int> brick_index;
+    std::vector<float> brick_data;
+};
+
+DensityGrid::DensityGrid(int size_x, int size_y, int size_z, const std::vector<float>& densities, bool sparse):
+    dimensions{size_x, size_y, size_z}, is_sparse{sparse}
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        bricks[axis] = (dimensions[axis] + brick_size - 1) / brick_size;
+    }
+
+    if (!is_sparse)
+    {
+        dense_data = densities;
+        return;
+    }
+
+    constexpr int brick_voxels = brick_size * brick_size * brick_size;
+    brick_index.assign(static_cast<std::size_t>(bricks[0]) * bricks[1] * bricks[2], -1);
+
+    for (int brick_z = 0; brick_z < bricks[2]; ++brick_z)
+    {
+        for (int brick_y = 0; brick_y < bricks[1]; ++brick_y)
+        {
+            for (int brick_x = 0; brick_x < bricks[0]; ++brick_x)
+            {
+                float brick[brick_voxels] = {};
+                bool occupied = false;
+
+                for (int k = 0; k < brick_size; ++k)
+                {
+                    for (int j = 0; j < brick_size; ++j)
+                    {
+                        for (int i = 0; i < brick_size; ++i)
+                        {
+                            int x = brick_x * brick_size + i;
+                            int y = brick_y * brick_size + j;
+                            int z = brick_z * brick_size + k;
+
+                            if (x >= size_x || y >= size_y || z >= size_z)
+                            {
+                                continue;
+                            }
+
+                            auto value = densities[(static_cast<std::size_t>(z) * size_y + y) * size_x + x];
+                            brick[(k * brick_size + j) * brick_size + i] = value;
+                            occupied = occupied || value > 0.0f;
+                        }
+                    }
+                }
+
+                if (occupied)
+                {
+                    brick_index[(brick_z * bricks[1] + brick_y) * bricks[0] + brick_x] = static_cast<int>(brick_data.size());
+                    brick_data.insert(brick_data.end(), brick, brick + brick_voxels);
+                }
+            }
+        }
+    }
+}
+
+DensityGrid DensityGrid::load_raw(const std::string& filename, int size_x, int size_y, int size_z, bool sparse)
+{
+    ScopedTrace trace{"scene", "load volume", filename};
+    std::ifstream input_file{filename, std::ios::binary};
+    const auto voxel_count = static_cast<std::size_t>(size_x) * size_y * size_z;
+    std::vector<float> densities(voxel_count);
+
+    if (!input_file.is_open())
+    {
+        std::cerr << "ERROR: could not open volume file " << filename << ".\n";
+        return DensityGrid{};
+    }
+
+    input_file.read(reinterpret_cast<char*>(densities.data()), voxel_count * sizeof(float));
+    if (static_cast<std::size_t>(input_file.gcount()) != voxel_count * sizeof(float))
+    {
+        std::cerr << "ERROR: volume file " << filename << " is smaller than " << size_x << "x" << size_y << "x" << size_z << ".\n";
+        return DensityGrid{};
+    }
+
+    return DensityGrid{size_x, size_y, size_z, densities, sparse};
+}
+
+float DensityGrid::density(int x, int y, int z) const
+{
+    if (x < 0 || y < 0 || z < 0 || x >= dimensions[0] || y >= dimensions[1] || z >= dimensions[2])
+    {
+        return 0.0f;
+    }
+
+    if (!is_sparse)
+    {
+        return dense_data[(static_cast<std::size_t>(z) * dimensions[1] + y) * dimensions[0] + x];
+    }
+
+    auto brick = brick_index[((z / brick_size) * bricks[1] + y / brick_size) * bricks[0] + x / brick_size];
+    if (brick < 0)
+    {
+        return 0.0f;
+    }
+
+    return brick_data[brick + ((z % brick_size) * brick_size + y % brick_size) * brick_size + x % brick_size];
+}
+
+// Maximum density over the voxels in [begin; end[ on each axis
+float DensityGrid::max_density(int begin_x, int begin_y, int begin_z, int end_x, int end_y, int end_z) const
+{
+    auto maximum = 0.0f;
+
+    for (int z = begin_z; z < end_z; ++z)
+    {
+        for (int y = begin_y; y < end_y; ++y)
+        {
+            for (int x = begin_x; x < end_x; ++x)
+            {
+                maximum = std::max(maximum, density(x, y, z));
+            }
+        }
+    }
+
+    return maximum;
+}
+
+bool DensityGrid::empty() const
+{
+    return dimensions[0] == 0 || dimensions[1] == 0 || dimensions[2] == 0;
+}
+
+int DensityGrid::size(int axis) const
+{
+    return dimensions[axis];
+}
+
+std::size_t DensityGrid::memory_usage() const
+{
+    return (dense_data.size() + brick_data.size()) * sizeof(float) + brick_index.size() * sizeof(int);
+}
+
+/*
+    Heterogeneous participating medium whose density is given by a DensityGrid
+    mapped onto an axis-aligned box.
+
+    Free-flight distances are sampled with delta tracking (Woodcock tracking) against
+    a coarse majorant grid: each majorant cell covers majorant_cell_size^3 voxels and
+    stores their maximum density. The cells along the ray are visited with a 3D-DDA,
+    so empty cells are skipped without sampling and the tentative collisions inside a
+    cell use a tight local majorant instead of the global maximum.
+*/
+class GridMedium: public Hittable
+{
+public:
+    static constexpr int majorant_cell_size{DensityGrid::brick_size};
+
+    std::shared_ptr<DensityGrid> grid;
+    AABB bounds;
+    double density_scale;
+    std::shared_ptr<Material> phase_function;
+
+    GridMedium(std::shared_ptr<DensityGrid> density_grid, const AABB& box, double scale, std::shared_ptr<Texture> texture);
+    GridMedium(std::shared_ptr<DensityGrid> density_grid, const AABB& box, double scale, Color color);
+
+    virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const override;
+    virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const override;
+
+    // Estimates the transmittance along the ray between both parameters using ratio tracking
+    double transmittance(const Ray& ray, double min_parameter, double max_parameter) const;
+private:
+    int majorant_cells[3]{0, 0, 0};
+    std::vector<float> majorants;
+    Vector3 voxel_size;
+
+    void build_majorants();
+    bool clip(const Ray& ray, double& min_parameter, double& max_parameter) const;
+    double density(const Point3& point) const;
+    double majorant(int cell_x, int cell_y, int cell_z) const;
+
+    /*
+        Walks the majorant cells crossed by the ray in [min_parameter; max_parameter]
+        and calls visit(cell_begin, cell_end, majorant) for each one in order.
+        The walk stops early when visit returns true, in which case traverse also
+        returns true.
+    */
+    template <typename Visitor>
+    bool traverse(const Ray& ray, double min_parameter, double max_parameter, Visitor&& visit) const;
+};
+
+GridMedium::GridMedium(std::shared_ptr<DensityGrid> density_grid, const AABB& box, double scale, std::shared_ptr<Texture> texture):
+    grid{density_grid}, bounds{box}, density_scale{scale}, phase_function{std::make_shared<Isotropic>(texture)}
+{
+    build_majorants();
+}
+
+GridMedium::GridMedium(std::shared_ptr<DensityGrid> density_grid, const AABB& box, double scale, Color color):
+    grid{density_grid}, bounds{box}, density_scale{scale}, phase_function{std::make_shared<Isotropic>(color)}
+{
+    build_majorants();
+}
+
+void GridMedium::build_majorants()
+{
+    if (grid->empty())
+    {
+        return;
+    }
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        majorant_cells[axis] = (grid->size(axis) + majorant_cell_size - 1) / majorant_cell_size;
+        voxel_size[axis] = (bounds.max()[axis] - bounds.min()[axis]) / grid->size(axis);
+    }
+
+    majorants.resize(static_cast<std::size_t>(majorant_cells[0]) * majorant_cells[1] * majorant_cells[2]);
+
+    for (int z = 0; z < majorant_cells[2]; ++z)
+    {
+        for (int y = 0; y < majorant_cells[1]; ++y)
+        {
+            for (int x = 0; x < majorant_cells[0]; ++x)
+            {
+                majorants[(z * majorant_cells[1] + y) * majorant_cells[0] + x] = grid->max_density(
+                    x * majorant_cell_size, y * majorant_cell_size, z * majorant_cell_size,
+                    (x + 1) * majorant_cell_size, (y + 1) * majorant_cell_size, (z + 1) * majorant_cell_size);
+            }
+        }
+    }
+}
+
+// Restricts [min_parameter; max_parameter] to the part of the ray inside the bounds
+bool GridMedium::clip(const Ray& ray, double& min_parameter, double& max_parameter) const
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        auto inverse_direction = 1.0 / ray.direction()[axis];
+        auto near_parameter = (bounds.min()[axis] - ray.origin()[axis]) * inverse_direction;
+        auto far_parameter = (bounds.max()[axis] - ray.origin()[axis]) * inverse_direction;
+
+        if (inverse_direction < 0.0)
+        {
+            std::swap(near_parameter, far_parameter);
+        }
+
+        min_parameter = std::max(min_parameter, near_parameter);
+        max_parameter = std::min(max_parameter, far_parameter);
+
+        if (max_parameter <= min_parameter)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+double GridMedium::density(const Point3& point) const
+{
+    auto x = static_cast<int>(std::floor((point.x() - bounds.min().x()) / voxel_size.x()));
+    auto y = static_cast<int>(std::floor((point.y() - bounds.min().y()) / voxel_size.y()));
+    auto z = static_cast<int>(std::floor((point.z() - bounds.min().z()) / voxel_size.z()));
+
+    return density_scale * grid->density(x, y, z);
+}
+
+double GridMedium::majorant(int cell_x, int cell_y, int cell_z) const
+{
+    return density_scale * majorants[(cell_z * majorant_cells[1] + cell_y) * majorant_cells[0] + cell_x];
+}
+
+/*
+    3D-DDA (Amanatides & Woo, "A Fast Voxel Traversal Algorithm for Ray Tracing")
+    over the majorant grid. next_parameter[axis] is the ray parameter at which the
+    ray crosses the next cell boundary on that axis, and delta_parameter[axis] is
+    the parameter increment needed to cross a whole cell on that axis.
+*/
+template <typename Visitor>
+bool GridMedium::traverse(const Ray& ray, double min_parameter, double max_parameter, Visitor&& visit) const
+{
+    const auto entry_point = ray.at(min_parameter);
+    int cell[3];
+    int step[3];
+    double next_parameter[3];
+    double delta_parameter[3];
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const auto cell_size = voxel_size[axis] * majorant_cell_size;
+        const auto local = (entry_point[axis] - bounds.min()[axis]) / cell_size;
+        cell[axis] = std::clamp(static_cast<int>(std::floor(local)), 0, majorant_cells[axis] - 1);
+
+        const auto direction = ray.direction()[axis];
+        if (direction > 0.0)
+        {
+            step[axis] = 1;
+            delta_parameter[axis] = cell_size / direction;
+            next_parameter[axis] = min_parameter + (bounds.min()[axis] + (cell[axis] + 1) * cell_size - entry_point[axis]) / direction;
+        }
+        else if (direction < 0.0)
+        {
+            step[axis] = -1;
+            delta_parameter[axis] = -cell_size / direction;
+            next_parameter[axis] = min_parameter + (bounds.min()[axis] + cell[axis] * cell_size - entry_point[axis]) / direction;
+        }
+        else
+        {
+            step[axis] = 0;
+            delta_parameter[axis] = infinity;
+            next_parameter[axis] = infinity;
+        }
+    }
+
+    auto cell_begin = min_parameter;
+
+    while (cell_begin < max_parameter)
+    {
+        // The axis whose cell boundary is crossed first
+        int axis = (next_parameter[0] < next_parameter[1])
+            ? (next_parameter[0] < next_parameter[2] ? 0 : 2)
+            : (next_parameter[1] < next_parameter[2] ? 1 : 2);
+
+        auto cell_end = std::min(next_parameter[axis], max_parameter);
+        auto cell_majorant = majorant(cell[0], cell[1], cell[2]);
+
+        if (cell_majorant > 0.0 && visit(cell_begin, cell_end, cell_majorant))
+        {
+            return true;
+        }
+
+        cell_begin = cell_end;
+        cell[axis] += step[axis];
+        next_parameter[axis] += delta_parameter[axis];
+
+        if (cell[axis] < 0 || cell[axis] >= majorant_cells[axis])
+        {
+            break;
+        }
+    }
+
+    return false;
+}
+
+/*
+    Delta tracking: inside a cell with majorant M, tentative collisions are sampled
+    at exponentially distributed distances with rate M. A tentative collision at
+    point x is a real collision with probability density(x) / M, otherwise it's
+    a null collision and tracking continues from x. Because the exponential
+    distribution is memoryless, crossing into the next cell simply restarts the
+    sampling with that cell's majorant.
+*/
+bool GridMedium::hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const
+{
+    RT_STATISTIC(count_primitive_test(PrimitiveKind::GridMedium));
+
+    if (majorants.empty() || !clip(ray, min_parameter, max_parameter))
+    {
+        return false;
+    }
+
+    const auto ray_length = ray.direction().length();
+    double collision_parameter = 0.0;
+
+    auto found = traverse(ray, min_parameter, max_parameter, [&](double cell_begin, double cell_end, double cell_majorant)
+    {
+        auto parameter = cell_begin;
+
+        while (true)
+        {
+            parameter -= std::log(1.0 - random_double()) / (cell_majorant * ray_length);
+
+            if (parameter >= cell_end)
+            {
+                return false;
+            }
+
+            if (random_double() * cell_majorant < density(ray.at(parameter)))
+            {
+                collision_parameter = parameter;
+                return true;
+            }
+        }
+    });
+
+    if (!found)
+    {
+        return false;
+    }
+
+    record.parameter = collision_parameter;
+    record.point = ray.at(collision_parameter);
+
+    record.normal = Vector3{1, 0, 0}; // arbitrary
+    record.front_face = true; // arbitrary
+    record.material = phase_function;
+    record.object = nullptr;
+
+    RT_STATISTIC(count_primitive_hit(PrimitiveKind::GridMedium));
+    return true;
+}
+
+/*
+    Ratio tracking: the same tentative collisions as in delta tracking are sampled,
+    but instead of stochastically terminating, each one multiplies the running
+    transmittance by the probability of a null collision, 1 - density(x) / M.
+    This gives a lower variance estimate of exp(-integral of density) for shadow
+    and visibility queries.
+*/
+double GridMedium::transmittance(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    if (majorants.empty() || !clip(ray, min_parameter, max_parameter))
+    {
+        return 1.0;
+    }
+
+    const auto ray_length = ray.direction().length();
+    double transmittance = 1.0;
+
+    traverse(ray, min_parameter, max_parameter, [&](double cell_begin, double cell_end, double cell_majorant)
+    {
+        auto parameter = cell_begin;
+
+        while (true)
+        {
+            parameter -= std::log(1.0 - random_double()) / (cell_majorant * ray_length);
+
+            if (parameter >= cell_end)
+            {
+                return false;
+            }
+
+            transmittance *= 1.0 - density(ray.at(parameter)) / cell_majorant;
+
+            if (transmittance <= 0.0)
+            {
+                return true;
+            }
+        }
+    });
+
+    return std::max(0.0, transmittance);
+}
+
+bool GridMedium::bounding_box(double start_time, double end_time, AABB& output_box) const
+{
+    output_box = bounds;
+    return true;
+}
+
+#endif // GRID_MEDIUM_HPP
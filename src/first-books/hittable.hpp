@@ -3,9 +3,17 @@
 
 #include "aabb.hpp"
 #include "ray.hpp"
+#include "ray_packet.hpp"
+#include "statistics.hpp"
+#include "util.hpp"
 
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <utility>
 
+class Hittable;
 class Material;
 
 struct HitRecord
@@ -14,16 +22,63 @@ struct HitRecord
     Vector3 normal;
     std::shared_ptr<Material> material;
     double parameter;
-    // UV surfaces coordinates for textures
-    double u;
-    double v;
+    // UV surfaces coordinates for textures, only set for materials that use them
+    double u{0.0};
+    double v{0.0};
+    // Width of the ray cone footprint in UV units, used to choose the filtering level of textures
+    double footprint{0.0};
     bool front_face; // stores whether the ray is outside the sphere or not
+    // Primitive whose surface attributes are still to be computed (see Hittable::surface_interaction)
+    const Hittable* object{nullptr};
 
     inline void set_face_normal(const Ray& ray, const Vector3& outward_normal)
     {
         front_face = dot(ray.direction(), outward_normal) < 0.0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    /*
+        Projects the ray cone onto the surface and converts its width to UV units;
+        must be called after parameter and normal are set.
+
+        Args:
+            ray: incoming ray carrying the cone
+            uv_scale: world-space length spanned by one unit of UV on the surface
+    */
+    inline void set_footprint(const Ray& ray, double uv_scale)
+    {
+        if (ray.cone_width == 0.0 && ray.cone_spread == 0.0)
+        {
+            footprint = 0.0;
+            return;
+        }
+
+        // Grazing angles stretch the footprint; the cosine is clamped to avoid blurring everything at silhouettes
+        const auto direction_length = ray.direction().length();
+        const auto cosine = std::fmax(std::fabs(dot(ray.direction(), normal)) / direction_length, 0.1);
+        footprint = (ray.cone_width + parameter * direction_length * ray.cone_spread) / (uv_scale * cosine);
+    }
+};
+
+/*
+    Closest hits of the lanes of a ray packet.
+
+    Scalar intersection tests of a lane run with the lane's own random stream (only
+    participating media draw random numbers there), so a lane gets the same hit, and
+    leaves its stream in the same state, as its ray traced alone.
+*/
+struct PacketHits
+{
+    HitRecord records[RayPacket::max_size];
+    // Parameter of the closest hit so far, and the same rounded up to float for the box tests
+    double max_parameters[RayPacket::max_size];
+    alignas(16) float max_parameter_bounds[RayPacket::max_size];
+    std::uint32_t hit_lanes{0};
+    RandomGenerator generators[RayPacket::max_size];
+
+    void reset(double max_parameter);
+    // Scalar intersection of one lane with object
+    void hit_lane(const Hittable& object, const RayPacket& packet, int lane, double min_parameter);
 };
 
 class Hittable
@@ -31,6 +86,87 @@ class Hittable
 public:
     virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const = 0;
     virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const = 0;
+
+    /*
+        Surface attributes of a hit: while looking for the closest hit, hit only has to
+        set the parameter and record.object to this, and the point, normal and material
+        of the closest hit alone are computed here, along with its UV coordinates and
+        footprint if its material uses them. Primitives that set everything in hit set
+        record.object to nullptr instead, and this is never called for them.
+    */
+    virtual void surface_interaction(const Ray& ray, HitRecord& record) const;
+
+    /*
+        Whether anything is hit between min_parameter and max_parameter, for shadow and
+        visibility rays: it stops at the first hit found, in any order, and computes no
+        surface attributes. By default it's hit with a record that's thrown away.
+    */
+    virtual bool occluded(const Ray& ray, double min_parameter, double max_parameter) const;
+
+    /*
+        Intersects the active lanes of a packet, updating the lanes of hits that find a
+        closer hit. By default every lane is tested on its own; BVHNode and HittableList
+        pass the packet down to their children.
+    */
+    virtual void hit_packet(const RayPacket& packet, std::uint32_t active, double min_parameter, PacketHits& hits) const;
 };
 
+/*
+    Completes a hit found by hit with the same ray, so that every attribute of record is
+    set; the callers of hit that read more than the parameter call it first.
+*/
+inline void finish_hit(const Ray& ray, HitRecord& record)
+{
+    if (record.object)
+    {
+        record.object->surface_interaction(ray, record);
+        record.object = nullptr;
+    }
+}
+
+void Hittable::surface_interaction(const Ray& ray, HitRecord& record) const
+{
+}
+
+bool Hittable::occluded(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    HitRecord record;
+    return hit(ray, min_parameter, max_parameter, record);
+}
+
+void PacketHits::reset(double max_parameter)
+{
+    hit_lanes = 0;
+    for (int lane = 0; lane < RayPacket::max_size; ++lane)
+    {
+        max_parameters[lane] = max_parameter;
+        max_parameter_bounds[lane] = std::nextafter(static_cast<float>(max_parameter), std::numeric_limits<float>::infinity());
+    }
+}
+
+void PacketHits::hit_lane(const Hittable& object, const RayPacket& packet, int lane, double min_parameter)
+{
+    std::swap(random_generator(), generators[lane]);
+
+    if (object.hit(packet.rays[lane], min_parameter, max_parameters[lane], records[lane]))
+    {
+        hit_lanes |= 1u << lane;
+        max_parameters[lane] = records[lane].parameter;
+        max_parameter_bounds[lane] = std::nextafter(static_cast<float>(records[lane].parameter), std::numeric_limits<float>::infinity());
+    }
+
+    std::swap(random_generator(), generators[lane]);
+}
+
+void Hittable::hit_packet(const RayPacket& packet, std::uint32_t active, double min_parameter, PacketHits& hits) const
+{
+    for (int lane = 0; lane < packet.size; ++lane)
+    {
+        if (active & (1u << lane))
+        {
+            hits.hit_lane(*this, packet, lane, min_parameter);
+        }
+    }
+}
+
 #endif // HITTABLE_HPP
\ No newline at end of file
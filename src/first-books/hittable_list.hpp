@@ -18,6 +18,8 @@ public:
     void add(std::shared_ptr<Hittable> object);
     virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const override;
     virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const override;
+    virtual void hit_packet(const RayPacket& packet, std::uint32_t active, double min_parameter, PacketHits& hits) const override;
+    virtual bool occluded(const Ray& ray, double min_parameter, double max_parameter) const override;
 };
 
 HittableList::HittableList(std::shared_ptr<Hittable> object)
@@ -37,6 +39,8 @@ void HittableList::add(std::shared_ptr<Hittable> object)
 
 bool HittableList::hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const
 {
+    RT_STATISTIC(count_list_visit());
+
     HitRecord temp_record;
     bool hit_anything = false;
     auto closest_so_far = max_parameter;
@@ -54,6 +58,32 @@ bool HittableList::hit(const Ray& ray, double min_parameter, double max_paramete
     return hit_anything;
 }
 
+// The lanes' closest hits are kept in hits, so objects are tested in turn like in hit
+void HittableList::hit_packet(const RayPacket& packet, std::uint32_t active, double min_parameter, PacketHits& hits) const
+{
+    RT_STATISTIC(count_list_visit());
+
+    for (const auto& object: objects)
+    {
+        object->hit_packet(packet, active, min_parameter, hits);
+    }
+}
+
+bool HittableList::occluded(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    RT_STATISTIC(count_list_visit());
+
+    for (const auto& object: objects)
+    {
+        if (object->occluded(ray, min_parameter, max_parameter))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 bool HittableList::bounding_box(double start_time, double end_time, AABB& output_box) const
 {
     if (objects.empty())
@@ -1,284 +1,419 @@
-#include "aarect.hpp"
+#include "animation.hpp"
+#include "batch.hpp"
+#include "bvh.hpp"
 #include "camera.hpp"
-#include "color.hpp"
+#include "daemon.hpp"
+#include "distributed.hpp"
 #include "hittable_list.hpp"
-#include "material.hpp"
-#include "moving_sphere.hpp"
-#include "ray.hpp"
+#include "preview.hpp"
+#include "renderer.hpp"
 #include "scenes.hpp"
-#include "sphere.hpp"
-#include "texture.hpp"
+#include "trace.hpp"
 #include "util.hpp"
 #include "vector3.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <string>
 
-// Recursive ray tracing function to compute color for a pixel
-Color ray_color(const Ray& ray, const Hittable& world, int depth);
+/*
+    Renders the chosen scene as PPM to the standard output.
 
-// Overloading of ray_color to accept a single background color instead of a gradient
-Color ray_color(const Ray& ray, const Color& background, const Hittable& world, int depth);
+    Options:
+        --diagnostics PREFIX  also writes per-pixel cost maps (cycles, BVH nodes visited
+                              with RT_STATISTICS, average path length) as
+                              PREFIX_<channel>.pfm and .ppm
+        --trace FILE          writes a timeline of scene construction, BVH build, texture
+                              decoding, tile renders and image output in the Chrome trace
+                              format (open it in chrome://tracing or ui.perfetto.dev)
+        --packet N            traces the camera rays in packets of N (4, 8 or 16) rays
+        --wavefront           renders with the wavefront renderer (stages sorted by material)
+        --reorder             same, also sorting the secondary rays by direction and origin
 
-int main()
+    Animations (the scene, its textures and BVH are built once for the whole sequence):
+        --frames N            renders N frames to PREFIX_0000.ppm, PREFIX_0001.ppm... instead
+        --output PREFIX       of the standard output (required with --frames)
+        --orbit DEGREES       the camera orbits around its target by DEGREES over the
+                              sequence (360 by default)
+        --spin DEGREES        every rotated instance turns by DEGREES over the sequence,
+                              including the ones in lists and nested BVHs
+                              (0 by default); the BVH is refitted every frame
+        --rebuild-threshold X rebuilds the BVH instead once refitting made its SAH cost
+                              grow by more than X (0.25 by default)
+
+    Batches:
+        --batch FILE          renders every job (scene, camera, resolution, samples per
+                              pixel and output file) of FILE, see read_jobs in batch.hpp;
+                              every scene is built once for all the jobs viewing it
+
+    Distributed rendering (see distributed.hpp):
+        --coordinator JOB     renders JOB (a line of a job file) by handing its tiles to
+                              worker processes, writing the image to its output file
+        --port N              TCP port the coordinator listens on (a free one by default)
+        --bind ADDRESS        IPv4 address the coordinator listens on (127.0.0.1 by default,
+                              so only workers on this machine can join; 0.0.0.0 for all)
+        --workers N           worker processes the coordinator starts on this machine
+        --worker-threads N    render threads of each of them (shared out by default)
+        --timeout SECONDS     drops a worker that sends nothing for this long (60 by
+                              default) and hands its tiles to the others; also drops
+                              connections that don't get ready within it
+        --worker HOST:PORT    renders tiles for the coordinator at HOST:PORT
+
+    Render daemon (see daemon.hpp):
+        --daemon SOCKET       renders the jobs sent to the Unix domain socket SOCKET until
+                              stopped, keeping the last scenes built
+        --cache N             scenes the daemon keeps built (4 by default)
+        --submit SOCKET JOB   sends JOB to the daemon, and writes its image to its output
+                              file; interrupting it cancels the job
+        --priority N          the daemon renders the jobs of higher priority first (0 by
+                              default)
+        --cancel SOCKET ID    cancels the job ID of the daemon
+
+    Preview (see preview.hpp):
+        --preview JOB         renders JOB coarse to fine, from 1/16 of its resolution at
+                              1 sample per pixel, overwriting its output file with every
+                              refinement; key=value lines read from the standard input
+                              change the job and restart the preview, quit ends it
+*/
+// Renders the frames of the animation of scene to numbered PPM files; returns the process exit code
+int render_sequence(SceneSettings scene, const AnimationSettings& animation, const RenderSettings& settings, const std::string& output_prefix)
 {
-    // Image settings
-    double aspect_ratio = 16.0 / 9.0;
-    int image_width = 1200;
-    int image_height = static_cast<int>(image_width / aspect_ratio); // 675
-    int samples_per_pixel = 100;
-    int max_depth = 50;
+    AnimatedScene animated_scene{std::move(scene), animation};
+    int rebuilds = 0;
 
-    /*
-    Wide-angle view world settings
-    const auto radius = std::cos(pi / 4);
-    auto material_left = std::make_shared<Lambertian>(Color{0, 0, 1});
-    auto material_right = std::make_shared<Lambertian>(Color{1, 0, 0});
-    world.add(std::make_shared<Sphere>(Point3{-radius, 0, -1}, radius, material_left));
-    world.add(std::make_shared<Sphere>(Point3{radius, 0, -1}, radius, material_right));
-    */
+    for (int frame = 0; frame < animation.frames; ++frame)
+    {
+        const auto camera = animated_scene.pose(frame, settings.image_height);
+        rebuilds += animated_scene.rebuilt;
 
-    // Camera settings; set distance_to_focus to 1.0 and aperture to 0.0 to remove depth of field/defocus blur
-    Point3 look_from;
-    Point3 look_at;
-    Vector3 view_up{0, 1, 0};
-    double vertical_fov{20.0};
-    double distance_to_focus{1.0};
-    double aperture{0.0};
+        RenderStatistics statistics;
+        const auto image = render(animated_scene.world, camera, animated_scene.scene.background, settings, &statistics);
 
-    auto choosen_scene{Scenes::PointCloud};
-    bool use_motion_blur{true};
-    HittableList world;
-    Color background{0, 0, 0};
+        char filename_suffix[16];
+        std::snprintf(filename_suffix, sizeof(filename_suffix), "_%04d.ppm", frame);
+        const auto filename = output_prefix + filename_suffix;
+        std::ofstream file{filename, std::ios::binary};
+        image.write_ppm(file, settings.samples_per_pixel);
+        if (!file)
+        {
+            std::cerr << "\nUnable to write " << filename << "\n";
+            return 1;
+        }
 
-    switch (choosen_scene)
+        std::cerr << "\rFrame " << frame + 1 << "/" << animation.frames << ": BVH " << (animated_scene.rebuilt ? "rebuilt" : "refitted")
+                  << " in " << animated_scene.update_milliseconds << " ms (SAH cost " << animated_scene.sah_cost << "), rendered in "
+                  << statistics.seconds << " s\n";
+    }
+
+    std::cerr << "\n" << animation.frames << " frames, " << rebuilds << " BVH rebuild(s)\n";
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string diagnostics_prefix;
+    std::string trace_filename;
+    int packet_size{0};
+    bool wavefront{false};
+    bool reorder_rays{false};
+    AnimationSettings animation;
+    std::string output_prefix;
+    std::string batch_filename;
+    std::string coordinator_job;
+    std::string coordinator_address;
+    DistributedSettings distributed;
+    std::string daemon_path;
+    DaemonSettings daemon;
+    std::string submitted_job;
+    int priority{0};
+    int cancelled_job{0};
+    std::string preview_job;
+    for (int i = 1; i < argc; ++i)
     {
-    case Scenes::HollowGlass:
-        look_from = Point3{3, 3, 2};
-        look_at = Point3{0, 0, -1};
-        aperture = 0.1;
-        distance_to_focus = (look_from - look_at).length();
-        world = hollow_glass_scene();
-        background = Color{0.70, 0.80, 1.00};
-        break;
-    case Scenes::Random:
-        look_from = Point3{13, 2, 3};
-        look_at = Point3{0, 0, 0};
-        aperture = 0.1;
-        distance_to_focus = 10.0;
-        world = random_scene(use_motion_blur);
-        background = Color{0.70, 0.80, 1.00};
-        break;
-    case Scenes::TwoCheckeredSpheres:
-        look_from = Point3{13, 2, 3};
-        look_at = Point3{0, 0, 0};
-        distance_to_focus = 10.0;
-        world = two_checkered_spheres();
-        background = Color{0.70, 0.80, 1.00};
-        break;
-    case Scenes::PerlinTexture:
-        look_from = Point3{13, 2, 3};
-        look_at = Point3{0, 0, 0};
-        distance_to_focus = 10.0;
-        world = two_perlin_spheres();
-        background = Color{0.70, 0.80, 1.00};
-        break;
-    case Scenes::PerlinTextureRandomSpheres:
-        look_from = Point3{13, 2, 3};
-        look_at = Point3{0, 0, 0};
-        aperture = 0.1;
-        distance_to_focus = 10.0;
-        world = perlin_random_scene();
-        background = Color{0.70, 0.80, 1.00};
-        break;
-    case Scenes::EarthSphere:
-        look_from = Point3{13, 2, 3};
-        look_at = Point3{0, 0, 0};
-        world = earth_sphere();
-        background = Color{0.70, 0.80, 1.00};
-        break;
-    case Scenes::SimpleLight:
-        look_from = Point3{26, 3, 6};
-        look_at = Point3{0, 2, 0};
-        world = simple_light();
-        break;
-    case Scenes::SimpleLightSphere:
-        look_from = Point3{26, 3, 6};
-        look_at = Point3{0, 2, 0};
-        world = simple_light_with_sphere();
-        break;
-    case Scenes::EmptyCornellBox:
-        aspect_ratio = 1.0;
-        image_width = 600;
-        image_height = static_cast<int>(image_width / aspect_ratio);
-        look_from = Point3{278, 278, -800};
-        look_at = Point3{278, 278, 0};
-        vertical_fov = 40.0;
-        world = empty_cornell_box();
-        break;
-    case Scenes::TwoBlocksCornellBox:
-        aspect_ratio = 1.0;
-        image_width = 600;
-        image_height = static_cast<int>(image_width / aspect_ratio);
-        samples_per_pixel = 200;
-        look_from = Point3{278, 278, -800};
-        look_at = Point3{278, 278, 0};
-        vertical_fov = 40.0;
-        world = two_blocks_cornell_box();
-        break;
-    case Scenes::ClassicCornellBox:
-        aspect_ratio = 1.0;
-        image_width = 600;
-        image_height = static_cast<int>(image_width / aspect_ratio);
-        samples_per_pixel = 200;
-        look_from = Point3{278, 278, -800};
-        look_at = Point3{278, 278, 0};
-        vertical_fov = 40.0;
-        world = classic_cornell_box();
-        break;
-    case Scenes::SmokeCornellBox:
-        aspect_ratio = 1.0;
-        image_width = 600;
-        image_height = static_cast<int>(image_width / aspect_ratio);
-        samples_per_pixel = 200;
-        look_from = Point3{278, 278, -800};
-        look_at = Point3{278, 278, 0};
-        vertical_fov = 40.0;
-        world = smoke_cornell_box();
-        break;
-    case Scenes::NextWeekFinal:
-        aspect_ratio = 1.0;
-        image_width = 800;
-        image_height = static_cast<int>(image_width / aspect_ratio);
-        samples_per_pixel = 1000;
-        look_from = Point3{478, 278, -600};
-        look_at = Point3{278, 278, 0};
-        vertical_fov = 40.0;
-        world = next_week_final_scene();
-        break;
-    case Scenes::WikipediaPathTracing:
-        aspect_ratio = 3.0 / 2.0;
-        image_height = static_cast<int>(image_width / aspect_ratio); // 800
-        look_from = Point3{0, 13, 30};
-        look_at = Point3{0, 3, 0};
-        background = Color{1.0, 1.0, 1.0};
-        //background = Color{0.0, 0.0, 0.0};
-        if (background != Color{0, 0, 0})
-        {
-            samples_per_pixel = 200;
-            world = wikipedia_path_tracing_scene();
+        const std::string argument{argv[i]};
+        if (argument == "--diagnostics" && i + 1 < argc)
+        {
+            diagnostics_prefix = argv[++i];
+        }
+        else if (argument == "--trace" && i + 1 < argc)
+        {
+            trace_filename = argv[++i];
+            enable_tracing();
+        }
+        else if (argument == "--packet" && i + 1 < argc)
+        {
+            packet_size = std::stoi(argv[++i]);
+        }
+        else if (argument == "--wavefront")
+        {
+            wavefront = true;
+        }
+        else if (argument == "--reorder")
+        {
+            wavefront = true;
+            reorder_rays = true;
+        }
+        else if (argument == "--frames" && i + 1 < argc)
+        {
+            animation.frames = std::max(1, std::stoi(argv[++i]));
+        }
+        else if (argument == "--output" && i + 1 < argc)
+        {
+            output_prefix = argv[++i];
+        }
+        else if (argument == "--orbit" && i + 1 < argc)
+        {
+            animation.orbit_degrees = std::stod(argv[++i]);
+        }
+        else if (argument == "--spin" && i + 1 < argc)
+        {
+            animation.spin_degrees = std::stod(argv[++i]);
+        }
+        else if (argument == "--rebuild-threshold" && i + 1 < argc)
+        {
+            animation.rebuild_threshold = std::stod(argv[++i]);
+        }
+        else if (argument == "--batch" && i + 1 < argc)
+        {
+            batch_filename = argv[++i];
+        }
+        else if (argument == "--coordinator" && i + 1 < argc)
+        {
+            coordinator_job = argv[++i];
+        }
+        else if (argument == "--port" && i + 1 < argc)
+        {
+            distributed.port = std::stoi(argv[++i]);
+        }
+        else if (argument == "--bind" && i + 1 < argc)
+        {
+            distributed.bind_address = argv[++i];
+        }
+        else if (argument == "--workers" && i + 1 < argc)
+        {
+            distributed.local_workers = std::max(0, std::stoi(argv[++i]));
+        }
+        else if (argument == "--worker-threads" && i + 1 < argc)
+        {
+            distributed.worker_threads = static_cast<unsigned>(std::max(0, std::stoi(argv[++i])));
+        }
+        else if (argument == "--timeout" && i + 1 < argc)
+        {
+            distributed.timeout_seconds = std::stod(argv[++i]);
+        }
+        else if (argument == "--worker" && i + 1 < argc)
+        {
+            coordinator_address = argv[++i];
+        }
+        else if (argument == "--daemon" && i + 1 < argc)
+        {
+            daemon_path = argv[++i];
+        }
+        else if (argument == "--cache" && i + 1 < argc)
+        {
+            daemon.cached_scenes = static_cast<std::size_t>(std::max(1, std::stoi(argv[++i])));
+        }
+        else if (argument == "--submit" && i + 2 < argc)
+        {
+            daemon_path = argv[++i];
+            submitted_job = argv[++i];
+        }
+        else if (argument == "--priority" && i + 1 < argc)
+        {
+            priority = std::stoi(argv[++i]);
+        }
+        else if (argument == "--cancel" && i + 2 < argc)
+        {
+            daemon_path = argv[++i];
+            cancelled_job = std::stoi(argv[++i]);
+        }
+        else if (argument == "--preview" && i + 1 < argc)
+        {
+            preview_job = argv[++i];
         }
         else
         {
-            samples_per_pixel = 500; // More rays are needed because of the small light source
-            world = wikipedia_path_tracing_scene(false);
-        }
-        break;
-    case Scenes::RecursiveGlass:
-        look_from = Point3{0, 1, 6};
-        look_at = Point3{0, 1, 0};
-        world = recursive_glass();
-        background = Color{1.0, 1.0, 1.0};
-        break;
-    case Scenes::PointCloud:
-        aspect_ratio = 3.0 / 2.0;
-        image_height = static_cast<int>(image_width / aspect_ratio); // 800
-        look_from = Point3{0, 4, 10};
-        look_at = Point3{-0.25, 1.5, 0};
-        aperture = 0.0;
-        distance_to_focus = 1.0;
-        //background = Color{0.70, 0.80, 1.00};
-        background = Color{0, 0, 0};
-        world = point_cloud(background != Color{0, 0, 0}); 
-        break;
-    default:
-        std::cerr << "Empty scene: unable to render\n";
-        return 1;
+            std::cerr << "Usage: firstbooks [--diagnostics PREFIX] [--trace FILE] [--packet 4|8|16] [--wavefront] [--reorder] > image.ppm\n"
+                      << "       firstbooks --frames N --output PREFIX [--orbit DEGREES] [--spin DEGREES] [--rebuild-threshold X] [options]\n"
+                      << "       firstbooks --batch FILE [options]\n"
+                      << "       firstbooks --coordinator JOB [--port N] [--bind ADDRESS] [--workers N] [--worker-threads N] [--timeout SECONDS] [options]\n"
+                      << "       firstbooks --worker HOST:PORT [options]\n"
+                      << "       firstbooks --daemon SOCKET [--cache N] [options]\n"
+                      << "       firstbooks --submit SOCKET JOB [--priority N]\n"
+                      << "       firstbooks --cancel SOCKET ID\n"
+                      << "       firstbooks --preview JOB [options]\n";
+            return 2;
+        }
     }
 
-    double open_shutter_time{0.0};
-    double close_shutter_time{1.0};
-    Camera camera{look_from, look_at, view_up, vertical_fov, aspect_ratio, aperture, distance_to_focus, open_shutter_time, close_shutter_time};
-
-    // Render
-    std::cout << "P3\n" << image_width << " " << image_height << "\n255\n";
-    
-    // Starting at upper left corner, left to right and up to bottom
-    for (int row = image_height - 1; row >= 0; --row)
+    if (!batch_filename.empty())
     {
-        std::cerr << "\rScanlines remaining: " << row << ' ' << std::flush;
+        std::vector<BatchJob> jobs;
+        if (!read_jobs(batch_filename, jobs))
+        {
+            return 2;
+        }
 
-        for (int column = 0; column < image_width; ++column)
+        RenderSettings settings;
+        settings.packet_size = packet_size;
+        settings.wavefront = wavefront;
+        settings.reorder_rays = reorder_rays;
+        const auto status = render_batch(jobs, settings);
+        if (!trace_filename.empty() && !write_trace(trace_filename))
         {
-            Color pixel_color{0.0, 0.0, 0.0};
-            for (int sample = 0; sample < samples_per_pixel; ++sample)
-            {
-                auto u = (column + random_double()) / (image_width - 1);
-                auto v = (row + random_double()) / (image_height - 1);
+            std::cerr << "Unable to write trace " << trace_filename << "\n";
+        }
+        return status;
+    }
 
-                Ray ray = camera.get_ray(u, v);
-                //pixel_color += ray_color(ray, world, max_depth); // gradient-sky background
-                pixel_color += ray_color(ray, background, world, max_depth);
-            }
+    if (!preview_job.empty())
+    {
+        BatchJob job;
+        std::string error;
+        if (!parse_job(preview_job, job, error))
+        {
+            std::cerr << "Invalid job: " << error << "\n";
+            return 2;
+        }
 
-            write_color(std::cout, pixel_color, samples_per_pixel);
+        RenderSettings settings;
+        settings.packet_size = packet_size;
+        settings.wavefront = wavefront;
+        settings.reorder_rays = reorder_rays;
+        const auto status = run_preview(job, settings);
+        if (!trace_filename.empty() && !write_trace(trace_filename))
+        {
+            std::cerr << "Unable to write trace " << trace_filename << "\n";
         }
+        return status;
     }
-    
-    std::cerr << "\nDone.\n";
-}
 
-Color ray_color(const Ray& ray, const Hittable& world, int depth)
-{
-    if (depth == 0)
+    if (!submitted_job.empty())
     {
-        return Color{0.0, 0.0, 0.0};
+        return submit_job(daemon_path, submitted_job, priority);
+    }
+    if (cancelled_job != 0)
+    {
+        return cancel_job(daemon_path, cancelled_job);
     }
 
-    HitRecord record;
+    if (!daemon_path.empty())
+    {
+        RenderSettings settings;
+        settings.packet_size = packet_size;
+        settings.wavefront = wavefront;
+        settings.reorder_rays = reorder_rays;
+        return run_daemon(daemon_path, settings, daemon);
+    }
 
-    if (world.hit(ray, 0.001, infinity, record))
+    if (!coordinator_job.empty() || !coordinator_address.empty())
     {
-        Ray scattered_ray;
-        Color attenuation;
-        if (record.material->scatter(ray, record, attenuation, scattered_ray))
+        RenderSettings settings;
+        settings.packet_size = packet_size;
+        settings.wavefront = wavefront;
+        settings.reorder_rays = reorder_rays;
+        settings.show_progress = true;
+
+        int status;
+        if (!coordinator_address.empty())
+        {
+            status = run_worker(coordinator_address, settings);
+        }
+        else
         {
-            return attenuation * ray_color(scattered_ray, world, depth - 1);
+            BatchJob job;
+            std::string error;
+            if (!parse_job(coordinator_job, job, error))
+            {
+                std::cerr << "Invalid job: " << error << "\n";
+                return 2;
+            }
+            status = run_coordinator(job, settings, distributed);
         }
-        
-        return Color{0, 0, 0};
+
+        if (!trace_filename.empty() && !write_trace(trace_filename))
+        {
+            std::cerr << "Unable to write trace " << trace_filename << "\n";
+        }
+        return status;
     }
 
-    Vector3 unit_direction = unit_vector(ray.direction());
-    
-    // unit.direction.y() ranges from -1.0 to 1.0, so lerp_parameter ranges from 0.0 to 1.0
-    auto lerp_parameter = 0.5 * (unit_direction.y() + 1.0);
+    const bool sequence = animation.frames > 1 || !output_prefix.empty();
+    if (sequence && output_prefix.empty())
+    {
+        std::cerr << "--frames needs --output PREFIX\n";
+        return 2;
+    }
 
-    Color white{1.0, 1.0, 1.0};
-    Color light_blue{0.5, 0.7, 1.0};
-    
-    return (1 - lerp_parameter) * white + lerp_parameter * light_blue;
-}
+    /*
+    Wide-angle view world settings
+    const auto radius = std::cos(pi / 4);
+    auto material_left = std::make_shared<Lambertian>(Color{0, 0, 1});
+    auto material_right = std::make_shared<Lambertian>(Color{1, 0, 0});
+    world.add(std::make_shared<Sphere>(Point3{-radius, 0, -1}, radius, material_left));
+    world.add(std::make_shared<Sphere>(Point3{radius, 0, -1}, radius, material_right));
+    */
 
-Color ray_color(const Ray& ray, const Color& background, const Hittable& world, int depth)
-{
-    if (depth <= 0)
+    auto choosen_scene{Scenes::PointCloud};
+    bool use_motion_blur{true};
+    auto scene = scene_settings(choosen_scene, use_motion_blur);
+
+    if (scene.world.objects.empty())
     {
-        return Color{0, 0, 0};
+        std::cerr << "Empty scene: unable to render\n";
+        return 1;
     }
 
-    HitRecord record;
-    if (!world.hit(ray, 0.001, infinity, record))
+    RenderSettings settings;
+    settings.image_width = scene.image_width;
+    settings.image_height = scene.image_height();
+    settings.samples_per_pixel = scene.samples_per_pixel;
+    settings.max_depth = scene.max_depth;
+    settings.packet_size = packet_size;
+    settings.wavefront = wavefront;
+    settings.reorder_rays = reorder_rays;
+    settings.show_progress = true;
+
+    if (sequence)
     {
-        return background;
+        const auto status = render_sequence(std::move(scene), animation, settings, output_prefix);
+        if (!trace_filename.empty() && !write_trace(trace_filename))
+        {
+            std::cerr << "Unable to write trace " << trace_filename << "\n";
+        }
+        return status;
     }
 
-    Ray scattered_ray;
-    Color attenuation;
-    Color emitted = record.material->emitted(record.u, record.v, record.point);
+    // Top-level BVH over the objects of the scene
+    MotionBVH world{scene.world, scene.open_shutter_time, scene.close_shutter_time};
+
+    Camera camera = scene.camera(settings.image_height);
+
+    // Render
+    RenderStatistics statistics;
+    DiagnosticBuffer diagnostics;
+    auto image = render(world, camera, scene.background, settings, &statistics, diagnostics_prefix.empty() ? nullptr : &diagnostics);
+    image.write_ppm(std::cout, settings.samples_per_pixel);
+
+    if (!diagnostics_prefix.empty() && !diagnostics.write(diagnostics_prefix))
+    {
+        std::cerr << "Unable to write diagnostics " << diagnostics_prefix << "_*\n";
+    }
+    if (!diagnostics_prefix.empty() && !DiagnosticBuffer::recorded(DiagnosticBuffer::Channel::BVHNodes))
+    {
+        std::cerr << "No BVH node map: the visits are only counted in builds with RT_STATISTICS\n";
+    }
 
-    if (!record.material->scatter(ray, record, attenuation, scattered_ray))
+    if (!trace_filename.empty() && !write_trace(trace_filename))
     {
-        return emitted;
+        std::cerr << "Unable to write trace " << trace_filename << "\n";
     }
 
-    return emitted + attenuation * ray_color(scattered_ray, background, world, depth - 1);
-}
\ No newline at end of file
+#ifdef RT_STATISTICS
+    std::cerr << "\n";
+    print_counters(std::cerr, statistics.counters);
+#endif
+
+    std::cerr << "\nDone.\n";
+}
@@ -6,20 +6,86 @@
 #include "ray.hpp"
 #include "texture.hpp"
 #include "util.hpp"
+#include <cstddef>
 #include <memory>
+#include <utility>
+#include <vector>
+
+/*
+    Hits of one material scattered together (see Material::scatter_batch); the inputs and
+    results of hit i are at index i of every array.
+*/
+struct ScatterBatch
+{
+    std::vector<const Ray*> incoming_rays;
+    std::vector<const HitRecord*> records;
+    // Random stream of each hit, used instead of the thread's own
+    std::vector<RandomGenerator*> generators;
+
+    std::vector<Color> attenuations;
+    std::vector<Ray> scattered_rays;
+    std::vector<char> scattered;
+
+    // Scratch space for batched texture lookups
+    std::vector<TextureLookup> lookups;
+
+    void resize(std::size_t count);
+    std::size_t size() const;
+};
 
 class Material
 {
 public:
     virtual bool scatter(const Ray& incoming_ray, const HitRecord& record, Color& attenuation, Ray& scattered_ray) const = 0;
     virtual Color emitted(double u, double v, const Point3& point) const;
+
+    /*
+        Batch form of scatter, used by the wavefront renderer: scattered[i], attenuations[i]
+        and scattered_rays[i] get what scatter would return and set for hit i, drawing
+        random numbers from generators[i]. By default scatter is called for each hit.
+    */
+    virtual void scatter_batch(ScatterBatch& batch) const;
+
+    // Whether scatter or emitted read the UV coordinates or footprint of the hit (see Texture::uses_uv)
+    virtual bool uses_uv() const;
 };
 
+void ScatterBatch::resize(std::size_t count)
+{
+    incoming_rays.resize(count);
+    records.resize(count);
+    generators.resize(count);
+    attenuations.resize(count);
+    scattered_rays.resize(count);
+    scattered.resize(count);
+    lookups.resize(count);
+}
+
+std::size_t ScatterBatch::size() const
+{
+    return records.size();
+}
+
 Color Material::emitted(double u, double v, const Point3& point) const
 {
     return Color{0, 0, 0};
 }
 
+bool Material::uses_uv() const
+{
+    return false;
+}
+
+void Material::scatter_batch(ScatterBatch& batch) const
+{
+    for (std::size_t i = 0; i < batch.size(); ++i)
+    {
+        std::swap(random_generator(), *batch.generators[i]);
+        batch.scattered[i] = scatter(*batch.incoming_rays[i], *batch.records[i], batch.attenuations[i], batch.scattered_rays[i]);
+        std::swap(random_generator(), *batch.generators[i]);
+    }
+}
+
 class Lambertian: public Material
 {
 public:
@@ -29,10 +95,14 @@ public:
     Lambertian(std::shared_ptr<Texture> texture): albedo{texture} {}
 
     virtual bool scatter(const Ray& incoming_ray, const HitRecord& record, Color& attenuation, Ray& scattered_ray) const override;
+    virtual void scatter_batch(ScatterBatch& batch) const override;
+    virtual bool uses_uv() const override;
 };
 
 bool Lambertian::scatter(const Ray& incoming_ray, const HitRecord& record, Color& attenuation, Ray& scattered_ray) const
 {
+    RT_STATISTIC(count_scatter(MaterialKind::Lambertian));
+
     auto scatter_direction = record.normal + random_unit_vector();
 
     // Catch degenerate scatter direction
@@ -41,12 +111,42 @@ bool Lambertian::scatter(const Ray& incoming_ray, const HitRecord& record, Color
         scatter_direction = record.normal;
     }
 
-    scattered_ray = Ray{record.point, scatter_direction, incoming_ray.time()};
-    attenuation = albedo->value(record.u, record.v, record.point);
+    scattered_ray = incoming_ray.scattered(record.point, record.normal, scatter_direction, record.parameter);
+    attenuation = albedo->filtered_value(record.u, record.v, record.point, record.footprint);
 
     return true;
 }
 
+// The directions are drawn hit by hit, then the albedo of the whole batch is looked up at once
+void Lambertian::scatter_batch(ScatterBatch& batch) const
+{
+    for (std::size_t i = 0; i < batch.size(); ++i)
+    {
+        RT_STATISTIC(count_scatter(MaterialKind::Lambertian));
+        const auto& record = *batch.records[i];
+
+        std::swap(random_generator(), *batch.generators[i]);
+        auto scatter_direction = record.normal + random_unit_vector();
+        std::swap(random_generator(), *batch.generators[i]);
+
+        if (scatter_direction.near_zero())
+        {
+            scatter_direction = record.normal;
+        }
+
+        batch.scattered_rays[i] = batch.incoming_rays[i]->scattered(record.point, record.normal, scatter_direction, record.parameter);
+        batch.scattered[i] = true;
+        batch.lookups[i] = TextureLookup{record.u, record.v, record.point, record.footprint};
+    }
+
+    albedo->filtered_values(batch.lookups.data(), batch.attenuations.data(), batch.size());
+}
+
+bool Lambertian::uses_uv() const
+{
+    return albedo->uses_uv();
+}
+
 class Metal: public Material
 {
 public:
@@ -60,8 +160,10 @@ public:
 
 bool Metal::scatter(const Ray& incoming_ray, const HitRecord& record, Color& attenuation, Ray& scattered_ray) const
 {
+    RT_STATISTIC(count_scatter(MaterialKind::Metal));
+
     Vector3 reflected = reflect(unit_vector(incoming_ray.direction()), record.normal);
-    scattered_ray = Ray{record.point, reflected + fuzz * random_in_unit_sphere(), incoming_ray.time()};
+    scattered_ray = incoming_ray.scattered(record.point, record.normal, reflected + fuzz * random_in_unit_sphere(), record.parameter);
     attenuation = albedo;
 
     return dot(scattered_ray.direction(), record.normal) > 0;
@@ -81,6 +183,8 @@ private:
 
 bool Dielectric::scatter(const Ray& incoming_ray, const HitRecord& record, Color& attenuation, Ray& scattered_ray) const
 {
+    RT_STATISTIC(count_scatter(MaterialKind::Dielectric));
+
     attenuation = Color{1.0, 1.0, 1.0}; // No absorption
     
     /*
@@ -106,7 +210,7 @@ bool Dielectric::scatter(const Ray& incoming_ray, const HitRecord& record, Color
         direction = refract(unit_direction, record.normal, refraction_ratio);
     }
 
-    scattered_ray = Ray{record.point, direction, incoming_ray.time()};
+    scattered_ray = incoming_ray.scattered(record.point, record.normal, direction, record.parameter);
     return true;
 }
 
@@ -127,10 +231,13 @@ public:
 
     virtual bool scatter(const Ray& ray, const HitRecord& record, Color& attenuation, Ray& scattered_ray) const override;
     virtual Color emitted(double u, double v, const Point3& point) const override;
+    virtual bool uses_uv() const override;
 };
 
 bool DiffuseLight::scatter(const Ray& incoming_ray, const HitRecord& record, Color& attenuation, Ray& scattered_ray) const
 {
+    RT_STATISTIC(count_scatter(MaterialKind::DiffuseLight));
+
     return false; // DiffuseLight don't scatter incoming rays, only emit light
 }
 
@@ -139,6 +246,11 @@ Color DiffuseLight::emitted(double u, double v, const Point3& point) const
     return emit->value(u, v, point);
 }
 
+bool DiffuseLight::uses_uv() const
+{
+    return emit->uses_uv();
+}
+
 class Isotropic: public Material
 {
 public:
@@ -148,13 +260,21 @@ public:
     Isotropic(std::shared_ptr<Texture> texture): albedo{texture} {}
 
     virtual bool scatter(const Ray& incoming_ray, const HitRecord& record, Color& attenuation, Ray& scattered_ray) const override;
+    virtual bool uses_uv() const override;
 };
 
 bool Isotropic::scatter(const Ray& incoming_ray, const HitRecord& record, Color& attenuation, Ray& scattered_ray) const
 {
-    scattered_ray = Ray{record.point, random_in_unit_sphere(), incoming_ray.time()};
-    attenuation = albedo->value(record.u, record.v, record.point);
+    RT_STATISTIC(count_scatter(MaterialKind::Isotropic));
+
+    scattered_ray = incoming_ray.scattered(record.point, random_in_unit_sphere(), record.parameter);
+    attenuation = albedo->filtered_value(record.u, record.v, record.point, record.footprint);
     return true;
 }
 
+bool Isotropic::uses_uv() const
+{
+    return albedo->uses_uv();
+}
+
 #endif // MATERIAL_HPP
\ No newline at end of file
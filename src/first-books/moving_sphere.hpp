@@ -26,11 +26,15 @@ public:
 
     virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const override;
     virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const override;
+    virtual void surface_interaction(const Ray& ray, HitRecord& record) const override;
+    virtual bool occluded(const Ray& ray, double min_parameter, double max_parameter) const override;
     Point3 center(double time) const;
 };
 
 bool MovingSphere::hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const
 {
+    RT_STATISTIC(count_primitive_test(PrimitiveKind::MovingSphere));
+
     Vector3 center_to_origin = ray.origin() - center(ray.time()); // A - C in the equation
     auto quadratic_coefficient = ray.direction().length_squared();
     auto half_linear_coefficient = dot(ray.direction(), center_to_origin);
@@ -55,11 +59,44 @@ bool MovingSphere::hit(const Ray& ray, double min_parameter, double max_paramete
     }
 
     record.parameter = root;
-    record.point = ray.at(root);
+    record.object = this;
+    
+    RT_STATISTIC(count_primitive_hit(PrimitiveKind::MovingSphere));
+    return true;
+}
+
+void MovingSphere::surface_interaction(const Ray& ray, HitRecord& record) const
+{
+    record.point = ray.at(record.parameter);
     Vector3 outward_normal = (record.point - center(ray.time())) / radius; // Unit length normal
     record.set_face_normal(ray, outward_normal);
     record.material = material;
-    
+}
+
+bool MovingSphere::occluded(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    RT_STATISTIC(count_primitive_test(PrimitiveKind::MovingSphere));
+
+    Vector3 center_to_origin = ray.origin() - center(ray.time());
+    auto quadratic_coefficient = ray.direction().length_squared();
+    auto half_linear_coefficient = dot(ray.direction(), center_to_origin);
+    auto constant_coefficient = center_to_origin.length_squared() - radius * radius;
+
+    auto discriminant = half_linear_coefficient * half_linear_coefficient - quadratic_coefficient * constant_coefficient;
+    if (discriminant < 0.0)
+    {
+        return false;
+    }
+
+    auto sqrt_discriminant = std::sqrt(discriminant);
+    auto near_root = (-half_linear_coefficient - sqrt_discriminant) / quadratic_coefficient;
+    auto far_root = (-half_linear_coefficient + sqrt_discriminant) / quadratic_coefficient;
+    if ((near_root < min_parameter || near_root > max_parameter) && (far_root < min_parameter || far_root > max_parameter))
+    {
+        return false;
+    }
+
+    RT_STATISTIC(count_primitive_hit(PrimitiveKind::MovingSphere));
     return true;
 }
 
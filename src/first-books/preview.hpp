@@ -0,0 +1,281 @@
+#ifndef PREVIEW_HPP
+#define PREVIEW_HPP
+
+#include "batch.hpp"
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "color.hpp"
+#include "renderer.hpp"
+#include "scenes.hpp"
+#include "trace.hpp"
+#include "util.hpp"
+#include "wavefront.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+    Interactive preview of a job (see BatchJob), for look development: instead of one
+    image once every tile is done, the job's output file gets a usable image within
+    moments, then better ones, each replacing the last:
+
+    - 1/16, 1/8, 1/4 and 1/2 of the resolution at 1 sample per pixel, scaled up to the
+      full resolution (nearest pixel);
+    - the full resolution at 1 sample per pixel, then 2, 4, 8... up to the job's samples
+      per pixel, each pass adding as many samples as the ones before (see
+      RenderSettings::first_sample). The samples are seeded like in a regular render, so
+      the last image has the same samples as the job rendered at once.
+
+    Every image is written next to the output file, then renamed over it, so viewers
+    reloading the file never read a partial image.
+
+    Lines read from the standard input change the job while it renders: key=value pairs,
+    as in a job file (look_from=0,20,0.1 fov=40, spp=256...), replace the job's ones, and
+    a new scene starts from its own camera and image settings. A change cancels the
+    refinement in progress, every render thread stopping after its current tile, and the
+    preview starts over from the coarsest image; scenes are built only the first time
+    they're viewed. The preview ends on a quit line, or once the last image is written
+    after the input is closed.
+*/
+int run_preview(const BatchJob& job, const RenderSettings& settings);
+
+// Refinement of a preview: 1/scale of the resolution, with samples [first_sample; last_sample[ of every pixel
+struct PreviewPass
+{
+    int scale;
+    int first_sample;
+    int last_sample;
+};
+
+// Refinements of a preview up to samples_per_pixel, coarsest first
+std::vector<PreviewPass> preview_passes(int samples_per_pixel);
+
+// Writes image, the sum of samples_per_pixel samples per pixel, scaled to width x height, over the PPM file filename
+bool publish_preview(const std::string& filename, const Framebuffer& image, int samples_per_pixel, int width, int height);
+
+std::vector<PreviewPass> preview_passes(int samples_per_pixel)
+{
+    std::vector<PreviewPass> passes;
+    for (int scale = 16; scale > 1; scale /= 2)
+    {
+        passes.push_back(PreviewPass{scale, 0, 1});
+    }
+    for (int first_sample = 0; first_sample < samples_per_pixel;)
+    {
+        const auto last_sample = std::min(std::max(2 * first_sample, 1), samples_per_pixel);
+        passes.push_back(PreviewPass{1, first_sample, last_sample});
+        first_sample = last_sample;
+    }
+    return passes;
+}
+
+bool publish_preview(const std::string& filename, const Framebuffer& image, int samples_per_pixel, int width, int height)
+{
+    ScopedTrace trace{"output", "write_ppm", filename};
+    const auto partial = filename + ".partial";
+    {
+        std::ofstream file{partial, std::ios::binary};
+        file << "P3\n" << width << " " << height << "\n255\n";
+        for (int row = height - 1; row >= 0; --row)
+        {
+            for (int column = 0; column < width; ++column)
+            {
+                write_color(file, image.at(row * image.height / height, column * image.width / width), samples_per_pixel);
+            }
+        }
+
+        if (!file)
+        {
+            return false;
+        }
+    }
+
+    return std::rename(partial.c_str(), filename.c_str()) == 0;
+}
+
+// Commands read from the standard input, shared with the thread reading them
+struct PreviewInput
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::string> commands;
+    bool closed{false};
+    // Incremented with every command, so renders can tell they're out of date without locking
+    std::atomic<int> generation{0};
+};
+
+int run_preview(const BatchJob& initial_job, const RenderSettings& settings)
+{
+    // The reading thread is left blocked on the input when the preview ends, so it shares the input with the preview
+    auto input = std::make_shared<PreviewInput>();
+    std::thread{[input]()
+    {
+        for (std::string line; std::getline(std::cin, line);)
+        {
+            std::lock_guard<std::mutex> lock{input->mutex};
+            input->commands.push_back(line);
+            ++input->generation;
+            input->changed.notify_all();
+        }
+
+        std::lock_guard<std::mutex> lock{input->mutex};
+        input->closed = true;
+        input->changed.notify_all();
+    }}.detach();
+
+    auto job = initial_job;
+    std::map<Scenes, std::unique_ptr<BatchScene>> scenes;
+    const auto thread_count = settings.threads != 0 ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+
+    // Whether the last image of job is written
+    bool complete = false;
+    for (;;)
+    {
+        int generation;
+        std::deque<std::string> commands;
+        {
+            std::unique_lock<std::mutex> lock{input->mutex};
+            if (complete)
+            {
+                // Waits for a change, or the end of the input
+                input->changed.wait(lock, [&input]() { return !input->commands.empty() || input->closed; });
+                if (input->commands.empty())
+                {
+                    return 0;
+                }
+            }
+            commands.swap(input->commands);
+            generation = input->generation;
+        }
+
+        for (const auto& command: commands)
+        {
+            if (command == "quit")
+            {
+                return 0;
+            }
+
+            BatchJob changed_job;
+            std::string error;
+            if (!parse_job(format_job(job) + " " + command, changed_job, error))
+            {
+                std::cerr << "Invalid change: " << error << "\n";
+                continue;
+            }
+            if (changed_job.scene != job.scene)
+            {
+                parse_job("output=" + job.output + " " + command, changed_job, error);
+            }
+            job = changed_job;
+            complete = false;
+        }
+        if (complete)
+        {
+            continue;
+        }
+
+        auto& scene = scenes[job.scene];
+        if (!scene)
+        {
+            ScopedTrace trace{"scene", "build", scene_name(job.scene)};
+            random_generator() = RandomGenerator{};
+            scene = std::make_unique<BatchScene>();
+            scene->settings = scene_settings(job.scene);
+            scene->world = MotionBVH{scene->settings.world, scene->settings.open_shutter_time, scene->settings.close_shutter_time};
+        }
+
+        const auto view = job_view(job, scene->settings);
+        const auto job_settings = job_render_settings(job, view, settings);
+        std::cerr << "Preview of " << scene_name(job.scene) << " " << job_settings.image_width << "x" << job_settings.image_height
+                  << " up to " << job_settings.samples_per_pixel << " spp -> " << job.output << "\n";
+
+        Framebuffer accumulated;
+        bool cancelled = false;
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto& pass: preview_passes(job_settings.samples_per_pixel))
+        {
+            // At least 2 pixels across, since the camera rays are spread over width - 1 and height - 1
+            auto pass_settings = job_settings;
+            pass_settings.image_width = std::max(job_settings.image_width / pass.scale, 2);
+            pass_settings.image_height = std::max(job_settings.image_height / pass.scale, 2);
+            pass_settings.first_sample = pass.first_sample;
+            pass_settings.samples_per_pixel = pass.last_sample;
+            const auto camera = view.camera(pass_settings.image_height);
+            const auto tiles = tile_count(pass_settings);
+
+            Framebuffer image{pass_settings.image_width, pass_settings.image_height};
+            std::atomic<int> next_tile{0};
+            auto render_pass = [&]()
+            {
+                Wavefront wavefront;
+                wavefront.reorder_rays = settings.reorder_rays;
+                for (int tile = next_tile++; tile < tiles && input->generation == generation; tile = next_tile++)
+                {
+                    render_tile(scene->world, camera, view.background, pass_settings, tile, image, nullptr, wavefront);
+                }
+            };
+
+            std::vector<std::thread> threads;
+            for (unsigned thread_index = 1; thread_index < std::min<unsigned>(thread_count, tiles); ++thread_index)
+            {
+                threads.emplace_back(render_pass);
+            }
+            render_pass();
+            for (auto& thread: threads)
+            {
+                thread.join();
+            }
+
+            if (input->generation != generation)
+            {
+                cancelled = true;
+                break;
+            }
+
+            bool published;
+            if (pass.scale != 1)
+            {
+                published = publish_preview(job.output, image, 1, job_settings.image_width, job_settings.image_height);
+            }
+            else
+            {
+                if (pass.first_sample == 0)
+                {
+                    accumulated = std::move(image);
+                }
+                else
+                {
+                    for (std::size_t pixel = 0; pixel < accumulated.pixels.size(); ++pixel)
+                    {
+                        accumulated.pixels[pixel] += image.pixels[pixel];
+                    }
+                }
+                published = publish_preview(job.output, accumulated, pass.last_sample, job_settings.image_width, job_settings.image_height);
+            }
+
+            const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cerr << "  " << pass_settings.image_width << "x" << pass_settings.image_height << " at " << pass.last_sample
+                      << " spp after " << seconds << " s" << (published ? "" : " (unable to write)") << "\n";
+        }
+
+        if (cancelled)
+        {
+            std::cerr << "  cancelled\n";
+        }
+        complete = !cancelled;
+    }
+}
+
+#endif // PREVIEW_HPP
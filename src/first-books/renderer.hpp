@@ -0,0 +1,660 @@
+#ifndef RENDERER_HPP
+#define RENDERER_HPP
+
+#include "camera.hpp"
+#include "color.hpp"
+#include "diagnostics.hpp"
+#include "hittable.hpp"
+#include "material.hpp"
+#include "ray.hpp"
+#include "ray_packet.hpp"
+#include "statistics.hpp"
+#include "trace.hpp"
+#include "util.hpp"
+#include "vector3.hpp"
+#include "wavefront.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct RenderSettings
+{
+    int image_width{1200};
+    int image_height{675};
+    int samples_per_pixel{100};
+    // Only samples first_sample to samples_per_pixel (excluded) are traced, so a progressive render can add samples to earlier ones
+    int first_sample{0};
+    int max_depth{50};
+    // 0 uses every hardware thread
+    unsigned threads{0};
+    std::uint64_t seed{0};
+    int tile_size{16};
+    // Camera rays are traced in packets of 4, 8 or 16 (blocks of 2x2, 4x2 or 4x4 pixels); 0 traces them one at a time
+    int packet_size{0};
+    // Traces the tiles with the wavefront renderer (see wavefront.hpp) instead of one path at a time
+    bool wavefront{false};
+    // With wavefront, sorts the secondary rays of every bounce by direction and origin before tracing them
+    bool reorder_rays{false};
+    bool show_progress{false};
+};
+
+// Ray counts and timings of a render
+struct RenderStatistics
+{
+    std::uint64_t primary_rays{0};
+    std::uint64_t secondary_rays{0};
+    double seconds{0.0};
+    // Only filled in builds with RT_STATISTICS
+    TraversalCounters counters;
+};
+
+/*
+    Sum of the samples of every pixel, row 0 being the bottom of the image.
+
+    A framebuffer can also hold a window of a larger image, such as a tile: it's then
+    indexed with the rows and columns of the whole image, from first_row and
+    first_column. Only whole images can be written or read.
+*/
+class Framebuffer
+{
+public:
+    int width{0};
+    int height{0};
+    int first_row{0};
+    int first_column{0};
+    std::vector<Color> pixels;
+
+    Framebuffer() {}
+    Framebuffer(int image_width, int image_height): width{image_width}, height{image_height}, pixels(static_cast<std::size_t>(image_width) * image_height) {}
+    Framebuffer(int window_width, int window_height, int window_first_row, int window_first_column):
+    width{window_width}, height{window_height}, first_row{window_first_row}, first_column{window_first_column},
+    pixels(static_cast<std::size_t>(window_width) * window_height) {}
+
+    Color& at(int row, int column);
+    const Color& at(int row, int column) const;
+
+    // Writes a plain PPM (P3), from the upper left corner, left to right and up to bottom
+    void write_ppm(std::ostream& out, int samples_per_pixel) const;
+
+    // Writes the average of the samples, without gamma or clamping, as an RGB PFM (little-endian floats)
+    bool write_pfm(const std::string& filename, int samples_per_pixel) const;
+    // Reads an RGB PFM written by write_pfm; the pixels are then averages (one sample per pixel)
+    static bool read_pfm(const std::string& filename, Framebuffer& image);
+};
+
+Color& Framebuffer::at(int row, int column)
+{
+    return pixels[static_cast<std::size_t>(row - first_row) * width + column - first_column];
+}
+
+const Color& Framebuffer::at(int row, int column) const
+{
+    return pixels[static_cast<std::size_t>(row - first_row) * width + column - first_column];
+}
+
+void Framebuffer::write_ppm(std::ostream& out, int samples_per_pixel) const
+{
+    ScopedTrace trace{"output", "write_ppm"};
+    out << "P3\n" << width << " " << height << "\n255\n";
+
+    for (int row = height - 1; row >= 0; --row)
+    {
+        for (int column = 0; column < width; ++column)
+        {
+            write_color(out, at(row, column), samples_per_pixel);
+        }
+    }
+}
+
+bool Framebuffer::write_pfm(const std::string& filename, int samples_per_pixel) const
+{
+    std::ofstream file{filename, std::ios::binary};
+    file << "PF\n" << width << " " << height << "\n-1.0\n";
+
+    // PFM stores the bottom row first, like the framebuffer
+    for (const auto& pixel: pixels)
+    {
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            const auto value = static_cast<float>(pixel[channel] / samples_per_pixel);
+            std::uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+
+            const char bytes[4] = {static_cast<char>(bits), static_cast<char>(bits >> 8), static_cast<char>(bits >> 16), static_cast<char>(bits >> 24)};
+            file.write(bytes, 4);
+        }
+    }
+
+    return static_cast<bool>(file);
+}
+
+bool Framebuffer::read_pfm(const std::string& filename, Framebuffer& image)
+{
+    std::ifstream file{filename, std::ios::binary};
+    std::string format;
+    int width{0};
+    int height{0};
+    double scale{0.0};
+
+    if (!(file >> format >> width >> height >> scale) || format != "PF" || scale >= 0.0 || width <= 0 || height <= 0)
+    {
+        return false;
+    }
+    file.get(); // single whitespace before the data
+
+    image = Framebuffer{width, height};
+    for (auto& pixel: image.pixels)
+    {
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            unsigned char bytes[4];
+            if (!file.read(reinterpret_cast<char*>(bytes), 4))
+            {
+                return false;
+            }
+
+            const std::uint32_t bits = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<std::uint32_t>(bytes[3]) << 24);
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            pixel[channel] = value;
+        }
+    }
+
+    return true;
+}
+
+// Recursive ray tracing function to compute color for a pixel, with a gradient-sky background
+Color ray_color(const Ray& ray, const Hittable& world, int depth)
+{
+    if (depth == 0)
+    {
+        return Color{0.0, 0.0, 0.0};
+    }
+
+    HitRecord record;
+
+    if (world.hit(ray, min_hit_parameter, infinity, record))
+    {
+        finish_hit(ray, record);
+        Ray scattered_ray;
+        Color attenuation;
+        if (record.material->scatter(ray, record, attenuation, scattered_ray))
+        {
+            return attenuation * ray_color(scattered_ray, world, depth - 1);
+        }
+
+        return Color{0, 0, 0};
+    }
+
+    Vector3 unit_direction = unit_vector(ray.direction());
+
+    // unit.direction.y() ranges from -1.0 to 1.0, so lerp_parameter ranges from 0.0 to 1.0
+    auto lerp_parameter = 0.5 * (unit_direction.y() + 1.0);
+
+    Color white{1.0, 1.0, 1.0};
+    Color light_blue{0.5, 0.7, 1.0};
+
+    return (1 - lerp_parameter) * white + lerp_parameter * light_blue;
+}
+
+/*
+    Color of a path with a single background color instead of a gradient, whose first
+    intersection was already found: hit tells whether ray hit anything, and record is
+    then the closest hit (finished here if needed, see finish_hit).
+
+    This is the iterative form of
+        color(ray) = emitted + attenuation * color(scattered_ray)
+    where the product of the attenuations along the path is kept in throughput.
+
+    path_length is set to the number of rays traced (1 for a ray that misses everything).
+*/
+Color ray_color(const Ray& ray, bool hit, HitRecord& record, const Color& background, const Hittable& world, int depth, int& path_length)
+{
+    Color accumulated{0, 0, 0};
+    Color throughput{1, 1, 1};
+    Ray current_ray = ray;
+    HitRecord next_record;
+    HitRecord* current_record = &record;
+    path_length = 0;
+
+    for (; depth > 0; --depth)
+    {
+        RT_STATISTIC(count_ray(path_length));
+        if (path_length > 0)
+        {
+            next_record = HitRecord{};
+            hit = world.hit(current_ray, min_hit_parameter, infinity, next_record);
+            current_record = &next_record;
+        }
+        ++path_length;
+
+        if (!hit)
+        {
+            RT_STATISTIC(count_path_end(PathEnd::Escaped));
+            return accumulated + throughput * background;
+        }
+
+        finish_hit(current_ray, *current_record);
+        Ray scattered_ray;
+        Color attenuation;
+        accumulated += throughput * current_record->material->emitted(current_record->u, current_record->v, current_record->point);
+
+        if (!current_record->material->scatter(current_ray, *current_record, attenuation, scattered_ray))
+        {
+            RT_STATISTIC(count_path_end(PathEnd::Absorbed));
+            return accumulated;
+        }
+
+        throughput = throughput * attenuation;
+        current_ray = scattered_ray;
+    }
+
+    RT_STATISTIC(count_path_end(PathEnd::MaxDepth));
+    return accumulated;
+}
+
+Color ray_color(const Ray& ray, const Color& background, const Hittable& world, int depth, int& path_length)
+{
+    HitRecord record;
+    const bool hit = depth > 0 && world.hit(ray, min_hit_parameter, infinity, record);
+    return ray_color(ray, hit, record, background, world, depth, path_length);
+}
+
+Color ray_color(const Ray& ray, const Color& background, const Hittable& world, int depth)
+{
+    int path_length;
+    return ray_color(ray, background, world, depth, path_length);
+}
+
+/*
+    Every pixel sample gets its own random stream, derived from the render seed, the
+    pixel and the sample index, so a render is reproducible for a given seed whatever
+    the number of threads or the order in which tiles are rendered.
+*/
+inline void seed_pixel_sample(std::uint64_t seed, int width, int row, int column, int sample)
+{
+    auto key = seed + 0x9e3779b97f4a7c15ull * (static_cast<std::uint64_t>(sample) + 1);
+    // splitmix64 finalizer, so consecutive samples get unrelated seeds
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ull;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebull;
+    key ^= key >> 31;
+
+    seed_random(key, static_cast<std::uint64_t>(row) * width + column);
+}
+
+/*
+    Renders the pixels of a block (rows bottom to top, columns left to right, at most
+    packet_size of them) sample by sample, with the camera rays of a sample traced as one
+    packet. Each lane is seeded like a pixel sample of the scalar path and shaded with its
+    own random stream, so the image is the same as when the rays are traced one at a time.
+
+    Returns the number of secondary rays traced. Diagnostics get the cost of the block
+    spread evenly over its pixels, since the pixels of a packet are traced together.
+*/
+std::uint64_t render_packet_block(const Hittable& world, const Camera& camera, const Color& background, const RenderSettings& settings,
+                                  int top, int left, int bottom, int right, Framebuffer& image, DiagnosticBuffer* diagnostics)
+{
+    const auto block_start = diagnostics ? read_cycle_counter() : 0;
+    std::uint64_t block_bvh_nodes = 0;
+    RT_STATISTIC(block_bvh_nodes = thread_counters().bvh_nodes_visited);
+
+    const auto block_width = settings.packet_size == 4 ? 2 : 4;
+    RayPacket packet;
+    packet.size = settings.packet_size;
+    PacketHits hits;
+    Color colors[RayPacket::max_size];
+    int path_lengths[RayPacket::max_size] = {};
+    std::uint32_t active = 0;
+    std::uint64_t secondary_rays = 0;
+
+    for (int lane = 0; lane < packet.size; ++lane)
+    {
+        const auto row = top - lane / block_width;
+        const auto column = left + lane % block_width;
+        active |= row >= bottom && column < right ? 1u << lane : 0u;
+    }
+
+    for (int sample = settings.first_sample; sample < settings.samples_per_pixel; ++sample)
+    {
+        for (int lane = 0; lane < packet.size; ++lane)
+        {
+            if (active & (1u << lane))
+            {
+                const auto row = top - lane / block_width;
+                const auto column = left + lane % block_width;
+                seed_pixel_sample(settings.seed, settings.image_width, row, column, sample);
+
+                auto u = (column + random_double()) / (settings.image_width - 1);
+                auto v = (row + random_double()) / (settings.image_height - 1);
+                packet.rays[lane] = camera.get_ray(u, v);
+                hits.generators[lane] = random_generator();
+            }
+        }
+
+        packet.prepare(active);
+        hits.reset(infinity);
+        if (settings.max_depth > 0)
+        {
+            world.hit_packet(packet, active, min_hit_parameter, hits);
+        }
+
+        for (int lane = 0; lane < packet.size; ++lane)
+        {
+            if (active & (1u << lane))
+            {
+                random_generator() = hits.generators[lane];
+
+                int path_length;
+                colors[lane] += ray_color(packet.rays[lane], (hits.hit_lanes >> lane) & 1u, hits.records[lane], background, world, settings.max_depth, path_length);
+                // No ray is traced at all with a max_depth of 0
+                secondary_rays += path_length > 0 ? path_length - 1 : 0;
+                path_lengths[lane] += path_length;
+            }
+        }
+    }
+
+    const auto pixels = RayPacket::count(active);
+    const auto block_cycles = diagnostics ? read_cycle_counter() - block_start : 0;
+    RT_STATISTIC(block_bvh_nodes = thread_counters().bvh_nodes_visited - block_bvh_nodes);
+
+    for (int lane = 0; lane < packet.size; ++lane)
+    {
+        if (active & (1u << lane))
+        {
+            const auto row = top - lane / block_width;
+            const auto column = left + lane % block_width;
+            image.at(row, column) = colors[lane];
+
+            if (diagnostics)
+            {
+                diagnostics->record(row, column, block_cycles / pixels, block_bvh_nodes / pixels,
+                                    static_cast<double>(path_lengths[lane]) / (settings.samples_per_pixel - settings.first_sample));
+            }
+        }
+    }
+
+    return secondary_rays;
+}
+
+/*
+    Renders the pixels of a tile (rows bottom to top, columns left to right) with the
+    wavefront renderer: the paths of a range of samples of every pixel make up a wave, of
+    at most max_wave_size paths, which wavefront traces stage by stage. The camera rays are
+    generated and the colors summed exactly like in the scalar path.
+
+    Returns the number of secondary rays traced. Diagnostics get the cost of the tile
+    spread evenly over its pixels.
+*/
+std::uint64_t render_wavefront_tile(const Hittable& world, const Camera& camera, const Color& background, const RenderSettings& settings,
+                                    int top, int left, int bottom, int right, Framebuffer& image, DiagnosticBuffer* diagnostics,
+                                    Wavefront& wavefront)
+{
+    constexpr int max_wave_size{1024};
+    const auto tile_start = diagnostics ? read_cycle_counter() : 0;
+    std::uint64_t tile_bvh_nodes = 0;
+    RT_STATISTIC(tile_bvh_nodes = thread_counters().bvh_nodes_visited);
+
+    const auto width = right - left;
+    const auto pixels = width * (top - bottom + 1);
+    const auto samples_per_wave = std::max(1, max_wave_size / pixels);
+    std::vector<Color> colors(pixels, Color{0, 0, 0});
+    std::vector<int> path_lengths(pixels, 0);
+    std::uint64_t secondary_rays = 0;
+
+    for (int first_sample = settings.first_sample; first_sample < settings.samples_per_pixel; first_sample += samples_per_wave)
+    {
+        const auto last_sample = std::min(first_sample + samples_per_wave, settings.samples_per_pixel);
+
+        // Path (sample - first_sample) * pixels + pixel, so a wave traces neighbouring pixels together
+        wavefront.clear();
+        for (int sample = first_sample; sample < last_sample; ++sample)
+        {
+            for (int pixel = 0; pixel < pixels; ++pixel)
+            {
+                const auto row = top - pixel / width;
+                const auto column = left + pixel % width;
+                seed_pixel_sample(settings.seed, settings.image_width, row, column, sample);
+
+                auto u = (column + random_double()) / (settings.image_width - 1);
+                auto v = (row + random_double()) / (settings.image_height - 1);
+                const auto ray = camera.get_ray(u, v);
+                wavefront.add(ray, random_generator());
+            }
+        }
+
+        wavefront.trace(world, background, settings.max_depth);
+
+        for (std::size_t path = 0; path < wavefront.size(); ++path)
+        {
+            colors[path % pixels] += wavefront.colors[path];
+            path_lengths[path % pixels] += wavefront.lengths[path];
+            secondary_rays += wavefront.lengths[path] > 0 ? wavefront.lengths[path] - 1 : 0;
+        }
+    }
+
+    const auto tile_cycles = diagnostics ? read_cycle_counter() - tile_start : 0;
+    RT_STATISTIC(tile_bvh_nodes = thread_counters().bvh_nodes_visited - tile_bvh_nodes);
+
+    for (int pixel = 0; pixel < pixels; ++pixel)
+    {
+        const auto row = top - pixel / width;
+        const auto column = left + pixel % width;
+        image.at(row, column) = colors[pixel];
+
+        if (diagnostics)
+        {
+            diagnostics->record(row, column, tile_cycles / pixels, tile_bvh_nodes / pixels,
+                                static_cast<double>(path_lengths[pixel]) / (settings.samples_per_pixel - settings.first_sample));
+        }
+    }
+
+    return secondary_rays;
+}
+
+// Number of tiles of the images of settings, see render_tile
+int tile_count(const RenderSettings& settings);
+
+// Pixels of tile: rows from top down to bottom, columns from left to right (excluded)
+void tile_bounds(const RenderSettings& settings, int tile, int& top, int& left, int& bottom, int& right);
+
+/*
+    Renders tile of image: the tiles are squares of tile_size pixels, numbered from the
+    top left corner of the image, left to right then top to bottom. Returns the number of
+    secondary rays traced.
+
+    With a packet_size of 4, 8 or 16, the tile is split into blocks of that many pixels
+    rendered by render_packet_block. With wavefront set, it's rendered by
+    render_wavefront_tile with the given wavefront instead, and packet_size is ignored.
+*/
+std::uint64_t render_tile(const Hittable& world, const Camera& camera, const Color& background, const RenderSettings& settings,
+                          int tile, Framebuffer& image, DiagnosticBuffer* diagnostics, Wavefront& wavefront);
+
+int tile_count(const RenderSettings& settings)
+{
+    const auto tiles_per_row = (settings.image_width + settings.tile_size - 1) / settings.tile_size;
+    const auto tiles_per_column = (settings.image_height + settings.tile_size - 1) / settings.tile_size;
+    return tiles_per_row * tiles_per_column;
+}
+
+void tile_bounds(const RenderSettings& settings, int tile, int& top, int& left, int& bottom, int& right)
+{
+    // Tiles are taken from the top of the image, like the scanlines used to be
+    const auto tiles_per_row = (settings.image_width + settings.tile_size - 1) / settings.tile_size;
+    top = settings.image_height - 1 - (tile / tiles_per_row) * settings.tile_size;
+    left = (tile % tiles_per_row) * settings.tile_size;
+    bottom = std::max(top - settings.tile_size + 1, 0);
+    right = std::min(left + settings.tile_size, settings.image_width);
+}
+
+std::uint64_t render_tile(const Hittable& world, const Camera& camera, const Color& background, const RenderSettings& settings,
+                          int tile, Framebuffer& image, DiagnosticBuffer* diagnostics, Wavefront& wavefront)
+{
+    ScopedTrace trace{"render", "tile", tile};
+    std::uint64_t secondary_rays = 0;
+
+    int top;
+    int left;
+    int bottom;
+    int right;
+    tile_bounds(settings, tile, top, left, bottom, right);
+    const auto packet_size = settings.packet_size == 4 || settings.packet_size == 8 || settings.packet_size == 16 ? settings.packet_size : 0;
+
+    if (settings.wavefront)
+    {
+        return render_wavefront_tile(world, camera, background, settings, top, left, bottom, right, image, diagnostics, wavefront);
+    }
+
+    if (packet_size)
+    {
+        const auto block_height = packet_size / (packet_size == 4 ? 2 : 4);
+        const auto block_width = packet_size / block_height;
+        for (int block_top = top; block_top >= bottom; block_top -= block_height)
+        {
+            for (int block_left = left; block_left < right; block_left += block_width)
+            {
+                secondary_rays += render_packet_block(world, camera, background, settings, block_top, block_left,
+                                                      std::max(block_top - block_height + 1, bottom),
+                                                      std::min(block_left + block_width, right), image, diagnostics);
+            }
+        }
+        return secondary_rays;
+    }
+
+    for (int row = top; row >= bottom; --row)
+    {
+        for (int column = left; column < right; ++column)
+        {
+            const auto pixel_start = diagnostics ? read_cycle_counter() : 0;
+            std::uint64_t pixel_bvh_nodes = 0;
+            RT_STATISTIC(pixel_bvh_nodes = thread_counters().bvh_nodes_visited);
+            int pixel_path_length = 0;
+
+            Color pixel_color{0.0, 0.0, 0.0};
+            for (int sample = settings.first_sample; sample < settings.samples_per_pixel; ++sample)
+            {
+                seed_pixel_sample(settings.seed, settings.image_width, row, column, sample);
+
+                auto u = (column + random_double()) / (settings.image_width - 1);
+                auto v = (row + random_double()) / (settings.image_height - 1);
+
+                int path_length;
+                Ray ray = camera.get_ray(u, v);
+                pixel_color += ray_color(ray, background, world, settings.max_depth, path_length);
+                secondary_rays += path_length > 0 ? path_length - 1 : 0;
+                pixel_path_length += path_length;
+            }
+
+            image.at(row, column) = pixel_color;
+
+            if (diagnostics)
+            {
+                RT_STATISTIC(pixel_bvh_nodes = thread_counters().bvh_nodes_visited - pixel_bvh_nodes);
+                diagnostics->record(row, column, read_cycle_counter() - pixel_start, pixel_bvh_nodes,
+                                    static_cast<double>(pixel_path_length) / (settings.samples_per_pixel - settings.first_sample));
+            }
+        }
+    }
+
+    return secondary_rays;
+}
+
+/*
+    Renders the image with render_tile; worker threads take the next tile from a shared
+    counter until every tile is done.
+
+    If diagnostics isn't null, it's resized to the image and gets the cost of every pixel.
+*/
+Framebuffer render(const Hittable& world, const Camera& camera, const Color& background, const RenderSettings& settings,
+                   RenderStatistics* statistics = nullptr, DiagnosticBuffer* diagnostics = nullptr)
+{
+    const auto start = std::chrono::steady_clock::now();
+    Framebuffer image{settings.image_width, settings.image_height};
+    if (diagnostics)
+    {
+        *diagnostics = DiagnosticBuffer{settings.image_width, settings.image_height};
+    }
+    RT_STATISTIC(reset_counters());
+
+    const auto tiles = tile_count(settings);
+    auto thread_count = settings.threads != 0 ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+    // At least the calling thread, even for an image without tiles
+    thread_count = std::max(1u, std::min<unsigned>(thread_count, tiles));
+
+    if (settings.packet_size != 0 && settings.packet_size != 4 && settings.packet_size != 8 && settings.packet_size != 16)
+    {
+        std::cerr << "Unsupported packet size " << settings.packet_size << ", tracing rays one at a time\n";
+    }
+
+    std::atomic<int> next_tile{0};
+    std::atomic<int> finished_tiles{0};
+    std::vector<std::uint64_t> secondary_rays(thread_count, 0);
+
+    auto worker = [&](unsigned thread_index)
+    {
+        std::uint64_t thread_secondary_rays = 0;
+        Wavefront wavefront;
+        wavefront.reorder_rays = settings.reorder_rays;
+
+        for (int tile = next_tile++; tile < tiles; tile = next_tile++)
+        {
+            thread_secondary_rays += render_tile(world, camera, background, settings, tile, image, diagnostics, wavefront);
+            ++finished_tiles;
+        }
+
+        secondary_rays[thread_index] = thread_secondary_rays;
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned thread_index = 1; thread_index < thread_count; ++thread_index)
+    {
+        threads.emplace_back(worker, thread_index);
+    }
+
+    if (settings.show_progress)
+    {
+        // The calling thread reports progress while the workers render
+        threads.emplace_back(worker, 0);
+        while (finished_tiles < tiles)
+        {
+            std::cerr << "\rTiles remaining: " << tiles - finished_tiles << ' ' << std::flush;
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+        std::cerr << "\rTiles remaining: 0 \n";
+    }
+    else
+    {
+        worker(0);
+    }
+
+    for (auto& thread: threads)
+    {
+        thread.join();
+    }
+
+    if (statistics)
+    {
+        // Camera rays are only traced with a max_depth of at least 1
+        statistics->primary_rays = settings.max_depth > 0
+            ? static_cast<std::uint64_t>(settings.image_width) * settings.image_height * (settings.samples_per_pixel - settings.first_sample)
+            : 0;
+        statistics->secondary_rays = 0;
+        for (auto rays: secondary_rays)
+        {
+            statistics->secondary_rays += rays;
+        }
+        statistics->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        RT_STATISTIC(statistics->counters = collect_counters());
+    }
+
+    return image;
+}
+
+#endif // RENDERER_HPP
@@ -1,14 +1,23 @@
+#ifndef SCENES_HPP
+#define SCENES_HPP
+
 #include "box.hpp"
 #include "bvh.hpp"
+#include "camera.hpp"
 #include "constant_medium.hpp"
+#include "grid_medium.hpp"
 #include "hittable.hpp"
 #include "material.hpp"
+#include "moving_sphere.hpp"
 #include "sphere.hpp"
+#include "trace.hpp"
 #include "transform.hpp"
 #include "vector3.hpp"
+#include <array>
 #include <fstream>
 #include <memory>
 #include <sstream>
+#include <string>
 
 enum class Scenes
 {
@@ -28,9 +37,55 @@ enum class Scenes
     // Custom scenes
     WikipediaPathTracing,
     RecursiveGlass,
-    PointCloud
+    PointCloud,
+    GridSmokeCornellBox,
+    BakedPerlinTexture
+};
+
+constexpr std::array<Scenes, 18> all_scenes{
+    Scenes::HollowGlass, Scenes::Random, Scenes::TwoCheckeredSpheres, Scenes::PerlinTexture,
+    Scenes::PerlinTextureRandomSpheres, Scenes::EarthSphere, Scenes::SimpleLight, Scenes::SimpleLightSphere,
+    Scenes::EmptyCornellBox, Scenes::TwoBlocksCornellBox, Scenes::ClassicCornellBox, Scenes::SmokeCornellBox,
+    Scenes::NextWeekFinal, Scenes::WikipediaPathTracing, Scenes::RecursiveGlass, Scenes::PointCloud,
+    Scenes::GridSmokeCornellBox, Scenes::BakedPerlinTexture
+};
+
+// Name of the scene, as used on command lines and in reports
+const char* scene_name(Scenes scene);
+
+// Returns false if no scene has that name
+bool scene_from_name(const std::string& name, Scenes& scene);
+
+// Everything needed to render a scene: the world and its default image and camera settings
+struct SceneSettings
+{
+    HittableList world;
+    Color background{0, 0, 0};
+
+    // Image settings
+    double aspect_ratio{16.0 / 9.0};
+    int image_width{1200};
+    int samples_per_pixel{100};
+    int max_depth{50};
+
+    // Camera settings; set distance_to_focus to 1.0 and aperture to 0.0 to remove depth of field/defocus blur
+    Point3 look_from;
+    Point3 look_at;
+    Vector3 view_up{0, 1, 0};
+    double vertical_fov{20.0};
+    double distance_to_focus{1.0};
+    double aperture{0.0};
+    double open_shutter_time{0.0};
+    double close_shutter_time{1.0};
+
+    int image_height() const;
+    // Camera for an image of the given height (its ray cones cover one pixel)
+    Camera camera(int height) const;
 };
 
+// Builds the world of the scene and sets its default image and camera settings
+SceneSettings scene_settings(Scenes scene, bool use_motion_blur = true);
+
 // Simple scene developed along the "In One Weekend" book using lambertian, metal and dielectrics materials
 HittableList hollow_glass_scene();
 
@@ -40,8 +95,15 @@ HittableList random_scene(bool use_motion_blur = false);
 // Two spheres with checkered textures
 HittableList two_checkered_spheres();
 
-// Two spheres with perlin textures
-HittableList two_perlin_spheres();
+/*
+Two spheres with perlin textures
+
+Arguments:
+    bake_textures: if bake_textures is true, the noise on the small sphere is baked
+    into a UV atlas (see BakedTexture) and the bake error and memory are reported;
+    this is the baked_perlin_texture scene.
+*/
+HittableList two_perlin_spheres(bool bake_textures = false);
 
 // Similar to random_scene, but replaces solid textures with noise textures using Perlin noise
 HittableList perlin_random_scene();
@@ -89,8 +151,229 @@ draw as a sphere.
 */
 HittableList point_cloud(bool ambient_light);
 
+/*
+Cornell Box with a heterogeneous cloud stored in a voxel grid.
+
+Arguments:
+    volume_filename: raw volume (64x64x64 floats) to load; if it's empty or can't be
+    loaded, a procedural cloud made with Perlin turbulence is used instead.
+*/
+HittableList grid_smoke_cornell_box(const std::string& volume_filename = "");
+
 // Scenes definitions
 
+const char* scene_name(Scenes scene)
+{
+    switch (scene)
+    {
+    case Scenes::HollowGlass: return "hollow_glass";
+    case Scenes::Random: return "random";
+    case Scenes::TwoCheckeredSpheres: return "two_checkered_spheres";
+    case Scenes::PerlinTexture: return "perlin_texture";
+    case Scenes::PerlinTextureRandomSpheres: return "perlin_texture_random_spheres";
+    case Scenes::EarthSphere: return "earth_sphere";
+    case Scenes::SimpleLight: return "simple_light";
+    case Scenes::SimpleLightSphere: return "simple_light_sphere";
+    case Scenes::EmptyCornellBox: return "empty_cornell_box";
+    case Scenes::TwoBlocksCornellBox: return "two_blocks_cornell_box";
+    case Scenes::ClassicCornellBox: return "classic_cornell_box";
+    case Scenes::SmokeCornellBox: return "smoke_cornell_box";
+    case Scenes::NextWeekFinal: return "next_week_final";
+    case Scenes::WikipediaPathTracing: return "wikipedia_path_tracing";
+    case Scenes::RecursiveGlass: return "recursive_glass";
+    case Scenes::PointCloud: return "point_cloud";
+    case Scenes::GridSmokeCornellBox: return "grid_smoke_cornell_box";
+    case Scenes::BakedPerlinTexture: return "baked_perlin_texture";
+    }
+
+    return "unknown";
+}
+
+bool scene_from_name(const std::string& name, Scenes& scene)
+{
+    for (auto candidate: all_scenes)
+    {
+        if (name == scene_name(candidate))
+        {
+            scene = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int SceneSettings::image_height() const
+{
+    return static_cast<int>(image_width / aspect_ratio);
+}
+
+Camera SceneSettings::camera(int height) const
+{
+    Camera camera{look_from, look_at, view_up, vertical_fov, aspect_ratio, aperture, distance_to_focus, open_shutter_time, close_shutter_time};
+    camera.set_image_height(height);
+    return camera;
+}
+
+SceneSettings scene_settings(Scenes scene, bool use_motion_blur)
+{
+    ScopedTrace trace{"scene", scene_name(scene)};
+    SceneSettings settings;
+
+    switch (scene)
+    {
+    case Scenes::HollowGlass:
+        settings.look_from = Point3{3, 3, 2};
+        settings.look_at = Point3{0, 0, -1};
+        settings.aperture = 0.1;
+        settings.distance_to_focus = (settings.look_from - settings.look_at).length();
+        settings.world = hollow_glass_scene();
+        settings.background = Color{0.70, 0.80, 1.00};
+        break;
+    case Scenes::Random:
+        settings.look_from = Point3{13, 2, 3};
+        settings.look_at = Point3{0, 0, 0};
+        settings.aperture = 0.1;
+        settings.distance_to_focus = 10.0;
+        settings.world = random_scene(use_motion_blur);
+        settings.background = Color{0.70, 0.80, 1.00};
+        break;
+    case Scenes::TwoCheckeredSpheres:
+        settings.look_from = Point3{13, 2, 3};
+        settings.look_at = Point3{0, 0, 0};
+        settings.distance_to_focus = 10.0;
+        settings.world = two_checkered_spheres();
+        settings.background = Color{0.70, 0.80, 1.00};
+        break;
+    case Scenes::PerlinTexture:
+        settings.look_from = Point3{13, 2, 3};
+        settings.look_at = Point3{0, 0, 0};
+        settings.distance_to_focus = 10.0;
+        settings.world = two_perlin_spheres();
+        settings.background = Color{0.70, 0.80, 1.00};
+        break;
+    case Scenes::PerlinTextureRandomSpheres:
+        settings.look_from = Point3{13, 2, 3};
+        settings.look_at = Point3{0, 0, 0};
+        settings.aperture = 0.1;
+        settings.distance_to_focus = 10.0;
+        settings.world = perlin_random_scene();
+        settings.background = Color{0.70, 0.80, 1.00};
+        break;
+    case Scenes::EarthSphere:
+        settings.look_from = Point3{13, 2, 3};
+        settings.look_at = Point3{0, 0, 0};
+        settings.world = earth_sphere();
+        settings.background = Color{0.70, 0.80, 1.00};
+        break;
+    case Scenes::SimpleLight:
+        settings.look_from = Point3{26, 3, 6};
+        settings.look_at = Point3{0, 2, 0};
+        settings.world = simple_light();
+        break;
+    case Scenes::SimpleLightSphere:
+        settings.look_from = Point3{26, 3, 6};
+        settings.look_at = Point3{0, 2, 0};
+        settings.world = simple_light_with_sphere();
+        break;
+    case Scenes::EmptyCornellBox:
+        settings.aspect_ratio = 1.0;
+        settings.image_width = 600;
+        settings.look_from = Point3{278, 278, -800};
+        settings.look_at = Point3{278, 278, 0};
+        settings.vertical_fov = 40.0;
+        settings.world = empty_cornell_box();
+        break;
+    case Scenes::TwoBlocksCornellBox:
+        settings.aspect_ratio = 1.0;
+        settings.image_width = 600;
+        settings.samples_per_pixel = 200;
+        settings.look_from = Point3{278, 278, -800};
+        settings.look_at = Point3{278, 278, 0};
+        settings.vertical_fov = 40.0;
+        settings.world = two_blocks_cornell_box();
+        break;
+    case Scenes::ClassicCornellBox:
+        settings.aspect_ratio = 1.0;
+        settings.image_width = 600;
+        settings.samples_per_pixel = 200;
+        settings.look_from = Point3{278, 278, -800};
+        settings.look_at = Point3{278, 278, 0};
+        settings.vertical_fov = 40.0;
+        settings.world = classic_cornell_box();
+        break;
+    case Scenes::SmokeCornellBox:
+        settings.aspect_ratio = 1.0;
+        settings.image_width = 600;
+        settings.samples_per_pixel = 200;
+        settings.look_from = Point3{278, 278, -800};
+        settings.look_at = Point3{278, 278, 0};
+        settings.vertical_fov = 40.0;
+        settings.world = smoke_cornell_box();
+        break;
+    case Scenes::NextWeekFinal:
+        settings.aspect_ratio = 1.0;
+        settings.image_width = 800;
+        settings.samples_per_pixel = 1000;
+        settings.look_from = Point3{478, 278, -600};
+        settings.look_at = Point3{278, 278, 0};
+        settings.vertical_fov = 40.0;
+        settings.world = next_week_final_scene();
+        break;
+    case Scenes::WikipediaPathTracing:
+        settings.aspect_ratio = 3.0 / 2.0; // 1200x800
+        settings.look_from = Point3{0, 13, 30};
+        settings.look_at = Point3{0, 3, 0};
+        settings.background = Color{1.0, 1.0, 1.0};
+        //settings.background = Color{0.0, 0.0, 0.0};
+        if (settings.background != Color{0, 0, 0})
+        {
+            settings.samples_per_pixel = 200;
+            settings.world = wikipedia_path_tracing_scene();
+        }
+        else
+        {
+            settings.samples_per_pixel = 500; // More rays are needed because of the small light source
+            settings.world = wikipedia_path_tracing_scene(false);
+        }
+        break;
+    case Scenes::RecursiveGlass:
+        settings.look_from = Point3{0, 1, 6};
+        settings.look_at = Point3{0, 1, 0};
+        settings.world = recursive_glass();
+        settings.background = Color{1.0, 1.0, 1.0};
+        break;
+    case Scenes::PointCloud:
+        settings.aspect_ratio = 3.0 / 2.0; // 1200x800
+        settings.look_from = Point3{0, 4, 10};
+        settings.look_at = Point3{-0.25, 1.5, 0};
+        settings.aperture = 0.0;
+        settings.distance_to_focus = 1.0;
+        //settings.background = Color{0.70, 0.80, 1.00};
+        settings.background = Color{0, 0, 0};
+        settings.world = point_cloud(settings.background != Color{0, 0, 0}); 
+        break;
+    case Scenes::GridSmokeCornellBox:
+        settings.aspect_ratio = 1.0;
+        settings.image_width = 600;
+        settings.samples_per_pixel = 200;
+        settings.look_from = Point3{278, 278, -800};
+        settings.look_at = Point3{278, 278, 0};
+        settings.vertical_fov = 40.0;
+        settings.world = grid_smoke_cornell_box();
+        break;
+    case Scenes::BakedPerlinTexture:
+        settings.look_from = Point3{13, 2, 3};
+        settings.look_at = Point3{0, 0, 0};
+        settings.distance_to_focus = 10.0;
+        settings.world = two_perlin_spheres(true);
+        settings.background = Color{0.70, 0.80, 1.00};
+        break;
+    }
+
+    return settings;
+}
+
 HittableList hollow_glass_scene()
 {
     HittableList world;
@@ -188,13 +471,27 @@ HittableList two_checkered_spheres()
     return objects;
 }
 
-HittableList two_perlin_spheres()
+HittableList two_perlin_spheres(bool bake_textures)
 {
     HittableList objects;
 
     auto perlin_texture = std::make_shared<NoiseTexture>(4);
     objects.add(std::make_shared<Sphere>(Point3{0, -1000, 0}, 1000, std::make_shared<Lambertian>(perlin_texture)));
-    objects.add(std::make_shared<Sphere>(Point3{0, 2, 0}, 2, std::make_shared<Lambertian>(perlin_texture)));
+
+    if (!bake_textures)
+    {
+        objects.add(std::make_shared<Sphere>(Point3{0, 2, 0}, 2, std::make_shared<Lambertian>(perlin_texture)));
+        return objects;
+    }
+
+    // Bake 1024 x 1024 texels: about 0.012 units apart along the equator, 0.006 from pole to pole
+    Sphere shape{Point3{0, 2, 0}, 2, nullptr};
+    auto baked_texture = std::make_shared<BakedTexture>(perlin_texture, [shape](double u, double v) { return shape.surface_point(u, v); }, 1024);
+    auto bake_report = baked_texture->report();
+    std::cerr << "Baked noise texture: " << bake_report.memory_bytes / 1024 << " KiB, RMS error " << bake_report.rms_error
+              << ", max error " << bake_report.max_error << ", " << bake_report.bake_milliseconds << " ms\n";
+
+    objects.add(std::make_shared<Sphere>(Point3{0, 2, 0}, 2, std::make_shared<Lambertian>(baked_texture)));
 
     return objects;
 }
@@ -550,6 +847,7 @@ HittableList point_cloud(bool ambient_light)
 
     if (input_file.is_open())
     {
+        ScopedTrace trace{"scene", "load obj", filename};
         std::string line;
 
         while (std::getline(input_file, line))
@@ -586,4 +884,61 @@ HittableList point_cloud(bool ambient_light)
     
 
     return world;
-}
\ No newline at end of file
+}
+
+HittableList grid_smoke_cornell_box(const std::string& volume_filename)
+{
+    HittableList objects;
+
+    auto red = std::make_shared<Lambertian>(Color{0.65, 0.05, 0.05});
+    auto white = std::make_shared<Lambertian>(Color{0.73, 0.73, 0.73});
+    auto green = std::make_shared<Lambertian>(Color{0.12, 0.45, 0.15});
+    auto light = std::make_shared<DiffuseLight>(Color{7, 7, 7});
+
+    // Walls and light source
+    objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 555, green));
+    objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 0, red));
+    objects.add(std::make_shared<XZRect>(113, 443, 127, 432, 554, light));
+    objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 555, white));
+    objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 0, white));
+    objects.add(std::make_shared<XYRect>(0, 555, 0, 555, 555, white));
+
+    constexpr int resolution = 64;
+    auto grid = std::make_shared<DensityGrid>();
+
+    if (!volume_filename.empty())
+    {
+        *grid = DensityGrid::load_raw(volume_filename, resolution, resolution, resolution, true);
+    }
+
+    if (grid->empty())
+    {
+        // Procedural cloud: turbulence modulated by a spherical falloff, so the corners stay empty
+        Perlin noise;
+        std::vector<float> densities(resolution * resolution * resolution);
+
+        for (int z = 0; z < resolution; ++z)
+        {
+            for (int y = 0; y < resolution; ++y)
+            {
+                for (int x = 0; x < resolution; ++x)
+                {
+                    Point3 local{(x + 0.5) / resolution - 0.5, (y + 0.5) / resolution - 0.5, (z + 0.5) / resolution - 0.5};
+                    auto falloff = 1.0 - 2.0 * local.length();
+                    auto density = falloff * (0.5 + noise.turbulence(4.0 * local)) - 0.15;
+
+                    densities[(z * resolution + y) * resolution + x] = static_cast<float>(std::fmax(0.0, density));
+                }
+            }
+        }
+
+        *grid = DensityGrid{resolution, resolution, resolution, densities, true};
+    }
+
+    AABB cloud_bounds{Point3{100, 50, 100}, Point3{455, 405, 455}};
+    objects.add(std::make_shared<GridMedium>(grid, cloud_bounds, 0.05, Color{0.9, 0.9, 0.9}));
+
+    return objects;
+}
+
+#endif // SCENES_HPP
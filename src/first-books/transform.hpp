@@ -18,23 +18,33 @@ public:
 
     virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const override;
     virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const override;
+    virtual bool occluded(const Ray& ray, double min_parameter, double max_parameter) const override;
 };
 
 bool Translate::hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const
 {
-    Ray moved_ray{ray.origin() - offset, ray.direction(), ray.time()};
+    Ray moved_ray{ray.origin() - offset, ray.direction(), ray.time(), ray.cone_width, ray.cone_spread};
 
     if (!instance->hit(moved_ray, min_parameter, max_parameter, record))
     {
         return false;
     }
 
+    // The attributes are computed in the instance's space, with the moved ray
+    finish_hit(moved_ray, record);
+
     record.point += offset;
     record.set_face_normal(moved_ray, record.normal);
 
     return true;
 }
 
+bool Translate::occluded(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    Ray moved_ray{ray.origin() - offset, ray.direction(), ray.time(), ray.cone_width, ray.cone_spread};
+    return instance->occluded(moved_ray, min_parameter, max_parameter);
+}
+
 bool Translate::bounding_box(double start_time, double end_time, AABB& output_box) const
 {
     if (!instance->bounding_box(start_time, end_time, output_box))
@@ -50,6 +60,7 @@ class RotateY: public Hittable
 {
 public:
     std::shared_ptr<Hittable> instance;
+    double angle; // in degrees
     double sin_theta;
     double cos_theta;
     bool has_box;
@@ -57,12 +68,25 @@ public:
 
     RotateY(std::shared_ptr<Hittable> object, double angle);
 
+    // Rotates the instance by angle degrees instead, for animations; the BVHs above it must be refitted
+    void set_angle(double degrees);
+
     virtual bool hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const override;
     virtual bool bounding_box(double start_time, double end_time, AABB& output_box) const override;
+    virtual bool occluded(const Ray& ray, double min_parameter, double max_parameter) const override;
+private:
+    // The ray in the space of the instance
+    Ray rotated(const Ray& ray) const;
 };
 
 RotateY::RotateY(std::shared_ptr<Hittable> object, double angle): instance{object}
 {
+    set_angle(angle);
+}
+
+void RotateY::set_angle(double degrees)
+{
+    angle = degrees;
     auto radians = degrees_to_radians(angle);
     sin_theta = std::sin(radians);
     cos_theta = std::cos(radians);
@@ -97,7 +121,7 @@ RotateY::RotateY(std::shared_ptr<Hittable> object, double angle): instance{objec
     box = AABB{min, max};
 }
 
-bool RotateY::hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const
+Ray RotateY::rotated(const Ray& ray) const
 {
     auto origin = ray.origin();
     auto direction = ray.direction();
@@ -108,13 +132,20 @@ bool RotateY::hit(const Ray& ray, double min_parameter, double max_parameter, Hi
     direction[0] = cos_theta * ray.direction()[0] - sin_theta * ray.direction()[2];
     direction[2] = sin_theta * ray.direction()[0] + cos_theta * ray.direction()[2];
 
-    Ray rotated_ray{origin, direction, ray.time()};
+    return Ray{origin, direction, ray.time(), ray.cone_width, ray.cone_spread};
+}
+
+bool RotateY::hit(const Ray& ray, double min_parameter, double max_parameter, HitRecord& record) const
+{
+    const auto rotated_ray = rotated(ray);
 
     if (!instance->hit(rotated_ray, min_parameter, max_parameter, record))
     {
         return false;
     }
 
+    finish_hit(rotated_ray, record);
+
     auto hit_point = record.point;
     auto normal = record.normal;
 
@@ -130,6 +161,11 @@ bool RotateY::hit(const Ray& ray, double min_parameter, double max_parameter, Hi
     return true;
 }
 
+bool RotateY::occluded(const Ray& ray, double min_parameter, double max_parameter) const
+{
+    return instance->occluded(rotated(ray), min_parameter, max_parameter);
+}
+
 bool RotateY::bounding_box(double start_time, double end_time, AABB& output_box) const
 {
     output_box = box;
@@ -0,0 +1,300 @@
+#ifndef WAVEFRONT_HPP
+#define WAVEFRONT_HPP
+
+#include "color.hpp"
+#include "hittable.hpp"
+#include "material.hpp"
+#include "ray.hpp"
+#include "statistics.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+/*
+    Wavefront path tracing: instead of following one path from the camera to its end, as
+    ray_color does, a whole wave of paths advances one bounce at a time through separate
+    stages, each of which runs over every live path before the next one starts:
+
+    - extension: closest hit of the ray of every live path; paths that miss everything
+      take the background color and end;
+    - emission: light emitted at the hits;
+    - shading: the hits are sorted by material type, then material, and each run of hits
+      of one material is scattered at once with Material::scatter_batch, so the same code
+      and data stay in cache (Lambertian looks its texture up for the whole run, which for
+      noise textures is vectorized); paths whose hit absorbs the ray end;
+    - compaction: the paths that scattered, in the order they were traced, are the next wave.
+
+    The state of the paths is kept as structure of arrays, indexed by path. Every path
+    owns its random stream and the stages draw from it in the same order as ray_color, so
+    a path gets the same color as when traced by ray_color (up to float rounding in
+    vectorized texture lookups).
+
+    The materials only sample the scattered direction, with no light sampling, so there
+    are no shadow rays to trace in a separate stage.
+
+    With reorder_rays set, the secondary rays of every bounce are sorted before the
+    extension stage by direction octant, then by the Morton code of their origin within the
+    bounds of the wave: rays leaving the same region in similar directions are traced one
+    after the other, so they find the BVH nodes they share still in cache.
+*/
+class Wavefront
+{
+public:
+    // State of every path
+    std::vector<Ray> rays;
+    std::vector<Color> throughputs;
+    std::vector<Color> colors;
+    std::vector<RandomGenerator> generators;
+    std::vector<int> lengths;
+
+    bool reorder_rays{false};
+
+    std::size_t size() const;
+    void clear();
+
+    // Adds a path starting with ray, whose random stream continues from generator
+    void add(const Ray& ray, const RandomGenerator& generator);
+
+    /*
+        Traces every path to its end: colors[path] and lengths[path] are then the color
+        and path length ray_color would return and set.
+    */
+    void trace(const Hittable& world, const Color& background, int max_depth);
+private:
+    // Hit of a live path, sorted by material type then material for shading
+    struct ShadingKey
+    {
+        const std::type_info* type;
+        const Material* material;
+        std::uint32_t path;
+    };
+
+    std::vector<HitRecord> records;
+    // Whether the path scattered at its last hit
+    std::vector<char> scattered;
+    // Live paths, in the order they're traced
+    std::vector<std::uint32_t> active;
+    std::vector<ShadingKey> shading;
+    // Sort keys of the live paths, for reordering
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> ray_keys;
+    ScatterBatch batch;
+
+    void reorder();
+    void extend(const Hittable& world, const Color& background);
+    void emit();
+    void sort_by_material();
+    void shade(std::size_t first, std::size_t last);
+};
+
+std::size_t Wavefront::size() const
+{
+    return rays.size();
+}
+
+void Wavefront::clear()
+{
+    rays.clear();
+    throughputs.clear();
+    colors.clear();
+    generators.clear();
+    lengths.clear();
+}
+
+void Wavefront::add(const Ray& ray, const RandomGenerator& generator)
+{
+    rays.push_back(ray);
+    throughputs.push_back(Color{1, 1, 1});
+    colors.push_back(Color{0, 0, 0});
+    generators.push_back(generator);
+    lengths.push_back(0);
+}
+
+void Wavefront::trace(const Hittable& world, const Color& background, int max_depth)
+{
+    records.resize(size());
+    scattered.assign(size(), 0);
+    active.resize(size());
+    for (std::size_t path = 0; path < size(); ++path)
+    {
+        active[path] = static_cast<std::uint32_t>(path);
+    }
+
+    for (int depth = max_depth; depth > 0 && !active.empty(); --depth)
+    {
+        // Camera rays are already coherent, in pixel order
+        if (reorder_rays && depth < max_depth)
+        {
+            reorder();
+        }
+
+        extend(world, background);
+        emit();
+        sort_by_material();
+
+        std::size_t first = 0;
+        while (first < shading.size())
+        {
+            auto last = first + 1;
+            while (last < shading.size() && shading[last].material == shading[first].material)
+            {
+                ++last;
+            }
+
+            shade(first, last);
+            first = last;
+        }
+
+        // Compaction: the paths that scattered, in the order they were traced, so camera rays stay in pixel order
+        active.erase(std::remove_if(active.begin(), active.end(), [this](std::uint32_t path) { return !scattered[path]; }), active.end());
+    }
+
+    RT_STATISTIC(thread_counters().path_end_counts[static_cast<std::size_t>(PathEnd::MaxDepth)] += active.size());
+    active.clear();
+}
+
+// Spreads the 10 low bits of value so there are two zero bits between each of them
+inline std::uint32_t spread_bits(std::uint32_t value)
+{
+    value &= 0x3ff;
+    value = (value | (value << 16)) & 0x030000ff;
+    value = (value | (value << 8)) & 0x0300f00f;
+    value = (value | (value << 4)) & 0x030c30c3;
+    value = (value | (value << 2)) & 0x09249249;
+    return value;
+}
+
+/*
+    The key is the direction octant (one sign bit per axis) above a 30 bit Morton code
+    of the origin quantized to 1024 steps per axis over the bounds of the live origins.
+*/
+void Wavefront::reorder()
+{
+    Point3 minimum{infinity, infinity, infinity};
+    Point3 maximum{-infinity, -infinity, -infinity};
+    for (auto path: active)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            minimum[axis] = std::fmin(minimum[axis], rays[path].origin()[axis]);
+            maximum[axis] = std::fmax(maximum[axis], rays[path].origin()[axis]);
+        }
+    }
+
+    ray_keys.clear();
+    for (auto path: active)
+    {
+        const auto& ray = rays[path];
+        std::uint64_t key = (ray.direction().x() < 0 ? 4u : 0u) | (ray.direction().y() < 0 ? 2u : 0u) | (ray.direction().z() < 0 ? 1u : 0u);
+
+        std::uint32_t morton = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const auto extent = maximum[axis] - minimum[axis];
+            const auto cell = extent > 0.0 ? static_cast<std::uint32_t>(1023.0 * (ray.origin()[axis] - minimum[axis]) / extent) : 0u;
+            morton |= spread_bits(cell) << (2 - axis);
+        }
+
+        key = (key << 30) | morton;
+        ray_keys.emplace_back(key, path);
+    }
+
+    std::sort(ray_keys.begin(), ray_keys.end());
+    for (std::size_t i = 0; i < ray_keys.size(); ++i)
+    {
+        active[i] = ray_keys[i].second;
+    }
+}
+
+void Wavefront::extend(const Hittable& world, const Color& background)
+{
+    shading.clear();
+
+    for (auto path: active)
+    {
+        RT_STATISTIC(count_ray(lengths[path]));
+        ++lengths[path];
+        records[path] = HitRecord{};
+
+        // Participating media draw random numbers while intersecting
+        std::swap(random_generator(), generators[path]);
+        const bool hit = world.hit(rays[path], min_hit_parameter, infinity, records[path]);
+        std::swap(random_generator(), generators[path]);
+
+        scattered[path] = 0;
+        if (hit)
+        {
+            finish_hit(rays[path], records[path]);
+            const auto material = records[path].material.get();
+            shading.push_back(ShadingKey{&typeid(*material), material, path});
+        }
+        else
+        {
+            RT_STATISTIC(count_path_end(PathEnd::Escaped));
+            colors[path] = colors[path] + throughputs[path] * background;
+        }
+    }
+}
+
+void Wavefront::emit()
+{
+    for (const auto& key: shading)
+    {
+        const auto path = key.path;
+        const auto& record = records[path];
+        colors[path] += throughputs[path] * record.material->emitted(record.u, record.v, record.point);
+    }
+}
+
+void Wavefront::sort_by_material()
+{
+    std::sort(shading.begin(), shading.end(), [](const ShadingKey& first, const ShadingKey& second)
+    {
+        if (first.type != second.type)
+        {
+            return std::less<const std::type_info*>{}(first.type, second.type);
+        }
+        if (first.material != second.material)
+        {
+            return std::less<const Material*>{}(first.material, second.material);
+        }
+        return first.path < second.path;
+    });
+}
+
+// Scatters the hits shading[first, last[, which all have the same material
+void Wavefront::shade(std::size_t first, std::size_t last)
+{
+    batch.resize(last - first);
+    for (std::size_t i = 0; i < batch.size(); ++i)
+    {
+        const auto path = shading[first + i].path;
+        batch.incoming_rays[i] = &rays[path];
+        batch.records[i] = &records[path];
+        batch.generators[i] = &generators[path];
+    }
+
+    shading[first].material->scatter_batch(batch);
+
+    for (std::size_t i = 0; i < batch.size(); ++i)
+    {
+        const auto path = shading[first + i].path;
+        if (!batch.scattered[i])
+        {
+            RT_STATISTIC(count_path_end(PathEnd::Absorbed));
+            continue;
+        }
+
+        throughputs[path] = throughputs[path] * batch.attenuations[i];
+        rays[path] = batch.scattered_rays[i];
+        scattered[path] = 1;
+    }
+}
+
+#endif // WAVEFRONT_HPP